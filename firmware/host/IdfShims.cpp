@@ -0,0 +1,373 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstring>
+#include <driver/gpio.h>
+#include <esp_cpu.h>
+#include <esp_err.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <esp_pthread.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+#include <malloc.h>
+#include <map>
+#include <mutex>
+#include <nvs_flash.h>
+#include <random>
+#include <sched.h>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_NVS_NOT_INITIALIZED: return "ESP_ERR_NVS_NOT_INITIALIZED";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_INVALID_HANDLE: return "ESP_ERR_NVS_INVALID_HANDLE";
+        case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+        case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+    }
+    return "UNKNOWN ERROR";
+}
+
+/*******************************************************************************
+ * esp_log
+ ******************************************************************************/
+
+/// Default log level, used for tags without a specific level.
+static std::atomic<esp_log_level_t> log_default_level{ESP_LOG_INFO};
+
+/// Set when @ref log_tag_levels is not empty, avoids the lookup for the
+/// common case of not having any tag specific levels.
+static std::atomic<bool> log_has_tag_levels{false};
+
+/// Tag specific log levels.
+static std::map<std::string, esp_log_level_t> log_tag_levels;
+
+/// Protects @ref log_tag_levels.
+static std::shared_mutex log_tag_levels_mux;
+
+/// Serializes log output so that lines from different threads do not mix.
+static std::mutex log_output_mux;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    if (!strcmp(tag, "*"))
+    {
+        // as with ESP-IDF, setting the default level clears all tag
+        // specific levels.
+        const std::unique_lock<std::shared_mutex> lock(log_tag_levels_mux);
+        log_tag_levels.clear();
+        log_has_tag_levels = false;
+        log_default_level = level;
+        return;
+    }
+    const std::unique_lock<std::shared_mutex> lock(log_tag_levels_mux);
+    log_tag_levels[tag] = level;
+    log_has_tag_levels = true;
+}
+
+bool esp_log_enabled(const char *tag, esp_log_level_t level)
+{
+    if (log_has_tag_levels.load(std::memory_order_relaxed))
+    {
+        const std::shared_lock<std::shared_mutex> lock(log_tag_levels_mux);
+        if (auto it = log_tag_levels.find(tag); it != log_tag_levels.end())
+        {
+            return level <= it->second;
+        }
+    }
+    return level <= log_default_level.load(std::memory_order_relaxed);
+}
+
+void esp_log_write(esp_log_level_t, const char *, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    const std::lock_guard<std::mutex> lock(log_output_mux);
+    vprintf(format, args);
+    va_end(args);
+}
+
+/*******************************************************************************
+ * esp_timer
+ ******************************************************************************/
+
+int64_t esp_timer_get_time()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+/*******************************************************************************
+ * esp_pthread
+ ******************************************************************************/
+
+esp_pthread_cfg_t esp_pthread_get_default_config()
+{
+    esp_pthread_cfg_t cfg = {};
+    cfg.stack_size = 3072;
+    cfg.prio = 5;
+    cfg.inherit_cfg = false;
+    cfg.thread_name = nullptr;
+    cfg.pin_to_core = -1;
+    return cfg;
+}
+
+esp_err_t esp_pthread_set_cfg(const esp_pthread_cfg_t *cfg)
+{
+    return cfg != nullptr ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+/*******************************************************************************
+ * esp_cpu
+ ******************************************************************************/
+
+int esp_cpu_get_core_id()
+{
+    const int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : cpu % portNUM_PROCESSORS;
+}
+
+/*******************************************************************************
+ * esp_heap_caps
+ ******************************************************************************/
+
+/// Size of the heap reported by @ref heap_caps_get_free_size, the host heap
+/// has no fixed size so only differences between calls are meaningful.
+static constexpr std::size_t HOST_HEAP_SIZE = 1024 * 1024 * 1024;
+
+std::size_t heap_caps_get_free_size(uint32_t)
+{
+    const std::size_t used = mallinfo2().uordblks;
+    return used < HOST_HEAP_SIZE ? HOST_HEAP_SIZE - used : 0;
+}
+
+/*******************************************************************************
+ * esp_random
+ ******************************************************************************/
+
+/// Random number generator, seeded with a fixed value so that runs are
+/// repeatable.
+static std::mt19937 random_engine(0x45535033);
+
+/// Protects @ref random_engine.
+static std::mutex random_mux;
+
+uint32_t esp_random()
+{
+    const std::lock_guard<std::mutex> lock(random_mux);
+    return random_engine();
+}
+
+void esp_fill_random(void *buf, size_t len)
+{
+    uint8_t *data = static_cast<uint8_t *>(buf);
+    for (size_t idx = 0; idx < len; idx++)
+    {
+        data[idx] = esp_random() & 0xFF;
+    }
+}
+
+/*******************************************************************************
+ * esp_app_desc
+ ******************************************************************************/
+
+const esp_app_desc_t *esp_app_get_description()
+{
+    static esp_app_desc_t desc = []()
+    {
+        esp_app_desc_t desc = {};
+        strncpy(desc.version, "host", sizeof(desc.version) - 1);
+        strncpy(desc.project_name, "Esp32FeederController",
+                sizeof(desc.project_name) - 1);
+        strncpy(desc.time, __TIME__, sizeof(desc.time) - 1);
+        strncpy(desc.date, __DATE__, sizeof(desc.date) - 1);
+        strncpy(desc.idf_ver, "host", sizeof(desc.idf_ver) - 1);
+        return desc;
+    }();
+    return &desc;
+}
+
+/*******************************************************************************
+ * nvs
+ ******************************************************************************/
+
+/// Contents of all NVS namespaces, keyed by namespace and then key.
+static std::map<std::string, std::map<std::string, std::vector<uint8_t>>>
+    nvs_data;
+
+/// Namespace for each open handle, handles are one based.
+static std::vector<std::string> nvs_handles;
+
+/// Protects @ref nvs_data and @ref nvs_handles.
+static std::mutex nvs_mux;
+
+esp_err_t nvs_flash_init()
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t, nvs_handle_t *handle)
+{
+    const std::lock_guard<std::mutex> lock(nvs_mux);
+    nvs_handles.emplace_back(name);
+    *handle = nvs_handles.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value,
+                       size_t *length)
+{
+    const std::lock_guard<std::mutex> lock(nvs_mux);
+    if (!handle || handle > nvs_handles.size())
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    auto &space = nvs_data[nvs_handles[handle - 1]];
+    auto it = space.find(key);
+    if (it == space.end())
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (value == nullptr)
+    {
+        *length = it->second.size();
+        return ESP_OK;
+    }
+    if (*length < it->second.size())
+    {
+        *length = it->second.size();
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(value, it->second.data(), it->second.size());
+    *length = it->second.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key,
+                       const void *value, size_t length)
+{
+    const std::lock_guard<std::mutex> lock(nvs_mux);
+    if (!handle || handle > nvs_handles.size())
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    const uint8_t *data = static_cast<const uint8_t *>(value);
+    nvs_data[nvs_handles[handle - 1]][key].assign(data, data + length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    const std::lock_guard<std::mutex> lock(nvs_mux);
+    if (!handle || handle > nvs_handles.size())
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    return nvs_data[nvs_handles[handle - 1]].erase(key) ?
+        ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    const std::lock_guard<std::mutex> lock(nvs_mux);
+    return handle && handle <= nvs_handles.size() ?
+        ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+void nvs_close(nvs_handle_t)
+{
+    // handles are not reused so there is nothing to release.
+}
+
+/*******************************************************************************
+ * gpio
+ ******************************************************************************/
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    return config != nullptr ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_install_isr_service(int)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t, gpio_isr_t, void *)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t)
+{
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t)
+{
+    // interrupt pins are active low and idle high with the pull-up.
+    return 1;
+}
+
+/*******************************************************************************
+ * FreeRTOS
+ ******************************************************************************/
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex()
+{
+    return new std::recursive_timed_mutex();
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticks)
+{
+    auto *mux = static_cast<std::recursive_timed_mutex *>(mutex);
+    if (ticks == portMAX_DELAY)
+    {
+        mux->lock();
+        return pdTRUE;
+    }
+    return mux->try_lock_for(std::chrono::milliseconds(ticks)) ?
+        pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex)
+{
+    static_cast<std::recursive_timed_mutex *>(mutex)->unlock();
+    return pdTRUE;
+}
+
+BaseType_t xTimerPendFunctionCallFromISR(PendedFunction_t function,
+                                         void *arg1, uint32_t arg2,
+                                         BaseType_t *woken)
+{
+    function(arg1, arg2);
+    if (woken != nullptr)
+    {
+        *woken = pdFALSE;
+    }
+    return pdPASS;
+}
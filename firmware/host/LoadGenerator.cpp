@@ -0,0 +1,474 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <esp_timer.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "BinaryServer.hxx"
+#include "LoadGenerator.hxx"
+
+/// @return true if @param line is the acknowledgement of a command.
+static bool is_response(const std::string &line, bool &ok)
+{
+    if (line.rfind("ok", 0) == 0)
+    {
+        ok = true;
+        return true;
+    }
+    if (line.rfind("error", 0) == 0)
+    {
+        ok = false;
+        return true;
+    }
+    return false;
+}
+
+LoadGenerator::Connection::Connection(const std::string &host, uint16_t port)
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+    {
+        return;
+    }
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ < 0)
+    {
+        return;
+    }
+    if (connect(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)))
+    {
+        close(fd_);
+        fd_ = -1;
+        return;
+    }
+    // OpenPnP does not batch commands, each command is sent as soon as it
+    // is ready.
+    int nodelay = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+}
+
+LoadGenerator::Connection::~Connection()
+{
+    if (fd_ >= 0)
+    {
+        close(fd_);
+    }
+}
+
+bool LoadGenerator::Connection::send_line(const std::string &line)
+{
+    std::string data = line;
+    data.append("\n");
+    return send_bytes(data.data(), data.size());
+}
+
+bool LoadGenerator::Connection::send_bytes(const void *data, std::size_t length)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    std::size_t offset = 0;
+    while (fd_ >= 0 && offset < length)
+    {
+        ssize_t sent = send(fd_, bytes + offset, length - offset, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        offset += sent;
+    }
+    return fd_ >= 0;
+}
+
+bool LoadGenerator::Connection::read_bytes(void *data, std::size_t length)
+{
+    // any line data which has already been received is consumed first.
+    uint8_t *bytes = static_cast<uint8_t *>(data);
+    std::size_t offset = std::min(length, buffer_.size());
+    memcpy(bytes, buffer_.data(), offset);
+    buffer_.erase(0, offset);
+    while (fd_ >= 0 && offset < length)
+    {
+        ssize_t received = recv(fd_, bytes + offset, length - offset, 0);
+        if (received <= 0)
+        {
+            return false;
+        }
+        offset += received;
+    }
+    return fd_ >= 0;
+}
+
+bool LoadGenerator::Connection::read_line(std::string &line)
+{
+    while (fd_ >= 0)
+    {
+        if (auto pos = buffer_.find('\n'); pos != std::string::npos)
+        {
+            line.assign(buffer_, 0, pos);
+            buffer_.erase(0, pos + 1);
+            return true;
+        }
+        char data[512];
+        ssize_t received = recv(fd_, data, sizeof(data), 0);
+        if (received <= 0)
+        {
+            return false;
+        }
+        buffer_.append(data, received);
+    }
+    return false;
+}
+
+bool LoadGenerator::Connection::read_response(bool &ok)
+{
+    std::string line;
+    while (read_line(line))
+    {
+        if (is_response(line, ok))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+LoadGenerator::LoadGenerator(const options_t &options) : options_(options)
+{
+}
+
+bool LoadGenerator::wait_ready(uint32_t timeout_ms)
+{
+    const int64_t deadline = esp_timer_get_time() + (timeout_ms * 1000LL);
+    while (esp_timer_get_time() < deadline)
+    {
+        auto lines = query("M617");
+        // first line is "ok {count}" followed by the status of each feeder.
+        std::size_t idle = 0;
+        for (std::size_t idx = 1; idx < lines.size(); idx++)
+        {
+            if (lines[idx].find(" Y1 ") != std::string::npos)
+            {
+                idle++;
+            }
+        }
+        if (idle && idle >= options_.feeders)
+        {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return false;
+}
+
+std::vector<std::string> LoadGenerator::query(const std::string &command)
+{
+    std::vector<std::string> lines;
+    if (!control_ || !control_->connected())
+    {
+        control_ = std::make_unique<Connection>(options_.host, options_.port);
+    }
+    Connection &connection = *control_;
+    if (!connection.send_line(command) || !connection.send_line(SYNC_CMD))
+    {
+        control_.reset();
+        return lines;
+    }
+    // responses are sent in the order the commands are received so the
+    // response to SYNC_CMD marks the end of the response to the command.
+    std::string line;
+    while (connection.read_line(line))
+    {
+        if (line.rfind("ok - not implemented", 0) == 0)
+        {
+            break;
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+LoadGenerator::result_t LoadGenerator::run_status()
+{
+    return run_clients({"status", 0, 0, 0, {{"M612", {}}}},
+                       &LoadGenerator::status_client);
+}
+
+LoadGenerator::result_t LoadGenerator::run_feed()
+{
+    return run_clients({"feed", 0, 0, 0, {{"M610", {}}, {"M611", {}}}},
+                       &LoadGenerator::feed_client);
+}
+
+LoadGenerator::result_t LoadGenerator::run_binary_status()
+{
+    return run_clients({"binary status", 0, 0, 0, {{"STATUS", {}}}},
+                       &LoadGenerator::binary_status_client);
+}
+
+LoadGenerator::result_t LoadGenerator::run_clients(
+    result_t result, void (LoadGenerator::*method)(std::size_t, result_t &))
+{
+    std::vector<result_t> results(options_.clients, result);
+    std::vector<std::thread> threads;
+    const int64_t start = esp_timer_get_time();
+    for (std::size_t client = 0; client < options_.clients; client++)
+    {
+        threads.emplace_back(method, this, client, std::ref(results[client]));
+    }
+    for (std::size_t client = 0; client < options_.clients; client++)
+    {
+        threads[client].join();
+        merge(result, results[client]);
+    }
+    result.elapsed_us = esp_timer_get_time() - start;
+    return result;
+}
+
+void LoadGenerator::status_client(std::size_t client, result_t &result)
+{
+    Connection connection(options_.host, options_.port);
+    std::deque<int64_t> pending;
+    std::size_t feeder = client % options_.feeders;
+    const int64_t deadline =
+        esp_timer_get_time() + (options_.duration_ms * 1000LL);
+    bool sending = true;
+    while (connection.connected() && (sending || !pending.empty()))
+    {
+        while (sending && pending.size() < options_.pipeline)
+        {
+            if (esp_timer_get_time() >= deadline)
+            {
+                sending = false;
+                break;
+            }
+            std::string command = "M612 N";
+            command.append(std::to_string(feeder));
+            feeder = (feeder + 1) % options_.feeders;
+            pending.push_back(esp_timer_get_time());
+            if (!connection.send_line(command))
+            {
+                result.errors++;
+                return;
+            }
+            result.commands++;
+        }
+        if (pending.empty())
+        {
+            break;
+        }
+        bool ok = false;
+        if (!connection.read_response(ok))
+        {
+            result.errors += pending.size();
+            return;
+        }
+        result.latencies[0].second.push_back(
+            esp_timer_get_time() - pending.front());
+        pending.pop_front();
+        if (!ok)
+        {
+            result.errors++;
+        }
+    }
+}
+
+void LoadGenerator::feed_client(std::size_t client, result_t &result)
+{
+    /// Command in flight on the connection.
+    struct pending_t
+    {
+        /// True for M610, false for M611.
+        bool feed;
+
+        /// Feeder the command was sent to.
+        std::size_t feeder;
+
+        /// Time at which the command was sent.
+        int64_t sent;
+    };
+
+    Connection connection(options_.host, options_.port);
+    bool ok = false;
+    if (!connection.send_line("M620 S1") || !connection.read_response(ok) ||
+        !ok)
+    {
+        result.errors++;
+        return;
+    }
+
+    // feeders owned by this client and the cycles remaining for each,
+    // feeders are only sent a new feed once the previous post-pick has
+    // completed.
+    std::deque<std::size_t> available;
+    std::vector<std::size_t> remaining(options_.feeders, 0);
+    for (std::size_t feeder = client; feeder < options_.feeders;
+         feeder += options_.clients)
+    {
+        available.push_back(feeder);
+        remaining[feeder] = options_.cycles;
+    }
+
+    std::deque<pending_t> pending;
+    auto send = [&](bool feed, std::size_t feeder)
+    {
+        std::string command = feed ? "M610 N" : "M611 N";
+        command.append(std::to_string(feeder));
+        pending.push_back({feed, feeder, esp_timer_get_time()});
+        result.commands++;
+        return connection.send_line(command);
+    };
+
+    while (!available.empty() || !pending.empty())
+    {
+        while (!available.empty() && pending.size() < options_.pipeline)
+        {
+            const std::size_t feeder = available.front();
+            available.pop_front();
+            if (!send(true, feeder))
+            {
+                result.errors++;
+                return;
+            }
+        }
+        if (!connection.read_response(ok))
+        {
+            result.errors += pending.size();
+            return;
+        }
+        const pending_t done = pending.front();
+        pending.pop_front();
+        result.latencies[done.feed ? 0 : 1].second.push_back(
+            esp_timer_get_time() - done.sent);
+        if (!ok)
+        {
+            // skip the rest of the cycle, the feeder is retried until it's
+            // cycles have been used.
+            result.errors++;
+        }
+        if (done.feed && ok)
+        {
+            // the part has been presented, the pick happens here and is
+            // followed by the post-pick.
+            if (!send(false, done.feeder))
+            {
+                result.errors++;
+                return;
+            }
+        }
+        else if (--remaining[done.feeder])
+        {
+            available.push_back(done.feeder);
+        }
+    }
+}
+
+void LoadGenerator::binary_status_client(std::size_t client, result_t &result)
+{
+    Connection connection(options_.host, options_.binary_port);
+    // send time of each request in flight, keyed by sequence number.
+    std::unordered_map<uint32_t, int64_t> pending;
+    std::size_t feeder = client % options_.feeders;
+    uint32_t seq = 0;
+    const int64_t deadline =
+        esp_timer_get_time() + (options_.duration_ms * 1000LL);
+    bool sending = true;
+    while (connection.connected() && (sending || !pending.empty()))
+    {
+        while (sending && pending.size() < options_.pipeline)
+        {
+            if (esp_timer_get_time() >= deadline)
+            {
+                sending = false;
+                break;
+            }
+            BinaryServer::request_frame request = {};
+            request.seq = seq++;
+            request.opcode = BinaryServer::OPCODE_STATUS;
+            request.feeder = feeder;
+            feeder = (feeder + 1) % options_.feeders;
+            pending[request.seq] = esp_timer_get_time();
+            if (!connection.send_bytes(&request, sizeof(request)))
+            {
+                result.errors++;
+                return;
+            }
+            result.commands++;
+        }
+        if (pending.empty())
+        {
+            break;
+        }
+        BinaryServer::response_frame response;
+        if (!connection.read_bytes(&response, sizeof(response)))
+        {
+            result.errors += pending.size();
+            return;
+        }
+        auto entry = pending.find(response.seq);
+        if (entry == pending.end())
+        {
+            result.errors++;
+            continue;
+        }
+        result.latencies[0].second.push_back(
+            esp_timer_get_time() - entry->second);
+        pending.erase(entry);
+        if (response.status)
+        {
+            result.errors++;
+        }
+    }
+}
+
+void LoadGenerator::merge(result_t &into, result_t &from)
+{
+    into.commands += from.commands;
+    into.errors += from.errors;
+    for (std::size_t idx = 0; idx < into.latencies.size(); idx++)
+    {
+        auto &samples = into.latencies[idx].second;
+        samples.insert(samples.end(), from.latencies[idx].second.begin(),
+                       from.latencies[idx].second.end());
+    }
+}
+
+void LoadGenerator::print(const result_t &result)
+{
+    const double seconds = result.elapsed_us / 1000000.0;
+    printf("%s: %" PRIu64 " commands in %.2fs (%.1f lines/s), %" PRIu64
+           " errors\n", result.name.c_str(), result.commands, seconds,
+           seconds > 0 ? result.commands / seconds : 0.0, result.errors);
+    for (auto [command, samples] : result.latencies)
+    {
+        if (samples.empty())
+        {
+            continue;
+        }
+        std::sort(samples.begin(), samples.end());
+        auto percentile = [&](std::size_t pct)
+        {
+            return samples[std::min(samples.size() - 1,
+                                    (samples.size() * pct) / 100)];
+        };
+        printf("  %s ack: count=%zu p50=%" PRIu32 "us p90=%" PRIu32
+               "us p99=%" PRIu32 "us max=%" PRIu32 "us\n", command.c_str(),
+               samples.size(), percentile(50), percentile(90),
+               percentile(99), samples.back());
+    }
+}
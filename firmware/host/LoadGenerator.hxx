@@ -0,0 +1,213 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// GCode client which generates the same command patterns as OpenPnP.
+///
+/// Each client uses a blocking TCP connection on it's own thread, commands
+/// are pipelined up to the configured depth and the responses are matched
+/// to the commands in order.
+class LoadGenerator
+{
+public:
+    /// Options for the load generator.
+    struct options_t
+    {
+        /// Address of the @ref GCodeServer.
+        std::string host;
+
+        /// Port of the @ref GCodeServer.
+        uint16_t port;
+
+        /// Number of concurrent client connections.
+        std::size_t clients;
+
+        /// Number of feeders to send commands to.
+        std::size_t feeders;
+
+        /// Maximum number of commands in flight on each connection.
+        std::size_t pipeline;
+
+        /// Duration of the status phase in milliseconds.
+        uint32_t duration_ms;
+
+        /// Number of feed / post-pick cycles for each feeder.
+        std::size_t cycles;
+
+        /// Port of the @ref BinaryServer, zero disables the binary phase.
+        uint16_t binary_port;
+    };
+
+    /// Results of a single phase.
+    struct result_t
+    {
+        /// Name of the phase.
+        std::string name;
+
+        /// Number of commands sent.
+        uint64_t commands;
+
+        /// Number of error responses (or unexpected disconnects).
+        uint64_t errors;
+
+        /// Duration of the phase in microseconds.
+        int64_t elapsed_us;
+
+        /// Latency of each response in microseconds, grouped by command.
+        std::vector<std::pair<std::string, std::vector<uint32_t>>> latencies;
+    };
+
+    /// Constructor.
+    ///
+    /// @param options @ref options_t to use.
+    LoadGenerator(const options_t &options);
+
+    /// Waits for all feeders to finish homing.
+    ///
+    /// @param timeout_ms Maximum number of milliseconds to wait.
+    ///
+    /// @return true if all feeders are idle, false otherwise.
+    bool wait_ready(uint32_t timeout_ms);
+
+    /// Sends pipelined feeder status requests (M612) from all clients for
+    /// the configured duration, this exercises the parser and dispatcher.
+    ///
+    /// @return @ref result_t for the phase.
+    result_t run_status();
+
+    /// Sends feed (M610) and post-pick (M611) requests with deferred
+    /// responses (M620) from all clients, each client owns a subset of the
+    /// feeders. This exercises the complete motion path.
+    ///
+    /// @return @ref result_t for the phase.
+    result_t run_feed();
+
+    /// Sends pipelined binary status requests (OPCODE_STATUS) from all
+    /// clients for the configured duration, responses are matched to the
+    /// requests by sequence number.
+    ///
+    /// @return @ref result_t for the phase.
+    result_t run_binary_status();
+
+    /// Sends a single command and collects the full response.
+    ///
+    /// @param command Command to send.
+    ///
+    /// @return response lines.
+    std::vector<std::string> query(const std::string &command);
+
+    /// Prints the results of a phase.
+    ///
+    /// @param result @ref result_t to print.
+    static void print(const result_t &result);
+
+private:
+    /// Blocking line based connection to the @ref GCodeServer.
+    class Connection
+    {
+    public:
+        /// Constructor, connects to the @ref GCodeServer.
+        ///
+        /// @param host Address to connect to.
+        /// @param port Port to connect to.
+        Connection(const std::string &host, uint16_t port);
+
+        /// Destructor, closes the connection.
+        ~Connection();
+
+        /// @return true if the connection is open.
+        bool connected() const
+        {
+            return fd_ >= 0;
+        }
+
+        /// Sends a single line, a newline is appended.
+        ///
+        /// @param line Line to send.
+        ///
+        /// @return true if the line was sent.
+        bool send_line(const std::string &line);
+
+        /// Receives a single line, the newline is removed.
+        ///
+        /// @param line Receives the line.
+        ///
+        /// @return true if a line was received, false if the connection was
+        /// closed.
+        bool read_line(std::string &line);
+
+        /// Reads lines until the response to a command has been received,
+        /// all lines are discarded.
+        ///
+        /// @param ok Receives true if the response starts with "ok".
+        ///
+        /// @return true if a response was received, false if the connection
+        /// was closed.
+        bool read_response(bool &ok);
+
+        /// Sends raw data.
+        ///
+        /// @param data Data to send.
+        /// @param length Number of bytes to send.
+        ///
+        /// @return true if the data was sent.
+        bool send_bytes(const void *data, std::size_t length);
+
+        /// Receives exactly @param length bytes.
+        ///
+        /// @param data Buffer to receive the data.
+        /// @param length Number of bytes to receive.
+        ///
+        /// @return true if the data was received, false if the connection
+        /// was closed.
+        bool read_bytes(void *data, std::size_t length);
+
+    private:
+        /// Socket descriptor.
+        int fd_{-1};
+
+        /// Data that has been received but not yet consumed.
+        std::string buffer_;
+    };
+
+    /// Command used to mark the end of a multi-line response in
+    /// @ref query, this is acknowledged by the server without performing any
+    /// action.
+    static constexpr const char *const SYNC_CMD = "M400";
+
+    /// Options in use.
+    options_t options_;
+
+    /// Connection used by @ref query, opened on first use.
+    std::unique_ptr<Connection> control_;
+
+    /// Status phase for a single client.
+    void status_client(std::size_t client, result_t &result);
+
+    /// Feed phase for a single client.
+    void feed_client(std::size_t client, result_t &result);
+
+    /// Binary status phase for a single client.
+    void binary_status_client(std::size_t client, result_t &result);
+
+    /// Runs a phase on all clients concurrently.
+    ///
+    /// @param result Initial result, receives the combined results.
+    /// @param method Phase to run for each client.
+    ///
+    /// @return @ref result_t for the phase.
+    result_t run_clients(
+        result_t result, void (LoadGenerator::*method)(std::size_t, result_t &));
+
+    /// Combines the results from all clients into a single result.
+    static void merge(result_t &into, result_t &from);
+};
@@ -0,0 +1,492 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#include <chrono>
+#include <cstddef>
+#include <esp_timer.h>
+#include <new>
+#include <thread>
+
+#include "SimulatedI2C.hxx"
+
+namespace
+{
+
+/// Command link entry operations.
+typedef enum : uint8_t
+{
+    /// (Repeated) start condition.
+    CMD_START,
+
+    /// Write of a single byte stored in the entry.
+    CMD_WRITE_BYTE,
+
+    /// Write of a caller provided buffer.
+    CMD_WRITE,
+
+    /// Read into a caller provided buffer.
+    CMD_READ,
+
+    /// Stop condition.
+    CMD_STOP
+} cmd_op_t;
+
+/// Single command link entry, the caller provided buffers must remain valid
+/// until the command link has been executed (as with ESP-IDF).
+struct cmd_entry_t
+{
+    /// Operation to perform.
+    cmd_op_t op;
+
+    /// When true the device must acknowledge written bytes.
+    bool ack_check;
+
+    /// Byte to write for @ref CMD_WRITE_BYTE.
+    uint8_t byte;
+
+    /// Number of bytes for @ref CMD_WRITE and @ref CMD_READ.
+    uint32_t length;
+
+    /// Source for @ref CMD_WRITE.
+    const uint8_t *write;
+
+    /// Destination for @ref CMD_READ.
+    uint8_t *read;
+};
+
+static_assert(sizeof(cmd_entry_t) <= I2C_INTERNAL_STRUCT_SIZE,
+              "I2C_INTERNAL_STRUCT_SIZE is too small for cmd_entry_t");
+
+/// Command link header, the entries follow the header in the caller
+/// provided buffer.
+struct cmd_link_t
+{
+    /// Number of entries in use.
+    std::size_t count;
+
+    /// Number of entries that fit in the buffer.
+    std::size_t capacity;
+
+    /// @return first entry of the command link.
+    cmd_entry_t *entries()
+    {
+        return reinterpret_cast<cmd_entry_t *>(this + 1);
+    }
+};
+
+/// @return entry appended to @param cmd or nullptr if the link is full.
+cmd_entry_t *append(i2c_cmd_handle_t cmd, cmd_op_t op)
+{
+    cmd_link_t *link = static_cast<cmd_link_t *>(cmd);
+    if (link == nullptr || link->count >= link->capacity)
+    {
+        return nullptr;
+    }
+    cmd_entry_t *entry = &link->entries()[link->count++];
+    *entry = {};
+    entry->op = op;
+    return entry;
+}
+
+/// Blocks until @param deadline (from esp_timer_get_time), the final part
+/// of the wait is spent spinning as sleeping is not precise enough for
+/// short transfers.
+void wait_until(int64_t deadline)
+{
+    static constexpr int64_t SPIN_US = 100;
+    int64_t now = esp_timer_get_time();
+    if (deadline - now > SPIN_US)
+    {
+        std::this_thread::sleep_for(
+            std::chrono::microseconds(deadline - now - SPIN_US));
+    }
+    while (esp_timer_get_time() < deadline)
+    {
+        std::this_thread::yield();
+    }
+}
+
+} // namespace
+
+SimulatedI2C &SimulatedI2C::instance(i2c_port_t port)
+{
+    static SimulatedI2C buses[I2C_NUM_MAX];
+    return buses[port == I2C_NUM_0 ? 0 : 1];
+}
+
+void SimulatedI2C::add_pca9685(uint8_t addr)
+{
+    auto device = std::make_unique<device_t>();
+    device->addr = addr;
+    device->registers.fill(0);
+    device->registers[0x00] = 0x11; // MODE1: sleep, all call
+    device->registers[0x01] = 0x04; // MODE2: totem pole outputs
+    device->registers[0xFE] = 0x1E; // PRE_SCALE: 200Hz
+    device->pointer = 0;
+    device->stats = {};
+    device->stats.addr = addr;
+    const std::lock_guard<std::mutex> lock(mux_);
+    devices_.push_back(std::move(device));
+}
+
+void SimulatedI2C::add_mcp23017(uint8_t addr)
+{
+    auto device = std::make_unique<device_t>();
+    device->addr = addr;
+    device->registers.fill(0);
+    device->registers[0x00] = 0xFF; // IODIRA: all inputs
+    device->registers[0x01] = 0xFF; // IODIRB: all inputs
+    device->registers[0x12] = 0xFF; // GPIOA: all pins high
+    device->registers[0x13] = 0xFF; // GPIOB: all pins high
+    device->pointer = 0;
+    device->stats = {};
+    device->stats.addr = addr;
+    const std::lock_guard<std::mutex> lock(mux_);
+    devices_.push_back(std::move(device));
+}
+
+void SimulatedI2C::set_clock_override(uint32_t clock_hz)
+{
+    const std::lock_guard<std::mutex> lock(mux_);
+    clock_override_ = clock_hz;
+}
+
+void SimulatedI2C::set_clock_limit(uint32_t clock_hz)
+{
+    const std::lock_guard<std::mutex> lock(mux_);
+    clock_limit_ = clock_hz;
+}
+
+void SimulatedI2C::set_transfer_overhead(uint32_t overhead_us)
+{
+    const std::lock_guard<std::mutex> lock(mux_);
+    overhead_us_ = overhead_us;
+}
+
+void SimulatedI2C::set_capture_limit(std::size_t limit)
+{
+    const std::lock_guard<std::mutex> lock(mux_);
+    capture_limit_ = limit;
+    captured_.clear();
+    captured_.reserve(limit);
+    capture_head_ = 0;
+}
+
+std::vector<SimulatedI2C::register_write_t> SimulatedI2C::captured_writes()
+{
+    const std::lock_guard<std::mutex> lock(mux_);
+    std::vector<register_write_t> writes;
+    writes.reserve(captured_.size());
+    writes.insert(writes.end(), captured_.begin() + capture_head_,
+                  captured_.end());
+    writes.insert(writes.end(), captured_.begin(),
+                  captured_.begin() + capture_head_);
+    return writes;
+}
+
+SimulatedI2C::bus_stats_t SimulatedI2C::bus_stats()
+{
+    const std::lock_guard<std::mutex> lock(mux_);
+    return stats_;
+}
+
+std::vector<SimulatedI2C::device_stats_t> SimulatedI2C::device_stats()
+{
+    const std::lock_guard<std::mutex> lock(mux_);
+    std::vector<device_stats_t> stats;
+    for (auto &device : devices_)
+    {
+        stats.push_back(device->stats);
+    }
+    return stats;
+}
+
+uint32_t SimulatedI2C::clock()
+{
+    const std::lock_guard<std::mutex> lock(mux_);
+    return clock_override_ ? clock_override_ : configured_clock_;
+}
+
+esp_err_t SimulatedI2C::configure(const i2c_config_t &config)
+{
+    if (config.mode != I2C_MODE_MASTER || !config.master.clk_speed)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const std::lock_guard<std::mutex> lock(mux_);
+    configured_clock_ = config.master.clk_speed;
+    return ESP_OK;
+}
+
+esp_err_t SimulatedI2C::execute(i2c_cmd_handle_t cmd)
+{
+    cmd_link_t *link = static_cast<cmd_link_t *>(cmd);
+    if (link == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const std::lock_guard<std::mutex> bus_lock(bus_mux_);
+    const int64_t start = esp_timer_get_time();
+    esp_err_t result = ESP_OK;
+    uint64_t bits = 0;
+    uint64_t bytes = 0;
+    uint32_t clock = 0;
+    uint32_t overhead = 0;
+    {
+        const std::lock_guard<std::mutex> lock(mux_);
+        clock = clock_override_ ? clock_override_ : configured_clock_;
+        overhead = overhead_us_;
+        if (!clock)
+        {
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (clock_limit_ && clock > clock_limit_ &&
+            (++marginal_transfers_ % MARGINAL_NAK_INTERVAL) == 0)
+        {
+            // the address byte is corrupted on the wire and is not
+            // acknowledged by any device.
+            bits += START_BITS + BYTE_BITS + STOP_BITS;
+            result = ESP_FAIL;
+        }
+
+        device_t *device = nullptr;
+        bool expect_address = false;
+        bool expect_register = false;
+        for (std::size_t idx = 0; idx < link->count && result == ESP_OK;
+             idx++)
+        {
+            const cmd_entry_t &entry = link->entries()[idx];
+            if (entry.op == CMD_START)
+            {
+                bits += START_BITS;
+                expect_address = true;
+            }
+            else if (entry.op == CMD_STOP)
+            {
+                bits += STOP_BITS;
+            }
+            else if (entry.op == CMD_READ)
+            {
+                for (uint32_t pos = 0; pos < entry.length; pos++)
+                {
+                    bits += BYTE_BITS;
+                    bytes++;
+                    if (device != nullptr)
+                    {
+                        entry.read[pos] = device->registers[device->pointer++];
+                        device->stats.register_reads++;
+                    }
+                    else
+                    {
+                        // nothing is driving SDA, the pull-ups read as high.
+                        entry.read[pos] = 0xFF;
+                    }
+                }
+            }
+            else
+            {
+                const uint8_t *data =
+                    entry.op == CMD_WRITE_BYTE ? &entry.byte : entry.write;
+                const uint32_t length =
+                    entry.op == CMD_WRITE_BYTE ? 1 : entry.length;
+                for (uint32_t pos = 0; pos < length && result == ESP_OK;
+                     pos++)
+                {
+                    bits += BYTE_BITS;
+                    bytes++;
+                    if (expect_address)
+                    {
+                        expect_address = false;
+                        device = find_device(data[pos] >> 1);
+                        if (device == nullptr)
+                        {
+                            if (entry.ack_check)
+                            {
+                                // the driver sends a stop condition after
+                                // the address is not acknowledged.
+                                bits += STOP_BITS;
+                                result = ESP_FAIL;
+                            }
+                            continue;
+                        }
+                        device->stats.transactions++;
+                        expect_register =
+                            (data[pos] & 0x01) == I2C_MASTER_WRITE;
+                    }
+                    else if (device == nullptr)
+                    {
+                        continue;
+                    }
+                    else if (expect_register)
+                    {
+                        expect_register = false;
+                        device->pointer = data[pos];
+                    }
+                    else
+                    {
+                        const uint8_t reg = device->pointer++;
+                        device->registers[reg] = data[pos];
+                        device->stats.register_writes++;
+                        capture(start + overhead + (bits * 1000000) / clock,
+                                device->addr, reg, data[pos]);
+                    }
+                }
+            }
+        }
+    }
+
+    const int64_t duration = overhead + (bits * 1000000) / clock;
+    wait_until(start + duration);
+
+    const std::lock_guard<std::mutex> lock(mux_);
+    stats_.transfers++;
+    stats_.bytes += bytes;
+    stats_.busy_us += duration;
+    if (result == ESP_FAIL)
+    {
+        stats_.naks++;
+    }
+    return result;
+}
+
+SimulatedI2C::device_t *SimulatedI2C::find_device(uint8_t addr)
+{
+    for (auto &device : devices_)
+    {
+        if (device->addr == addr)
+        {
+            return device.get();
+        }
+    }
+    return nullptr;
+}
+
+void SimulatedI2C::capture(int64_t timestamp, uint8_t addr, uint8_t reg,
+                           uint8_t value)
+{
+    if (!capture_limit_)
+    {
+        return;
+    }
+    if (captured_.size() < capture_limit_)
+    {
+        captured_.push_back({timestamp, addr, reg, value});
+    }
+    else
+    {
+        captured_[capture_head_] = {timestamp, addr, reg, value};
+        capture_head_ = (capture_head_ + 1) % capture_limit_;
+    }
+}
+
+esp_err_t i2c_param_config(i2c_port_t port, const i2c_config_t *config)
+{
+    if (port < 0 || port >= I2C_NUM_MAX || config == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return SimulatedI2C::instance(port).configure(*config);
+}
+
+esp_err_t i2c_driver_install(i2c_port_t port, i2c_mode_t, size_t, size_t,
+                             int)
+{
+    return port >= 0 && port < I2C_NUM_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2c_driver_delete(i2c_port_t port)
+{
+    return port >= 0 && port < I2C_NUM_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create_static(uint8_t *buffer, uint32_t size)
+{
+    void *storage = buffer;
+    std::size_t space = size;
+    if (buffer == nullptr ||
+        !std::align(alignof(cmd_link_t), sizeof(cmd_link_t), storage, space))
+    {
+        return nullptr;
+    }
+    cmd_link_t *link = new (storage) cmd_link_t();
+    link->count = 0;
+    link->capacity = (space - sizeof(cmd_link_t)) / sizeof(cmd_entry_t);
+    return link;
+}
+
+void i2c_cmd_link_delete_static(i2c_cmd_handle_t)
+{
+    // the command link is stored in the caller provided buffer.
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd)
+{
+    return append(cmd, CMD_START) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd)
+{
+    return append(cmd, CMD_STOP) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd, uint8_t data,
+                                bool ack_en)
+{
+    cmd_entry_t *entry = append(cmd, CMD_WRITE_BYTE);
+    if (entry == nullptr)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    entry->byte = data;
+    entry->ack_check = ack_en;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd, const uint8_t *data,
+                           size_t length, bool ack_en)
+{
+    if (data == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    cmd_entry_t *entry = append(cmd, CMD_WRITE);
+    if (entry == nullptr)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    entry->write = data;
+    entry->length = length;
+    entry->ack_check = ack_en;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_read(i2c_cmd_handle_t cmd, uint8_t *data, size_t length,
+                          i2c_ack_type_t)
+{
+    if (data == nullptr || !length)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    cmd_entry_t *entry = append(cmd, CMD_READ);
+    if (entry == nullptr)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    entry->read = data;
+    entry->length = length;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_cmd_begin(i2c_port_t port, i2c_cmd_handle_t cmd,
+                               TickType_t)
+{
+    if (port < 0 || port >= I2C_NUM_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return SimulatedI2C::instance(port).execute(cmd);
+}
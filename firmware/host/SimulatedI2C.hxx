@@ -0,0 +1,211 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <driver/i2c.h>
+#include <esp_err.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// Simulated I2C bus used by the host build in place of the ESP-IDF I2C
+/// driver.
+///
+/// Each transfer is executed against a register file for each simulated
+/// device and takes the time the transfer would take on a real bus at the
+/// configured clock speed, the calling thread is blocked for that duration
+/// just as it would be blocked in i2c_master_cmd_begin on the ESP32.
+class SimulatedI2C
+{
+public:
+    /// Single register write captured by the bus.
+    struct register_write_t
+    {
+        /// Time (from esp_timer_get_time) at which the write completed.
+        int64_t timestamp;
+
+        /// I2C device address.
+        uint8_t addr;
+
+        /// Register address.
+        uint8_t reg;
+
+        /// Value written to the register.
+        uint8_t value;
+    };
+
+    /// Counters for a single simulated device.
+    struct device_stats_t
+    {
+        /// I2C device address.
+        uint8_t addr;
+
+        /// Number of transactions addressed to the device.
+        uint32_t transactions;
+
+        /// Number of registers written.
+        uint32_t register_writes;
+
+        /// Number of registers read.
+        uint32_t register_reads;
+    };
+
+    /// Counters for the bus.
+    struct bus_stats_t
+    {
+        /// Number of transfers (command links) executed.
+        uint32_t transfers;
+
+        /// Number of transfers that were not acknowledged.
+        uint32_t naks;
+
+        /// Number of bytes (including addresses) sent on the bus.
+        uint64_t bytes;
+
+        /// Cumulative time the bus was busy, in microseconds.
+        uint64_t busy_us;
+    };
+
+    /// @return @ref SimulatedI2C instance for @param port.
+    static SimulatedI2C &instance(i2c_port_t port);
+
+    /// Adds a simulated PCA9685 to the bus.
+    ///
+    /// @param addr I2C device address.
+    void add_pca9685(uint8_t addr);
+
+    /// Adds a simulated MCP23017 to the bus, all IO pins read as high.
+    ///
+    /// @param addr I2C device address.
+    void add_mcp23017(uint8_t addr);
+
+    /// Overrides the clock speed configured by the firmware.
+    ///
+    /// @param clock_hz Clock speed in Hz, zero uses the configured speed.
+    void set_clock_override(uint32_t clock_hz);
+
+    /// Sets the fastest clock speed the simulated wiring can reliably carry,
+    /// above this every @ref MARGINAL_NAK_INTERVAL th transfer is not
+    /// acknowledged.
+    ///
+    /// @param clock_hz Clock speed in Hz, zero disables the limit.
+    void set_clock_limit(uint32_t clock_hz);
+
+    /// Sets the fixed time added to each transfer for driver overhead.
+    ///
+    /// @param overhead_us Number of microseconds to add to each transfer.
+    void set_transfer_overhead(uint32_t overhead_us);
+
+    /// Sets the number of register writes to capture.
+    ///
+    /// @param limit Maximum number of register writes to retain, zero
+    /// disables capturing.
+    void set_capture_limit(std::size_t limit);
+
+    /// @return captured register writes, oldest first.
+    std::vector<register_write_t> captured_writes();
+
+    /// @return counters for the bus.
+    bus_stats_t bus_stats();
+
+    /// @return counters for each simulated device.
+    std::vector<device_stats_t> device_stats();
+
+    /// @return effective clock speed of the bus in Hz.
+    uint32_t clock();
+
+    /// Configures the bus, called from i2c_param_config.
+    ///
+    /// @param config Configuration to apply.
+    ///
+    /// @return ESP_OK.
+    esp_err_t configure(const i2c_config_t &config);
+
+    /// Executes a command link, called from i2c_master_cmd_begin.
+    ///
+    /// @param cmd Command link to execute.
+    ///
+    /// @return ESP_OK if all bytes were acknowledged, ESP_FAIL if a byte was
+    /// not acknowledged, ESP_ERR_INVALID_STATE if the bus is not configured.
+    esp_err_t execute(i2c_cmd_handle_t cmd);
+
+private:
+    /// Simulated device, a set of registers accessed with an auto
+    /// incrementing register pointer.
+    struct device_t
+    {
+        /// I2C device address.
+        uint8_t addr;
+
+        /// Register file.
+        std::array<uint8_t, 256> registers;
+
+        /// Register pointer.
+        uint8_t pointer;
+
+        /// Counters for the device.
+        device_stats_t stats;
+    };
+
+    /// Number of SCL periods for a start (or repeated start) condition.
+    static constexpr uint32_t START_BITS = 1;
+
+    /// Number of SCL periods for a stop condition.
+    static constexpr uint32_t STOP_BITS = 1;
+
+    /// Number of SCL periods per byte, eight data bits and one ACK bit.
+    static constexpr uint32_t BYTE_BITS = 9;
+
+    /// Interval at which transfers fail when the clock speed is above the
+    /// limit set by @ref set_clock_limit.
+    static constexpr uint32_t MARGINAL_NAK_INTERVAL = 4;
+
+    /// Held for the duration of each transfer so that transfers are
+    /// executed one at a time, as they would be on a real bus.
+    std::mutex bus_mux_;
+
+    /// Protects all members other than @ref bus_mux_.
+    std::mutex mux_;
+
+    /// Clock speed configured by the firmware, zero when not configured.
+    uint32_t configured_clock_{0};
+
+    /// Clock speed override, zero when not overridden.
+    uint32_t clock_override_{0};
+
+    /// Fastest reliable clock speed, zero when not limited.
+    uint32_t clock_limit_{0};
+
+    /// Number of transfers executed above @ref clock_limit_.
+    uint32_t marginal_transfers_{0};
+
+    /// Fixed time added to each transfer.
+    uint32_t overhead_us_{0};
+
+    /// Simulated devices.
+    std::vector<std::unique_ptr<device_t>> devices_;
+
+    /// Counters for the bus.
+    bus_stats_t stats_{};
+
+    /// Captured register writes, used as a ring buffer once full.
+    std::vector<register_write_t> captured_;
+
+    /// Index of the oldest entry in @ref captured_ once full.
+    std::size_t capture_head_{0};
+
+    /// Maximum number of entries in @ref captured_.
+    std::size_t capture_limit_{0};
+
+    /// @return device at @param addr or nullptr if there is no device.
+    device_t *find_device(uint8_t addr);
+
+    /// Records a register write in @ref captured_.
+    void capture(int64_t timestamp, uint8_t addr, uint8_t reg, uint8_t value);
+};
@@ -0,0 +1,298 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#include <arpa/inet.h>
+#include <asio.hpp>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <esp_log.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BinaryServer.hxx"
+#include "config.hxx"
+#include "FeederManager.hxx"
+#include "GCodeServer.hxx"
+#include "LoadGenerator.hxx"
+#include "SimulatedI2C.hxx"
+
+/// Address of the first PCA9685, matches FeederManager.
+static constexpr uint8_t PCA9685_BASE_ADDRESS = 0x40;
+
+/// Address of the first MCP23017, matches FeederManager.
+static constexpr uint8_t MCP23017_BASE_ADDRESS = 0x20;
+
+/// Number of feeders connected to each PCA9685.
+static constexpr std::size_t FEEDERS_PER_PCA9685 = 16;
+
+/// Command line options for the benchmark.
+struct benchmark_options_t
+{
+    /// Number of simulated PCA9685 devices.
+    std::size_t pca9685{2};
+
+    /// Number of simulated MCP23017 devices.
+    std::size_t mcp23017{0};
+
+    /// I2C clock speed override in Hz, zero uses the firmware configuration.
+    uint32_t i2c_clock{0};
+
+    /// Fastest reliable I2C clock speed in Hz during startup, zero for no
+    /// limit.
+    uint32_t i2c_limit{0};
+
+    /// Fastest reliable I2C clock speed in Hz once the feeders are ready,
+    /// zero for no limit.
+    uint32_t i2c_runtime_limit{0};
+
+    /// Fixed driver overhead added to each I2C transfer in microseconds.
+    uint32_t i2c_overhead_us{20};
+
+    /// Number of register writes to capture and print.
+    std::size_t capture{0};
+
+    /// Enables firmware logging at INFO level.
+    bool verbose{false};
+
+    /// Options for the @ref LoadGenerator.
+    LoadGenerator::options_t load{"127.0.0.1", 8989, 4, 0, 4, 5000, 5, 8990};
+};
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+           "  --pca9685 N       simulated PCA9685 devices (default: 2)\n"
+           "  --mcp23017 N      simulated MCP23017 devices (default: 0)\n"
+           "  --i2c-clock HZ    I2C clock override (default: firmware config)\n"
+           "  --i2c-limit HZ    fastest reliable I2C clock (default: no limit)\n"
+           "  --i2c-runtime-limit HZ\n"
+           "                    fastest reliable I2C clock once the feeders are\n"
+           "                    ready (default: no limit)\n"
+           "  --i2c-overhead US driver overhead per transfer (default: 20)\n"
+           "  --clients N       concurrent GCode connections (default: 4)\n"
+           "  --pipeline N      commands in flight per connection (default: 4)\n"
+           "  --duration MS     status phase duration (default: 5000)\n"
+           "  --cycles N        feed cycles per feeder (default: 5)\n"
+           "  --port N          GCode server port (default: 8989)\n"
+           "  --binary-port N   binary server port, 0 disables (default: 8990)\n"
+           "  --capture N       print the last N register writes\n"
+           "  --verbose         enable firmware logging\n", name);
+}
+
+static bool parse_options(int argc, char **argv, benchmark_options_t &options)
+{
+    for (int idx = 1; idx < argc; idx++)
+    {
+        const std::string arg = argv[idx];
+        if (arg == "--verbose")
+        {
+            options.verbose = true;
+            continue;
+        }
+        if (idx + 1 >= argc)
+        {
+            return false;
+        }
+        const unsigned long value = strtoul(argv[++idx], nullptr, 0);
+        if (arg == "--pca9685")
+        {
+            options.pca9685 = value;
+        }
+        else if (arg == "--mcp23017")
+        {
+            options.mcp23017 = value;
+        }
+        else if (arg == "--i2c-clock")
+        {
+            options.i2c_clock = value;
+        }
+        else if (arg == "--i2c-limit")
+        {
+            options.i2c_limit = value;
+        }
+        else if (arg == "--i2c-runtime-limit")
+        {
+            options.i2c_runtime_limit = value;
+        }
+        else if (arg == "--i2c-overhead")
+        {
+            options.i2c_overhead_us = value;
+        }
+        else if (arg == "--clients")
+        {
+            options.load.clients = value;
+        }
+        else if (arg == "--pipeline")
+        {
+            options.load.pipeline = value;
+        }
+        else if (arg == "--duration")
+        {
+            options.load.duration_ms = value;
+        }
+        else if (arg == "--cycles")
+        {
+            options.load.cycles = value;
+        }
+        else if (arg == "--port")
+        {
+            options.load.port = value;
+        }
+        else if (arg == "--binary-port")
+        {
+            options.load.binary_port = value;
+        }
+        else if (arg == "--capture")
+        {
+            options.capture = value;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return options.pca9685 >= 1 && options.pca9685 <= 8 &&
+           options.mcp23017 <= 8 && options.load.clients >= 1 &&
+           options.load.pipeline >= 1;
+}
+
+static void print_lines(const char *title, const std::vector<std::string> &lines)
+{
+    printf("%s:\n", title);
+    for (auto &line : lines)
+    {
+        printf("  %s\n", line.c_str());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    benchmark_options_t options;
+    if (!parse_options(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    options.load.feeders = options.pca9685 * FEEDERS_PER_PCA9685;
+    esp_log_level_set("*", options.verbose ? ESP_LOG_INFO : ESP_LOG_WARN);
+
+    // all simulated devices are on the first bus.
+    SimulatedI2C &bus = SimulatedI2C::instance(I2C_NUM_0);
+    for (std::size_t idx = 0; idx < options.pca9685; idx++)
+    {
+        bus.add_pca9685(PCA9685_BASE_ADDRESS + idx);
+    }
+    for (std::size_t idx = 0; idx < options.mcp23017; idx++)
+    {
+        bus.add_mcp23017(MCP23017_BASE_ADDRESS + idx);
+    }
+    bus.set_clock_override(options.i2c_clock);
+    bus.set_clock_limit(options.i2c_limit);
+    bus.set_transfer_overhead(options.i2c_overhead_us);
+    bus.set_capture_limit(options.capture);
+
+    // mirrors the io_context layout used by the firmware (main.cpp).
+    asio::io_context network_context;
+    asio::io_context motion_context;
+    auto network_work = asio::make_work_guard(network_context);
+    auto motion_work = asio::make_work_guard(motion_context);
+    esp_ip4_addr_t local_addr;
+    inet_pton(AF_INET, options.load.host.c_str(), &local_addr.addr);
+    GCodeServer gcode_server(network_context, local_addr, options.load.port);
+    FeederManager feeder_mgr(gcode_server, motion_context);
+    std::unique_ptr<BinaryServer> binary_server;
+    if (options.load.binary_port)
+    {
+        binary_server = std::make_unique<BinaryServer>(
+            network_context, local_addr, options.load.binary_port);
+        feeder_mgr.register_binary_handlers(*binary_server);
+    }
+
+    std::vector<std::thread> workers;
+    for (std::size_t idx = 0; idx < NETWORK_CONTEXT_THREADS; idx++)
+    {
+        workers.emplace_back([&]() { network_context.run(); });
+    }
+    for (std::size_t idx = 0; idx < MOTION_CONTEXT_THREADS; idx++)
+    {
+        workers.emplace_back([&]() { motion_context.run(); });
+    }
+
+    printf("Simulating %zu PCA9685 (%zu feeders), %zu MCP23017 at %" PRIu32
+           "Hz\n", options.pca9685, options.load.feeders, options.mcp23017,
+           bus.clock());
+    LoadGenerator generator(options.load);
+    int result = 0;
+    if (!generator.wait_ready(30000))
+    {
+        printf("Feeders did not become idle\n");
+        result = 1;
+    }
+    else
+    {
+        // simulates the wiring degrading after the clock was calibrated.
+        if (options.i2c_runtime_limit)
+        {
+            bus.set_clock_limit(options.i2c_runtime_limit);
+        }
+
+        // the startup homing moves are not part of the results.
+        generator.query("M623");
+        generator.query("M624 R1");
+        const auto start_stats = bus.bus_stats();
+
+        auto status = generator.run_status();
+        LoadGenerator::print(status);
+        auto feed = generator.run_feed();
+        LoadGenerator::print(feed);
+        LoadGenerator::result_t binary = {};
+        if (options.load.binary_port)
+        {
+            binary = generator.run_binary_status();
+            LoadGenerator::print(binary);
+        }
+
+        const auto stats = bus.bus_stats();
+        const int64_t elapsed =
+            status.elapsed_us + feed.elapsed_us + binary.elapsed_us;
+        const uint64_t busy = stats.busy_us - start_stats.busy_us;
+        printf("simulated bus: transfers=%" PRIu32 " bytes=%" PRIu64
+               " busy=%" PRIu64 "us (%.1f%%)\n",
+               stats.transfers - start_stats.transfers,
+               stats.bytes - start_stats.bytes, busy,
+               elapsed > 0 ? (busy * 100.0) / elapsed : 0.0);
+        print_lines("firmware latency (M622)", generator.query("M622"));
+        print_lines("firmware I2C metrics (M624)", generator.query("M624"));
+        print_lines("firmware trace (M625 C8)", generator.query("M625 C8"));
+        if (status.errors || feed.errors || binary.errors)
+        {
+            result = 1;
+        }
+    }
+
+    if (options.capture)
+    {
+        printf("last %zu register writes:\n", options.capture);
+        for (auto &write : bus.captured_writes())
+        {
+            printf("  %10" PRId64 "us addr:0x%02X reg:0x%02X value:0x%02X\n",
+                   write.timestamp, write.addr, write.reg, write.value);
+        }
+    }
+
+    network_work.reset();
+    motion_work.reset();
+    network_context.stop();
+    motion_context.stop();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    return result;
+}
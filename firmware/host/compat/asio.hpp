@@ -0,0 +1,23 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+/// Maps the standalone asio namespace onto Boost.Asio, used by the host
+/// build when the standalone asio headers are not installed.
+
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/asio/system_timer.hpp>
+
+namespace boost
+{
+namespace asio
+{
+    using error_code = boost::system::error_code;
+} // namespace asio
+} // namespace boost
+
+namespace asio = boost::asio;
@@ -0,0 +1,12 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+/// Host replacement for the ESP-IDF CPU utilities, host CPUs are mapped onto
+/// the portNUM_PROCESSORS cores of the target.
+
+#pragma once
+
+int esp_cpu_get_core_id();
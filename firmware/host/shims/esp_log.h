@@ -0,0 +1,54 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+/// Host replacement for the ESP-IDF logging macros, messages are written to
+/// stdout when enabled for the tag.
+
+#pragma once
+
+#include <cinttypes>
+#include <cstdio>
+
+typedef enum
+{
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+/// Sets the log level for a tag, "*" sets the default level.
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+/// @return true if messages at @param level should be logged for @param tag.
+bool esp_log_enabled(const char *tag, esp_log_level_t level);
+
+/// Writes a log message.
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+                   ...) __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOG_LEVEL_LOCAL(level, letter, tag, format, ...)                  \
+    do                                                                        \
+    {                                                                         \
+        if (esp_log_enabled(tag, level))                                      \
+        {                                                                     \
+            esp_log_write(level, tag, letter " (%s) " format "\n", tag,       \
+                          ##__VA_ARGS__);                                     \
+        }                                                                     \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...)                                            \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)                                            \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)                                            \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)                                            \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...)                                            \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
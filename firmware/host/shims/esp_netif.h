@@ -0,0 +1,25 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+/// Host replacement for the ESP-IDF network interface types.
+
+#pragma once
+
+#include <cstdint>
+
+#include "esp_err.h"
+
+typedef struct
+{
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+#define esp_ip4_addr_get_byte(ipaddr, idx)                                    \
+    (((const uint8_t *)(&(ipaddr)->addr))[idx])
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr)                                                        \
+    esp_ip4_addr_get_byte(ipaddr, 0), esp_ip4_addr_get_byte(ipaddr, 1),       \
+    esp_ip4_addr_get_byte(ipaddr, 2), esp_ip4_addr_get_byte(ipaddr, 3)
@@ -0,0 +1,26 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+/// Host replacement for the ESP-IDF pthread extensions, the configuration
+/// is accepted but has no effect on the host threads.
+
+#pragma once
+
+#include <cstddef>
+
+#include "esp_err.h"
+
+typedef struct
+{
+    size_t stack_size;
+    size_t prio;
+    bool inherit_cfg;
+    const char *thread_name;
+    int pin_to_core;
+} esp_pthread_cfg_t;
+
+esp_pthread_cfg_t esp_pthread_get_default_config();
+esp_err_t esp_pthread_set_cfg(const esp_pthread_cfg_t *cfg);
@@ -0,0 +1,14 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+/// Host replacement for the ESP-IDF high resolution timer.
+
+#pragma once
+
+#include <cstdint>
+
+/// @return microseconds since the host process started.
+int64_t esp_timer_get_time();
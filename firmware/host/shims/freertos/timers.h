@@ -0,0 +1,18 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+/// Host replacement for the FreeRTOS timer service, pended functions are
+/// invoked immediately.
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef void (*PendedFunction_t)(void *arg1, uint32_t arg2);
+
+BaseType_t xTimerPendFunctionCallFromISR(PendedFunction_t function,
+                                         void *arg1, uint32_t arg2,
+                                         BaseType_t *woken);
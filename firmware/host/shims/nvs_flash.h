@@ -0,0 +1,11 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#pragma once
+
+#include "nvs.h"
+
+esp_err_t nvs_flash_init();
@@ -0,0 +1,10 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+/// Host build configuration, only options referenced by the firmware
+/// sources are defined.
+
+#pragma once
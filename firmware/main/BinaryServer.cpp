@@ -0,0 +1,264 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#include <algorithm>
+#include <asio.hpp>
+#include <cstring>
+#include <esp_log.h>
+#include <esp_netif.h>
+#include <esp_timer.h>
+#include <functional>
+
+#include "BinaryServer.hxx"
+#include "Latency.hxx"
+#include "Trace.hxx"
+
+BinaryServer::BinaryServer(asio::io_context &context,
+                           const esp_ip4_addr_t local_addr,
+                           const uint16_t port)
+    : acceptor_(context, tcp::endpoint(tcp::v4(), port))
+{
+    register_handler(OPCODE_PING,
+        [](const request_frame &request, completion done)
+        {
+            done(0, &request.arg, sizeof(request.arg));
+        });
+
+    auto endpoint = acceptor_.local_endpoint();
+    ESP_LOGI(TAG, "Waiting for connections on " IPSTR ":%d...",
+             IP2STR(&local_addr), endpoint.port());
+    do_accept();
+}
+
+void BinaryServer::register_handler(opcode_t opcode, request_handler &&handler)
+{
+    if (opcode < OPCODE_COUNT)
+    {
+        handlers_[opcode] = std::move(handler);
+    }
+}
+
+void BinaryServer::completion::operator()(uint8_t status, const void *payload,
+                                          std::size_t length) const
+{
+    record_latency(LATENCY_RESPONSE, received_);
+
+    response_frame response = {};
+    response.seq = seq_;
+    response.opcode = opcode_;
+    response.status = status;
+    response.feeder = feeder_;
+    if (payload != nullptr)
+    {
+        memcpy(response.payload, payload,
+               std::min(length, sizeof(response.payload)));
+    }
+
+    // Hand the response over to the client strand, if this is called from
+    // within the request handler the response will be queued immediately.
+    asio::dispatch(client_->strand_,
+        [client = client_, response]()
+        {
+            client->queue_response(response);
+        });
+}
+
+void BinaryServer::do_accept()
+{
+    acceptor_.async_accept(
+        [&](asio::error_code error, tcp::socket socket)
+        {
+            if (!error)
+            {
+                auto peer = socket.remote_endpoint().address().to_string();
+                ESP_LOGI(TAG, "New client:%s", peer.c_str());
+
+                // Responses are small and latency sensitive, disable Nagle's
+                // algorithm so they are sent immediately.
+                asio::error_code ec;
+                socket.set_option(tcp::no_delay(true), ec);
+                if (ec)
+                {
+                    ESP_LOGW(TAG, "[%s] Unable to set TCP_NODELAY: %s (%d)",
+                             peer.c_str(), ec.message().c_str(), ec.value());
+                }
+                auto client =
+                    std::make_shared<BinaryClient>(std::move(socket), *this);
+                {
+                    const std::lock_guard<std::mutex> lock(clients_mux_);
+                    clients_.insert(client);
+                }
+                client->start();
+            }
+
+            // Wait for another connection
+            do_accept();
+        });
+}
+
+void BinaryServer::stop(std::shared_ptr<BinaryClient> client)
+{
+    {
+        const std::lock_guard<std::mutex> lock(clients_mux_);
+        clients_.erase(client);
+    }
+    client->stop();
+}
+
+BinaryServer::BinaryClient::BinaryClient(tcp::socket &&socket,
+                                         BinaryServer &server)
+    : socket_(std::move(socket)), strand_(socket_.get_executor()),
+      server_(server), peer_(socket_.remote_endpoint().address().to_string())
+{
+    queued_.reserve(MAX_PENDING_REQUESTS);
+    sending_.reserve(MAX_PENDING_REQUESTS);
+}
+
+void BinaryServer::BinaryClient::start()
+{
+    asio::dispatch(strand_,
+        std::bind(&BinaryClient::read, shared_from_this()));
+}
+
+void BinaryServer::BinaryClient::stop()
+{
+    ESP_LOGI(CLIENT_TAG, "Closing connection from %s", peer_.c_str());
+    socket_.close();
+}
+
+void BinaryServer::BinaryClient::read()
+{
+    reading_ = true;
+    socket_.async_read_some(
+        asio::buffer(read_buffer_.data() + read_length_,
+                     read_buffer_.size() - read_length_),
+        asio::bind_executor(strand_,
+            std::bind(&BinaryClient::on_read, shared_from_this(),
+                      std::placeholders::_1, std::placeholders::_2)));
+}
+
+void BinaryServer::BinaryClient::write()
+{
+    // Send all responses that are ready as a single write, responses that
+    // become ready while this write is pending will be sent as part of the
+    // next write.
+    std::swap(queued_, sending_);
+    asio::async_write(socket_,
+        asio::buffer(sending_.data(), sending_.size() * sizeof(response_frame)),
+        asio::bind_executor(strand_,
+            std::bind(&BinaryClient::on_write, shared_from_this(),
+                      std::placeholders::_1)));
+}
+
+void BinaryServer::BinaryClient::on_read(asio::error_code error,
+                                         std::size_t size)
+{
+    reading_ = false;
+    if (!error)
+    {
+        received_ = esp_timer_get_time();
+        read_length_ += size;
+        process_buffered_requests();
+    }
+    else if (error != asio::error::operation_aborted)
+    {
+        ESP_LOGE(CLIENT_TAG, "[%s] Read was unsuccessful: %s (%d)",
+                 peer_.c_str(), error.message().c_str(), error.value());
+        server_.stop(shared_from_this());
+    }
+}
+
+void BinaryServer::BinaryClient::on_write(asio::error_code error)
+{
+    if (!error)
+    {
+        pending_ -= sending_.size();
+        sending_.clear();
+
+        // Send the responses which became ready during the write.
+        if (!queued_.empty())
+        {
+            write();
+        }
+
+        // If reading was paused due to the pending request limit being
+        // reached, resume processing now that space is available.
+        if (!reading_)
+        {
+            process_buffered_requests();
+        }
+    }
+    else if (error != asio::error::operation_aborted)
+    {
+        ESP_LOGE(CLIENT_TAG, "[%s] Write was unsuccessful: %s (%d)",
+                 peer_.c_str(), error.message().c_str(), error.value());
+        server_.stop(shared_from_this());
+    }
+}
+
+void BinaryServer::BinaryClient::process_buffered_requests()
+{
+    std::size_t offset = 0;
+    while (pending_ < MAX_PENDING_REQUESTS && socket_.is_open() &&
+           read_length_ - offset >= sizeof(request_frame))
+    {
+        // the frames are not guaranteed to be aligned within the buffer.
+        request_frame request;
+        memcpy(&request, read_buffer_.data() + offset, sizeof(request));
+        offset += sizeof(request_frame);
+        pending_++;
+
+        trace(TRACE_BINARY_REQUEST, request.feeder, request.opcode,
+              request.seq);
+        completion done(shared_from_this(), request, received_);
+        if (request.opcode < OPCODE_COUNT && server_.handlers_[request.opcode])
+        {
+            server_.handlers_[request.opcode](request, std::move(done));
+        }
+        else
+        {
+            done(STATUS_INVALID_OPCODE);
+        }
+        record_latency(LATENCY_DISPATCH, received_);
+    }
+
+    // move the remaining (partial) frames to the start of the buffer.
+    if (offset)
+    {
+        read_length_ -= offset;
+        memmove(read_buffer_.data(), read_buffer_.data() + offset,
+                read_length_);
+    }
+
+    // Continue reading as long as there is space for more requests,
+    // otherwise reading will resume when a response has been sent.
+    if (pending_ < MAX_PENDING_REQUESTS && socket_.is_open() &&
+        read_length_ < read_buffer_.size())
+    {
+        read();
+    }
+    else
+    {
+        ESP_LOGD(CLIENT_TAG, "[%s] Pending request limit reached",
+                 peer_.c_str());
+    }
+}
+
+void BinaryServer::BinaryClient::queue_response(const response_frame &response)
+{
+    // If the client has disconnected while a request was pending there is
+    // no need to send the response.
+    if (!socket_.is_open())
+    {
+        return;
+    }
+
+    queued_.push_back(response);
+    if (sending_.empty())
+    {
+        write();
+    }
+}
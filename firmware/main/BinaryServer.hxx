@@ -0,0 +1,336 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#pragma once
+
+#include <array>
+#include <asio.hpp>
+#include <cstdint>
+#include <esp_netif.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "config.hxx"
+
+/// Server for the binary framed feeder protocol.
+///
+/// Requests and responses are fixed size frames (@ref request_frame and
+/// @ref response_frame) with all fields in little endian byte order. Each
+/// request carries a client provided sequence number which is returned in
+/// the response, responses are sent as soon as each request completes and
+/// may be received in a different order than the requests were sent.
+class BinaryServer
+{
+    // Forward declaration of client class
+    class BinaryClient;
+
+public:
+    /// Request sent by the client.
+    struct __attribute__((packed)) request_frame
+    {
+        /// Sequence number, returned as-is in the response.
+        uint32_t seq;
+
+        /// Operation to perform, see @ref opcode_t.
+        uint8_t opcode;
+
+        /// Request flags, see @ref FLAG_DEFERRED.
+        uint8_t flags;
+
+        /// Feeder ID the request applies to.
+        uint16_t feeder;
+
+        /// Operation specific argument.
+        uint16_t arg;
+
+        /// Reserved, must be zero.
+        uint16_t reserved;
+    };
+
+    /// Number of bytes available for the response payload.
+    static constexpr std::size_t RESPONSE_PAYLOAD_SIZE = 24;
+
+    /// Response sent to the client.
+    struct __attribute__((packed)) response_frame
+    {
+        /// Sequence number of the request.
+        uint32_t seq;
+
+        /// Operation of the request.
+        uint8_t opcode;
+
+        /// Result of the request, zero for success.
+        uint8_t status;
+
+        /// Feeder ID of the request.
+        uint16_t feeder;
+
+        /// Operation specific payload, unused bytes are zero.
+        uint8_t payload[RESPONSE_PAYLOAD_SIZE];
+    };
+
+    static_assert(sizeof(request_frame) == 12, "request_frame size mismatch");
+    static_assert(sizeof(response_frame) == 32, "response_frame size mismatch");
+
+    /// Supported request operations.
+    typedef enum : uint8_t
+    {
+        /// Returns an empty response, the argument is returned in the first
+        /// two bytes of the payload.
+        OPCODE_PING = 0,
+
+        /// Moves the feeder forward, the argument is the distance in mm
+        /// (zero uses the configured feed length). Equivalent of M610.
+        OPCODE_FEED = 1,
+
+        /// Post-pick action for the feeder. Equivalent of M611.
+        OPCODE_POST_PICK = 2,
+
+        /// Reports the status of the feeder, the payload contains the
+        /// status record of the feeder. Equivalent of M612.
+        OPCODE_STATUS = 3,
+
+        /// Pre-feeds the next part, the argument is the distance in mm (zero
+        /// uses the configured feed length). Equivalent of M616.
+        OPCODE_PREFEED = 4,
+
+        /// Enables the feeder. Equivalent of M614.
+        OPCODE_ENABLE = 5,
+
+        /// Disables the feeder. Equivalent of M615.
+        OPCODE_DISABLE = 6,
+
+        /// Number of opcodes, must be last.
+        OPCODE_COUNT
+    } opcode_t;
+
+    /// When set in @ref request_frame::flags the response to a feeder
+    /// movement is sent only after the movement has completed, this is the
+    /// equivalent of M620 S1 for a single request.
+    static constexpr uint8_t FLAG_DEFERRED = 0x01;
+
+    /// Response status for requests with an unknown opcode.
+    static constexpr uint8_t STATUS_INVALID_OPCODE = 0xFF;
+
+    /// Completion token provided to request handlers.
+    ///
+    /// The response to the request is queued for the client only when this
+    /// is invoked, it must be invoked exactly once and can be invoked from
+    /// any thread.
+    class completion
+    {
+    public:
+        /// @return true if the response should be sent only after the
+        /// request has fully completed (ie: feeder movement has finished).
+        bool deferred() const
+        {
+            return flags_ & FLAG_DEFERRED;
+        }
+
+        /// @return time (from esp_timer_get_time) at which the request was
+        /// received.
+        int64_t received() const
+        {
+            return received_;
+        }
+
+        /// Queues the response to the request for the client.
+        ///
+        /// @param status Result of the request, zero for success.
+        /// @param payload Optional response payload.
+        /// @param length Number of bytes in @param payload, this is truncated
+        /// to @ref RESPONSE_PAYLOAD_SIZE.
+        void operator()(uint8_t status, const void *payload = nullptr,
+                        std::size_t length = 0) const;
+
+    private:
+        friend class BinaryClient;
+
+        /// Constructor.
+        ///
+        /// @param client @ref BinaryClient that received the request.
+        /// @param request @ref request_frame being processed.
+        /// @param received Value to return from @ref received.
+        completion(std::shared_ptr<BinaryClient> client,
+                   const request_frame &request, int64_t received)
+            : client_(std::move(client)), seq_(request.seq),
+              feeder_(request.feeder), opcode_(request.opcode),
+              flags_(request.flags), received_(received)
+        {
+        }
+
+        /// @ref BinaryClient that will receive the response.
+        std::shared_ptr<BinaryClient> client_;
+
+        /// Sequence number of the request.
+        uint32_t seq_;
+
+        /// Feeder ID of the request.
+        uint16_t feeder_;
+
+        /// Operation of the request.
+        uint8_t opcode_;
+
+        /// Flags of the request.
+        uint8_t flags_;
+
+        /// Time at which the request was received.
+        int64_t received_;
+    };
+
+    /// Type used for the request handlers.
+    using request_handler =
+        std::function<void(const request_frame &, completion)>;
+
+    /// Constructor.
+    ///
+    /// @param context @ref asio::io_context to use for all client processing.
+    /// @param local_addr Local address, used only for logging.
+    /// @param port Port to listen on.
+    BinaryServer(asio::io_context &context, const esp_ip4_addr_t local_addr,
+                 const uint16_t port = BINARY_SERVER_PORT);
+
+    /// Registers the handler for an operation.
+    ///
+    /// @param opcode @ref opcode_t to register.
+    /// @param handler Handler to invoke for the operation.
+    ///
+    /// NOTE: Handlers must be registered before the @ref asio::io_context is
+    /// started.
+    void register_handler(opcode_t opcode, request_handler &&handler);
+
+private:
+    using tcp = asio::ip::tcp;
+
+    /// Log tag to use for this class.
+    static constexpr const char * const TAG = "binary_server";
+
+    BinaryServer(const BinaryServer &) = delete;
+    BinaryServer &operator=(const BinaryServer &) = delete;
+
+    /// TCP/IP listener that handles accepting new clients.
+    tcp::acceptor acceptor_;
+
+    /// Registered handler for each @ref opcode_t.
+    std::array<request_handler, OPCODE_COUNT> handlers_;
+
+    /// Collection of connected clients.
+    std::set<std::shared_ptr<BinaryClient>> clients_;
+
+    /// Protects @ref clients_.
+    std::mutex clients_mux_;
+
+    /// Starts accepting client connections in an asynchronous manner.
+    void do_accept();
+
+    /// Stops a @ref BinaryClient and cleans up resources.
+    ///
+    /// @param client @ref BinaryClient to stop and cleanup.
+    void stop(std::shared_ptr<BinaryClient> client);
+
+    /// Client implementation that processes incoming request frames.
+    class BinaryClient
+        : public std::enable_shared_from_this<BinaryClient>
+    {
+    public:
+        BinaryClient(const BinaryClient &) = delete;
+        BinaryClient &operator=(const BinaryClient &) = delete;
+
+        /// Constructor.
+        ///
+        /// @param socket TCP/IP socket for the remote client.
+        /// @param server @ref BinaryServer that manages this client.
+        BinaryClient(tcp::socket &&socket, BinaryServer &server);
+
+        /// Starts this client.
+        void start();
+
+        /// Stops this client.
+        void stop();
+
+    private:
+        friend class completion;
+
+        /// Log tag to use for this class.
+        static constexpr const char *CLIENT_TAG = "binary_client";
+
+        /// Maximum number of requests that can be awaiting a response, once
+        /// reached no further requests will be read until a response has
+        /// been sent.
+        static constexpr std::size_t MAX_PENDING_REQUESTS =
+            BINARY_MAX_PIPELINED_REQUESTS;
+
+        /// Socket connected to the remote peer.
+        tcp::socket socket_;
+
+        /// Strand used to serialize all operations for this client.
+        asio::strand<tcp::socket::executor_type> strand_;
+
+        /// Server which manages this client.
+        BinaryServer &server_;
+
+        /// String format of the remote peer's address.
+        std::string peer_;
+
+        /// Buffer to use for receiving request frames from the peer.
+        std::array<uint8_t, sizeof(request_frame) * MAX_PENDING_REQUESTS>
+            read_buffer_;
+
+        /// Number of bytes in @ref read_buffer_ which have not yet been
+        /// processed.
+        std::size_t read_length_{0};
+
+        /// Responses which are ready to be sent.
+        std::vector<response_frame> queued_;
+
+        /// Responses included in the pending write.
+        std::vector<response_frame> sending_;
+
+        /// Number of requests which have been received and not yet had their
+        /// response sent.
+        std::size_t pending_{0};
+
+        /// When true a read operation is pending.
+        bool reading_{false};
+
+        /// Time (from esp_timer_get_time) at which the most recent data was
+        /// received, used as the arrival time of the buffered requests.
+        int64_t received_{0};
+
+        /// Utility function that starts (or restarts) a read operation on the
+        /// connected remote client.
+        void read();
+
+        /// Utility function that starts writing the queued responses to the
+        /// connected remote client.
+        void write();
+
+        /// Callback for read completion.
+        ///
+        /// @param error When non-zero an error occurred, otherwise the read
+        /// can be considered successful.
+        /// @param size Number of bytes received from the remote client.
+        void on_read(asio::error_code error, std::size_t size);
+
+        /// Callback for write completion.
+        ///
+        /// @param error When non-zero an error occurred, otherwise the write
+        /// can be considered successful.
+        void on_write(asio::error_code error);
+
+        /// Processes all complete request frames that have been received and
+        /// resumes reading when there is space for more requests.
+        void process_buffered_requests();
+
+        /// Queues a response to be sent to the remote client.
+        ///
+        /// @param response Response to send.
+        void queue_response(const response_frame &response);
+    };
+};
@@ -4,32 +4,36 @@
  * SPDX-License-Identifier: CC-BY-NC-SA-4.0
  */
 
+#include <algorithm>
 #include <asio.hpp>
 #include <esp_log.h>
 #include <cstdint>
-#include <nvs.h>
-#include <nvs_flash.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <string>
+#include <thread>
 
 #include "config.hxx"
 #include "GCodeServer.hxx"
 #include "FeederManager.hxx"
+#include "Latency.hxx"
+#include "Trace.hxx"
 #include "Feeder.hxx"
 #include "Utils.hxx"
 
-Feeder::Feeder(std::size_t id, uint32_t uuid, std::shared_ptr<PCA9685> pca9685,
-           uint8_t channel, asio::io_context &context,
-           std::shared_ptr<MCP23017> mcp23017)
+Feeder::Feeder(std::size_t id, uint32_t uuid, PCA9685 *pca9685,
+               uint8_t channel, FeederManager &manager, strand_type strand,
+               hot_state_t &hot, MCP23017 *mcp23017)
     : id_(id), uuid_(uuid), pca9685_(pca9685), mcp23017_(mcp23017),
-      channel_(channel), timer_(context)
+      channel_(channel), hot_(hot), manager_(manager),
+      strand_(std::move(strand))
 {
-    nvskey_ = "feeder-";
-    nvskey_.append(to_hex(uuid_));
+    refresh_status();
 }
 
-bool Feeder::move(uint8_t distance)
+bool Feeder::move(uint8_t distance, completion_callback callback)
 {
-    const std::lock_guard<std::mutex> lock(mux_);
     if (is_moving())
     {
         ESP_LOGW(TAG,
@@ -40,66 +44,200 @@ bool Feeder::move(uint8_t distance)
 
     if (distance == 0)
     {
-        movement_ = config_.feed_length;
+        hot_.movement = config_.feed_length;
     }
     else
     {
-        movement_ = distance;
+        hot_.movement = distance;
     }
 
-    status_ = FEEDER_MOVING;
+    set_status(FEEDER_MOVING);
+    completion_ = std::move(callback);
 
     // start moving the feeder forward.
-    move_locked();
+    start_advance();
 
     return true;
 }
 
-bool Feeder::post_pick()
+bool Feeder::post_pick(completion_callback callback)
 {
     if (!is_enabled())
     {
         return false;
     }
-    else if (position_ != POSITION_RETRACTED)
+
+    if (hot_.position != POSITION_RETRACTED)
+    {
+        if (is_moving())
+        {
+            return false;
+        }
+        completion_ = std::move(callback);
+        start_retract();
+        return true;
+    }
+
+    // Feeder is already retracted, there is nothing further to wait for.
+    if (callback)
+    {
+        callback(true);
+    }
+    return true;
+}
+
+bool Feeder::prefeed(uint8_t distance)
+{
+    if (!is_enabled() || prefeed_ != PREFEED_NONE)
     {
-        const std::lock_guard<std::mutex> lock(mux_);
-        retract_locked();
+        return false;
     }
+    prefeed_distance_ = distance;
+    prefeed_ = PREFEED_PENDING;
+
+    // start the movement now if the feeder is already retracted, otherwise it
+    // will be started once the post-pick retraction has completed.
+    start_prefeed();
     return true;
 }
 
+bool Feeder::claim_prefeed(completion_callback callback)
+{
+    if (prefeed_ == PREFEED_PRESENTED)
+    {
+        // part has already been presented, there is nothing to wait for.
+        prefeed_ = PREFEED_NONE;
+        if (callback)
+        {
+            callback(true);
+        }
+        return true;
+    }
+    else if (prefeed_ == PREFEED_MOVING)
+    {
+        // pre-feed movement is in progress, complete the request once it has
+        // finished.
+        prefeed_ = PREFEED_NONE;
+        completion_ = std::move(callback);
+        return true;
+    }
+    else if (prefeed_ == PREFEED_PENDING)
+    {
+        if (!is_busy())
+        {
+            // the feeder is idle without retracting, the pre-feed would not
+            // be started without a post-pick so process the request
+            // normally instead.
+            prefeed_ = PREFEED_NONE;
+            return false;
+        }
+        // the post-pick retraction is still in progress.
+        prefeed_ = PREFEED_CLAIMED;
+        prefeed_callback_ = std::move(callback);
+        return true;
+    }
+    return false;
+}
+
 std::string Feeder::status()
 {
-    std::string status = FeederManager::FEEDER_STATUS_CMD;
-    status.reserve(128);
-    status.append(" N").append(std::to_string(id_));
-    status.append(" A").append(std::to_string(config_.servo_full_angle));
-    status.append(" B").append(std::to_string(config_.servo_half_angle));
-    status.append(" C").append(std::to_string(config_.servo_retract_angle));
-    status.append(" D").append(std::to_string(config_.movement_degrees));
-    status.append(" F").append(std::to_string(config_.feed_length));
-    status.append(" S").append(std::to_string(config_.movement_interval_ms));
-    status.append(" U").append(std::to_string(config_.settle_time_ms));
-    status.append(" V").append(std::to_string(config_.servo_min_pulse));
-    status.append(" W").append(std::to_string(config_.servo_max_pulse));
-    status.append(" X").append(std::to_string(position_));
-    status.append(" Y").append(std::to_string(status_));
-    status.append(" Z").append(std::to_string(config_.ignore_feedback));
+    std::string status;
+    status.reserve(STATUS_TEXT_SIZE);
+    append_status(status, false);
     return status;
 }
 
+void Feeder::append_status(std::string &buffer, bool hex) const
+{
+    // The cache is updated only on strand_, readers retry when an update
+    // happened while the cache was being copied.
+    const std::size_t base = buffer.size();
+    while (true)
+    {
+        const uint32_t seq = status_seq_.load(std::memory_order_acquire);
+        if (seq & 1)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        if (hex)
+        {
+            static const char *digits = "0123456789ABCDEF";
+            for (std::size_t idx = 0; idx < STATUS_RECORD_SIZE; idx++)
+            {
+                buffer.push_back(digits[status_record_[idx] >> 4]);
+                buffer.push_back(digits[status_record_[idx] & 0x0F]);
+            }
+        }
+        else
+        {
+            buffer.append(status_text_,
+                          std::min<std::size_t>(status_length_,
+                                                sizeof(status_text_)));
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (status_seq_.load(std::memory_order_relaxed) == seq)
+        {
+            return;
+        }
+        buffer.resize(base);
+    }
+}
+
+void Feeder::read_status_record(uint8_t *record) const
+{
+    while (true)
+    {
+        const uint32_t seq = status_seq_.load(std::memory_order_acquire);
+        if (seq & 1)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        memcpy(record, status_record_, sizeof(status_record_));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (status_seq_.load(std::memory_order_relaxed) == seq)
+        {
+            return;
+        }
+    }
+}
+
 bool Feeder::enable()
 {
-    const std::lock_guard<std::mutex> lock(mux_);
-    status_ = FEEDER_IDLE;
+    set_status(FEEDER_IDLE);
     return true;
 }
 
 bool Feeder::disable()
 {
-    const std::lock_guard<std::mutex> lock(mux_);
-    status_ = FEEDER_DISABLED;
+    set_status(FEEDER_DISABLED);
+    completion_callback callback = take_completion();
+    completion_callback prefeed_callback = std::move(prefeed_callback_);
+    prefeed_callback_ = nullptr;
+    prefeed_ = PREFEED_NONE;
+
+    // drop a servo movement that has not started yet so that it is not
+    // resumed later, when the feeder has already been granted permission to
+    // move it will be returned by resume_motion.
+    if (hot_.phase == MOTION_WAITING && manager_.cancel_motion_slot(id_))
+    {
+        hot_.phase = MOTION_IDLE;
+    }
+
+    // abort any pending movement request.
+    if (callback || prefeed_callback)
+    {
+        set_fault(FAULT_ABORTED);
+    }
+    if (callback)
+    {
+        callback(false);
+    }
+    if (prefeed_callback)
+    {
+        prefeed_callback(false);
+    }
     return true;
 }
 
@@ -161,35 +299,31 @@ void Feeder::configure(uint8_t advance_angle, uint8_t half_advance_angle,
 
     if (need_persist)
     {
-        nvs_handle_t nvs;
-        // persist the updated configuration
-        ESP_ERROR_CHECK(nvs_open(NVS_FEEDER_NAMESPACE, NVS_READWRITE, &nvs));
-        ESP_ERROR_CHECK(
-            nvs_set_blob(nvs, nvskey_.c_str(), &config_, configsize_));
-        ESP_ERROR_CHECK(nvs_commit(nvs));
-        nvs_close(nvs);
+        refresh_status();
+
+        // persist the updated configuration, this will be written to NVS
+        // once no further updates have been received.
+        manager_.config_store_.store(uuid_, config_);
     }
 }
 
 bool Feeder::is_busy()
 {
-    return !is_enabled() && status_ != FEEDER_IDLE;
+    return is_enabled() && hot_.status != FEEDER_IDLE;
 }
 
 bool Feeder::is_enabled()
 {
-    return status_ != FEEDER_DISABLED;
+    return hot_.status != FEEDER_DISABLED;
 }
 
 bool Feeder::is_moving()
 {
-    return status_ == FEEDER_MOVING;
+    return hot_.status == FEEDER_MOVING;
 }
 
 bool Feeder::is_tensioned()
 {
-    const std::lock_guard<std::mutex> lock(mux_);
-
     if (config_.ignore_feedback)
     {
         return true;
@@ -198,11 +332,47 @@ bool Feeder::is_tensioned()
     return tensioned_;
 }
 
-void Feeder::feedback_state_changed(bool state)
+void Feeder::track_latency(int64_t received)
 {
+    request_received_ = received;
+    request_first_update_ = true;
+}
+
+void Feeder::feedback_state_changed(bool state,
+                                    std::chrono::steady_clock::time_point when)
+{
+    if (tensioned_.exchange(state) != state)
     {
-        const std::lock_guard<std::mutex> lock(mux_);
-        tensioned_ = state;
+        manager_.feeder_event(id_, FeederManager::FEEDER_EVENT_TENSION);
+    }
+
+    // the tension is released while the tape is being moved and restored
+    // once the mechanism has settled, track this for the adaptive settle
+    // time.
+    if (hot_.phase == MOTION_MOVING || hot_.phase == MOTION_SETTLING)
+    {
+        tension_restored_ = state;
+        tension_restored_at_ = when;
+        if (hot_.phase == MOTION_SETTLING && adaptive_settle())
+        {
+            using std::chrono::milliseconds;
+            const auto limit =
+                settle_start_ + milliseconds(config_.settle_time_ms);
+            if (state)
+            {
+                // finish settling shortly after the tension is restored.
+                const auto settled = std::max(
+                    when + milliseconds(FEEDER_ADAPTIVE_SETTLE_MARGIN_MS),
+                    settle_start_ + milliseconds(FEEDER_ADAPTIVE_SETTLE_MIN_MS));
+                hot_.phase_time = std::min(settled, limit);
+            }
+            else
+            {
+                // the tension has been lost again, wait for it to be
+                // restored.
+                hot_.phase_time = limit;
+            }
+        }
     }
 
     // If the feeder is not currently busy check the state of the feedback to
@@ -216,7 +386,11 @@ void Feeder::feedback_state_changed(bool state)
         }
         else if (advance_)
         {
-            move();
+            if (move())
+            {
+                manager_.feeder_event(id_,
+                                      FeederManager::FEEDER_EVENT_MANUAL_ADVANCE);
+            }
             advance_ = false;
         }
     }
@@ -226,15 +400,15 @@ void Feeder::feedback_state_changed(bool state)
     }
 }
 
-void Feeder::initialize()
+void Feeder::initialize(const FeederConfigStore::feeder_config_t *config)
 {
-    size_t config_size = configsize_;
-    nvs_handle_t nvs;
-    memset(&config_, 0, configsize_);
+    memset(&config_, 0, sizeof(feeder_config_t));
 
-    ESP_ERROR_CHECK(nvs_open(NVS_FEEDER_NAMESPACE, NVS_READWRITE, &nvs));
-    esp_err_t res = nvs_get_blob(nvs, nvskey_.c_str(), &config_, &config_size);
-    if (config_size != configsize_ || res != ESP_OK)
+    if (config)
+    {
+        config_ = *config;
+    }
+    else
     {
         ESP_LOGW(TAG,
                  "[%s:%zu] Configuration not found or corrupt, rebuilding..",
@@ -255,237 +429,458 @@ void Feeder::initialize()
             config_.ignore_feedback = 1;
         }
 
-        ESP_ERROR_CHECK(
-            nvs_set_blob(nvs, nvskey_.c_str(), &config_, configsize_));
-        ESP_ERROR_CHECK(nvs_commit(nvs));
+        manager_.config_store_.store(uuid_, config_);
     }
-    nvs_close(nvs);
+    persisted_advance_settle_ms_ = config_.learned_advance_settle_ms;
+    persisted_retract_settle_ms_ = config_.learned_retract_settle_ms;
+    refresh_status();
 
     ESP_LOGI(TAG,
              "[%s:%zu] Initializing using PCA9685 %p:%d",
-             to_hex(uuid_).c_str(), id_, pca9685_.get(), channel_);
+             to_hex(uuid_).c_str(), id_, pca9685_, channel_);
 
     if (mcp23017_ && !config_.ignore_feedback)
     {
         ESP_LOGI(TAG, "[%s:%zu] Subscribing to MCP23017 channel %d",
                  to_hex(uuid_).c_str(), id_, channel_);
         mcp23017_->subscribe(channel_,
-                             std::bind(&Feeder::feedback_state_changed,
-                                       shared_from_this(), std::placeholders::_1));
+            [this](bool state)
+            {
+                // the MCP23017 reports state changes from any thread,
+                // process them on the feeder strand. The time is captured
+                // here as it is closest to when the IO pins were read.
+                asio::dispatch(strand_,
+                               std::bind(&Feeder::feedback_state_changed,
+                                         this, state,
+                                         std::chrono::steady_clock::now()));
+            });
         ESP_LOGI(TAG, "[%s:%zu] Feedback enabled using MCP23017 %p:%d",
-                 to_hex(uuid_).c_str(), id_, mcp23017_.get(), channel_);
+                 to_hex(uuid_).c_str(), id_, mcp23017_, channel_);
+    }
+}
+
+bool Feeder::motion_tick(std::chrono::steady_clock::time_point now)
+{
+    completion_callback callback;
+    bool success = false;
+
+    if (hot_.phase == MOTION_MOVING)
+    {
+        // the movement may have started after the time of this tick was
+        // captured.
+        const auto elapsed = std::max(
+            std::chrono::milliseconds(0),
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                now - hot_.phase_time));
+        if (elapsed.count() >= hot_.duration_ms)
+        {
+            // servo has reached the target angle, start the settle period.
+            hot_.current_degrees = hot_.target_degrees;
+            hot_.phase = MOTION_SETTLING;
+            settle_start_ = now;
+            hot_.phase_time = now + std::chrono::milliseconds(settle_time_ms());
+
+            // the servo draws the most current while moving, allow another
+            // servo to start moving.
+            manager_.release_motion_slot(id_);
+        }
+        else
+        {
+            // follow the motion profile from the starting angle to the
+            // target angle.
+            const std::size_t index =
+                (elapsed.count() * (FeederManager::MOTION_PROFILE_SIZE - 1)) /
+                hot_.duration_ms;
+            const int32_t distance =
+                hot_.target_degrees - hot_.start_degrees;
+            hot_.current_degrees = hot_.start_degrees +
+                (distance * FeederManager::MOTION_PROFILE[index]) /
+                FeederManager::MOTION_PROFILE_SCALE;
+        }
+        pca9685_->stage_servo_angle(channel_, hot_.current_degrees,
+                                    config_.servo_min_pulse,
+                                    config_.servo_max_pulse);
+        if (request_first_update_)
+        {
+            // the staged update is sent by the FeederManager once all feeders
+            // in the group have been advanced for this tick.
+            record_latency(LATENCY_FIRST_I2C, request_received_);
+            request_first_update_ = false;
+        }
+    }
+    else if (hot_.phase == MOTION_SETTLING && now >= hot_.phase_time)
+    {
+        const auto limit =
+            settle_start_ + std::chrono::milliseconds(config_.settle_time_ms);
+        if (adaptive_settle() && !tensioned_ && now < limit)
+        {
+            // the learned settle time has passed without the tension being
+            // restored, wait for it up to the configured settle time.
+            hot_.phase_time = limit;
+        }
+        else
+        {
+            learn_settle_time(now);
+            hot_.phase = MOTION_IDLE;
+            callback = movement_settled(success);
+            if (callback)
+            {
+                callback(success);
+            }
+        }
     }
+    // the settled handling may have started another movement, a waiting
+    // movement does not need further ticks until it has been resumed.
+    return hot_.phase == MOTION_MOVING || hot_.phase == MOTION_SETTLING;
+}
+
+bool Feeder::adaptive_settle() const
+{
+    return FEEDER_ADAPTIVE_SETTLE && mcp23017_ && !config_.ignore_feedback;
+}
+
+uint16_t &Feeder::learned_settle_ms()
+{
+    return hot_.position == POSITION_RETRACTED ?
+        config_.learned_retract_settle_ms : config_.learned_advance_settle_ms;
+}
 
-    // move the feeder to retracted position.
+uint16_t Feeder::settle_time_ms()
+{
+    const uint16_t learned = learned_settle_ms();
+    if (!adaptive_settle() || !learned)
     {
-        const std::lock_guard<std::mutex> lock(mux_);
-        retract_locked();
+        return config_.settle_time_ms;
     }
+    return std::min<uint16_t>(config_.settle_time_ms,
+        std::max<uint16_t>(FEEDER_ADAPTIVE_SETTLE_MIN_MS,
+                           learned + FEEDER_ADAPTIVE_SETTLE_MARGIN_MS));
 }
 
-void Feeder::update(asio::error_code error)
+void Feeder::learn_settle_time(std::chrono::steady_clock::time_point now)
 {
-    const std::lock_guard<std::mutex> lock(mux_);
+    if (!adaptive_settle() || !tension_restored_)
+    {
+        return;
+    }
+
+    // the tension may have been restored before the servo reached the
+    // target angle, count this as settling immediately.
+    const auto restored = std::chrono::duration_cast<std::chrono::milliseconds>(
+        tension_restored_at_ - settle_start_).count();
+    const uint16_t sample = std::clamp<int64_t>(restored, 1,
+                                                config_.settle_time_ms);
+    uint16_t &learned = learned_settle_ms();
+    if (learned)
+    {
+        learned = ((learned * (FEEDER_ADAPTIVE_SETTLE_WEIGHT - 1)) + sample) /
+                  FEEDER_ADAPTIVE_SETTLE_WEIGHT;
+    }
+    else
+    {
+        learned = sample;
+    }
+    trace(TRACE_FEEDER_SETTLED, id_,
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              now - settle_start_).count(), learned);
 
-    if (error && error != asio::error::operation_aborted)
+    uint16_t &persisted = hot_.position == POSITION_RETRACTED ?
+        persisted_retract_settle_ms_ : persisted_advance_settle_ms_;
+    if (std::abs(learned - persisted) >=
+        FEEDER_ADAPTIVE_SETTLE_PERSIST_DELTA_MS)
     {
-        ESP_LOGE(TAG, "[%s:%zu] Error received from timer: %s (%d)",
-                 to_hex(uuid_).c_str(), id_, error.message().c_str(),
-                 error.value());
+        persisted = learned;
+        manager_.config_store_.store(uuid_, config_);
     }
-    else if (is_enabled() && is_moving() && movement_ > 0)
+}
+
+Feeder::completion_callback Feeder::movement_settled(bool &success)
+{
+    if (is_enabled() && is_moving() && hot_.movement > 0)
     {
-        ESP_LOGI(TAG, "[%s:%zu] Feeder movement remaining: %dmm",
-                 to_hex(uuid_).c_str(), id_, movement_);
+        trace(TRACE_FEEDER_REMAINING, id_, hot_.movement);
         // continue moving
-        move_locked();
+        start_advance();
     }
     else if (is_enabled())
     {
-        ESP_LOGI(TAG, "[%s:%zu] Feeder movement complete, turning off servo",
-                 to_hex(uuid_).c_str(), id_);
+        trace(TRACE_FEEDER_COMPLETE, id_);
         // disable the servo PWM signal.
         pca9685_->off(channel_);
 
         // reset the feeder status to idle.
-        status_ = FEEDER_IDLE;
+        set_status(FEEDER_IDLE);
+        success = true;
+        if (request_received_)
+        {
+            record_latency(LATENCY_FEEDER_IDLE, request_received_);
+            request_received_ = 0;
+            request_first_update_ = false;
+        }
+        if (prefeed_ == PREFEED_MOVING)
+        {
+            prefeed_ = PREFEED_PRESENTED;
+        }
+        completion_callback callback = take_completion();
+
+        // start the pre-feed movement if this was the post-pick retraction.
+        start_prefeed();
+        return callback;
     }
+    return nullptr;
 }
 
-void Feeder::servo_movement_complete(asio::error_code error)
+void Feeder::set_status(feeder_status_t status)
 {
-    const std::lock_guard<std::mutex> lock(mux_);
+    if (hot_.status.exchange(status) != status)
+    {
+        refresh_status();
+        manager_.feeder_event(id_, FeederManager::FEEDER_EVENT_STATE);
+    }
+    if (status == FEEDER_MOVING)
+    {
+        set_fault(FAULT_NONE);
+    }
+}
 
-    if (error && error != asio::error::operation_aborted)
+void Feeder::set_position(feeder_position_t position)
+{
+    if (hot_.position.exchange(position) != position)
     {
-        ESP_LOGE(TAG, "[%s:%zu] Error received from timer: %s (%d)",
-                 to_hex(uuid_).c_str(), id_, error.message().c_str(),
-                 error.value());
+        refresh_status();
+        manager_.feeder_event(id_, FeederManager::FEEDER_EVENT_STATE);
     }
-    else
+}
+
+void Feeder::set_fault(feeder_fault_t fault)
+{
+    if (fault_.exchange(fault) != fault)
     {
-        if (targetDegrees_ < currentDegrees_ &&
-            (currentDegrees_ - config_.movement_degrees) > targetDegrees_)
-        {
-            // if the target angle is lower than the current angle and our
-            // movement distance will not move beyond the target angle, move
-            // by the movement distance amount.
-            currentDegrees_ -= config_.movement_degrees;
-        }
-        else if (targetDegrees_ > currentDegrees_ &&
-                 (currentDegrees_ + config_.movement_degrees) < targetDegrees_)
-        {
-            // if the target angle is higher than the current angle and our
-            // movement distance will not move beyond the target angle, move
-            // by the movement distance amount.
-            currentDegrees_ += config_.movement_degrees;
-        }
-        else
-        {
-            currentDegrees_ = targetDegrees_;
-        }
-        pca9685_->set_servo_angle(channel_, currentDegrees_,
-                                  config_.servo_min_pulse,
-                                  config_.servo_max_pulse);
+        manager_.feeder_event(id_, FeederManager::FEEDER_EVENT_FAULT);
+    }
+}
 
-        if (currentDegrees_ != targetDegrees_)
-        {
-            // additional movement will be required.
-            timer_.expires_from_now(
-                std::chrono::milliseconds(config_.movement_interval_ms));
-            timer_.async_wait(
-                std::bind(&Feeder::servo_movement_complete, this,
-                          std::placeholders::_1));
-        }
-        else
+void Feeder::refresh_status()
+{
+    const uint8_t record[STATUS_RECORD_SIZE] =
+    {
+        static_cast<uint8_t>(id_),
+        config_.servo_full_angle,
+        config_.servo_half_angle,
+        config_.servo_retract_angle,
+        config_.movement_degrees,
+        config_.feed_length,
+        static_cast<uint8_t>(config_.movement_interval_ms & 0xFF),
+        static_cast<uint8_t>(config_.movement_interval_ms >> 8),
+        static_cast<uint8_t>(config_.settle_time_ms & 0xFF),
+        static_cast<uint8_t>(config_.settle_time_ms >> 8),
+        static_cast<uint8_t>(config_.servo_min_pulse & 0xFF),
+        static_cast<uint8_t>(config_.servo_min_pulse >> 8),
+        static_cast<uint8_t>(config_.servo_max_pulse & 0xFF),
+        static_cast<uint8_t>(config_.servo_max_pulse >> 8),
+        hot_.position.load(),
+        hot_.status.load(),
+        config_.ignore_feedback
+    };
+    // seqlock write, there is only a single writer (strand_) so the sequence
+    // counter does not need to be incremented atomically.
+    const uint32_t seq = status_seq_.load(std::memory_order_relaxed);
+    status_seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    int length =
+        snprintf(status_text_, sizeof(status_text_),
+                 "%s N%zu A%u B%u C%u D%u F%u S%u U%u V%u W%u X%u Y%u Z%u",
+                 FeederManager::FEEDER_STATUS_CMD, id_,
+                 config_.servo_full_angle, config_.servo_half_angle,
+                 config_.servo_retract_angle, config_.movement_degrees,
+                 config_.feed_length, config_.movement_interval_ms,
+                 config_.settle_time_ms, config_.servo_min_pulse,
+                 config_.servo_max_pulse, hot_.position.load(),
+                 hot_.status.load(), config_.ignore_feedback);
+    status_length_ =
+        std::clamp<int>(length, 0, sizeof(status_text_) - 1);
+    memcpy(status_record_, record, sizeof(status_record_));
+
+    status_seq_.store(seq + 2, std::memory_order_release);
+}
+
+Feeder::completion_callback Feeder::take_completion()
+{
+    completion_callback callback = std::move(completion_);
+    completion_ = nullptr;
+    return callback;
+}
+
+void Feeder::start_prefeed()
+{
+    if ((prefeed_ != PREFEED_PENDING && prefeed_ != PREFEED_CLAIMED) ||
+        is_busy() || hot_.position != POSITION_RETRACTED)
+    {
+        return;
+    }
+    completion_callback callback = std::move(prefeed_callback_);
+    prefeed_callback_ = nullptr;
+    if (!is_tensioned())
+    {
+        ESP_LOGW(TAG, "[%s:%zu] Tape cover is not tensioned, dropping pre-feed",
+                 to_hex(uuid_).c_str(), id_);
+        prefeed_ = PREFEED_NONE;
+        set_fault(FAULT_NOT_TENSIONED);
+        if (callback)
         {
-            // servo has reached the target angle, call the update method after
-            // settle period.
-            timer_.expires_from_now(
-                std::chrono::milliseconds(config_.settle_time_ms));
-            timer_.async_wait(
-                std::bind(&Feeder::update, this, std::placeholders::_1));
+            callback(false);
         }
+        return;
     }
-
+    trace(TRACE_FEEDER_PREFEED, id_, prefeed_distance_);
+    // a claimed pre-feed is a regular movement for the request that claimed
+    // it, otherwise the part will be presented once the movement completes.
+    prefeed_ = (prefeed_ == PREFEED_CLAIMED) ? PREFEED_NONE : PREFEED_MOVING;
+    move(prefeed_distance_, std::move(callback));
 }
 
-void Feeder::retract_locked()
+void Feeder::start_retract()
 {
-    status_ = FEEDER_MOVING;
-    position_ = POSITION_RETRACTED;
+    set_status(FEEDER_MOVING);
+    set_position(POSITION_RETRACTED);
     set_servo_angle(config_.servo_retract_angle);
 }
 
-void Feeder::move_locked()
+void Feeder::start_advance()
 {
-    if (position_ == POSITION_RETRACTED)
+    trace(TRACE_FEEDER_ADVANCE, id_, hot_.position.load(), hot_.movement);
+    if (hot_.position == POSITION_RETRACTED)
     {
-        ESP_LOGI(TAG, "[%s:%zu] Feeder is retracted", to_hex(uuid_).c_str(),
-                 id_);
-        if (movement_ >= FEEDER_MECHANICAL_ADVANCE_LENGTH)
+        if (hot_.movement >= FEEDER_MECHANICAL_ADVANCE_LENGTH)
         {
-            ESP_LOGI(TAG, "[%s:%zu] Moving to fully advanced position",
-                     to_hex(uuid_).c_str(), id_);
-            position_ = POSITION_ADVANCED_FULL;
-            movement_ -= FEEDER_MECHANICAL_ADVANCE_LENGTH;
+            set_position(POSITION_ADVANCED_FULL);
+            hot_.movement -= FEEDER_MECHANICAL_ADVANCE_LENGTH;
             set_servo_angle(config_.servo_full_angle);
+            return;
         }
-        else if (movement_ >= FEEDER_MECHANICAL_ADVANCE_LENGTH / 2)
+        else if (hot_.movement >= FEEDER_MECHANICAL_ADVANCE_LENGTH / 2)
         {
-            ESP_LOGI(TAG, "[%s:%zu] Moving to half advanced position",
-                     to_hex(uuid_).c_str(), id_);
-            position_ = POSITION_ADVANCED_HALF;
-            movement_ -= (FEEDER_MECHANICAL_ADVANCE_LENGTH / 2);
+            set_position(POSITION_ADVANCED_HALF);
+            hot_.movement -= (FEEDER_MECHANICAL_ADVANCE_LENGTH / 2);
             set_servo_angle(config_.servo_half_angle);
+            return;
         }
     }
-    else if (position_ == POSITION_ADVANCED_HALF)
+    else if (hot_.position == POSITION_ADVANCED_HALF)
     {
-        ESP_LOGI(TAG, "[%s:%zu] Feeder is half advanced",
-                 to_hex(uuid_).c_str(), id_);
-        if (movement_ >= FEEDER_MECHANICAL_ADVANCE_LENGTH / 2)
+        if (hot_.movement >= FEEDER_MECHANICAL_ADVANCE_LENGTH / 2)
         {
-            ESP_LOGI(TAG, "[%s:%zu] Moving to fully advanced position",
-                     to_hex(uuid_).c_str(), id_);
-            position_ = POSITION_ADVANCED_FULL;
-            movement_ -= (FEEDER_MECHANICAL_ADVANCE_LENGTH / 2);
+            set_position(POSITION_ADVANCED_FULL);
+            hot_.movement -= (FEEDER_MECHANICAL_ADVANCE_LENGTH / 2);
             set_servo_angle(config_.servo_full_angle);
+            return;
         }
     }
-    else if (position_ == POSITION_ADVANCED_FULL)
+    else if (hot_.position == POSITION_ADVANCED_FULL)
     {
-        ESP_LOGI(TAG, "[%s:%zu] Feeder fully advanced, retracting",
-                 to_hex(uuid_).c_str(), id_);
-        retract_locked();
+        start_retract();
+        return;
     }
     else
     {
         ESP_LOGE(TAG,
                  "[%s:%zu] Feeder is not in an expect state! position: %d",
-                 to_hex(uuid_).c_str(), id_, position_);
+                 to_hex(uuid_).c_str(), id_, hot_.position.load());
+    }
+
+    // the remaining movement is shorter than the smallest step, complete the
+    // movement as failed instead of leaving the feeder in the moving state.
+    ESP_LOGW(TAG, "[%s:%zu] Unable to move remaining %dmm, stopping movement.",
+             to_hex(uuid_).c_str(), id_, hot_.movement);
+    movement_failed();
+}
+
+void Feeder::movement_failed()
+{
+    hot_.movement = 0;
+    pca9685_->off(channel_);
+    set_status(FEEDER_IDLE);
+    set_fault(FAULT_INCOMPLETE);
+
+    // the part was not presented, a pre-feed must not be claimed by the next
+    // movement request.
+    prefeed_ = PREFEED_NONE;
+    request_received_ = 0;
+    request_first_update_ = false;
+    completion_callback prefeed_callback = std::move(prefeed_callback_);
+    prefeed_callback_ = nullptr;
+    completion_callback callback = take_completion();
+    if (prefeed_callback)
+    {
+        prefeed_callback(false);
+    }
+    if (callback)
+    {
+        callback(false);
     }
 }
 
 void Feeder::set_servo_angle(uint8_t angle)
 {
-    targetDegrees_ = angle;
-    if (config_.movement_degrees)
+    hot_.target_degrees = angle;
+    if (hot_.phase == MOTION_MOVING)
     {
-        if (targetDegrees_ < currentDegrees_ &&
-            (currentDegrees_ - config_.movement_degrees) > targetDegrees_)
-        {
-            // if the target angle is lower than the current angle and our
-            // movement distance will not move beyond the target angle, move
-            // by the movement distance amount.
-            currentDegrees_ -= config_.movement_degrees;
-        }
-        else if (targetDegrees_ > currentDegrees_ &&
-                 (currentDegrees_ + config_.movement_degrees) < targetDegrees_)
-        {
-            // if the target angle is higher than the current angle and our
-            // movement distance will not move beyond the target angle, move
-            // by the movement distance amount.
-            currentDegrees_ += config_.movement_degrees;
-        }
-        else
-        {
-            currentDegrees_ = targetDegrees_;
-        }
-        pca9685_->set_servo_angle(channel_, currentDegrees_,
-                                  config_.servo_min_pulse,
-                                  config_.servo_max_pulse);
+        // the servo already holds a motion slot, restart the movement from
+        // the current angle towards the new target.
+        begin_motion();
+        return;
+    }
+    else if (hot_.phase == MOTION_WAITING)
+    {
+        // the new target will be used once the feeder has been resumed.
+        trace(TRACE_SERVO_WAITING, id_, hot_.target_degrees);
+        return;
+    }
+    if (!manager_.acquire_motion_slot(id_))
+    {
+        trace(TRACE_SERVO_WAITING, id_, hot_.target_degrees);
+        hot_.phase = MOTION_WAITING;
+        return;
+    }
+    begin_motion();
+}
 
-        if (currentDegrees_ != targetDegrees_)
-        {
-            // additional movement will be required.
-            timer_.expires_from_now(
-                std::chrono::milliseconds(config_.movement_interval_ms));
-            timer_.async_wait(
-                std::bind(&Feeder::servo_movement_complete, this,
-                          std::placeholders::_1));
-        }
-        else
-        {
-            // servo will move to the target angle, call the update method
-            // after settle period.
-            timer_.expires_from_now(
-                std::chrono::milliseconds(config_.settle_time_ms));
-            timer_.async_wait(
-                std::bind(&Feeder::update, this, std::placeholders::_1));
-        }
+void Feeder::resume_motion()
+{
+    if (hot_.phase == MOTION_WAITING && is_enabled())
+    {
+        begin_motion();
     }
     else
     {
-        currentDegrees_ = angle;
-        pca9685_->set_servo_angle(channel_, targetDegrees_,
-                                  config_.servo_min_pulse,
-                                  config_.servo_max_pulse);
-        // start background timer to shut off the servo or continue
-        // movement.
-        timer_.expires_from_now(
-            std::chrono::milliseconds(config_.settle_time_ms));
-        timer_.async_wait(
-            std::bind(&Feeder::update, this, std::placeholders::_1));
+        // nothing is waiting to move (or the feeder was disabled while
+        // waiting), return the permission.
+        if (hot_.phase == MOTION_WAITING)
+        {
+            hot_.phase = MOTION_IDLE;
+        }
+        manager_.release_motion_slot(id_);
     }
 }
+
+void Feeder::begin_motion()
+{
+    hot_.start_degrees = hot_.current_degrees;
+    hot_.phase_time = std::chrono::steady_clock::now();
+    hot_.duration_ms = 0;
+    const uint16_t distance =
+        std::abs(hot_.target_degrees - hot_.start_degrees);
+    if (config_.movement_degrees && config_.movement_interval_ms && distance)
+    {
+        // spread the movement over the same duration as moving by at most
+        // movement_degrees every movement_interval_ms.
+        const uint16_t steps =
+            (distance + config_.movement_degrees - 1) / config_.movement_degrees;
+        hot_.duration_ms = steps * config_.movement_interval_ms;
+    }
+    hot_.phase = MOTION_MOVING;
+    tension_restored_ = false;
+    trace(TRACE_SERVO_MOVE, id_, hot_.target_degrees, hot_.duration_ms);
+    manager_.start_motion();
+}
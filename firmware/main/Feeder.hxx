@@ -7,31 +7,64 @@
 #pragma once
 
 #include <asio.hpp>
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <map>
 #include <memory>
 
 #include "config.hxx"
+#include "FeederConfigStore.hxx"
 #include "PCA9685.hxx"
 #include "MCP23017.hxx"
 #include "GCodeServer.hxx"
 
+class FeederManager;
+
 /// Class for controlling a single Feeder using a @ref PCA9685 for servo
 /// movement and @ref MCP23017 for capturing the status of the tape pulling
 /// mechanism.
-class Feeder : public std::enable_shared_from_this<Feeder>
+///
+/// All methods which modify the feeder must be called from @ref strand, the
+/// @ref is_busy, @ref is_enabled and @ref is_moving methods can be called
+/// from any thread.
+class Feeder
 {
 public:
+    /// Callback invoked when a requested movement has completed, the
+    /// parameter will be true if the movement completed successfully or false
+    /// if the movement failed or was aborted.
+    using completion_callback = std::function<void(bool)>;
+
+    /// Strand type used to serialize access to the feeder.
+    using strand_type = asio::strand<asio::io_context::executor_type>;
+
+    /// Runtime state which is accessed on every motion tick.
+    struct hot_state_t;
+
     /// Constructor.
     ///
     /// @param uuid Unique identifier for this feeder.
     /// @param pca9685 @ref PCA9685 to use for this feeder.
     /// @param channel @ref IO Expander channel assigned to this feeder.
-    /// @param context @ref asio::io_context to use for this feeder.
+    /// @param manager @ref FeederManager which drives the movement of this
+    /// feeder.
+    /// @param strand Strand to serialize access to this feeder, this is
+    /// shared by all feeders using the same @ref PCA9685.
+    /// @param hot @ref hot_state_t for this feeder, this is owned by the
+    /// @ref FeederManager.
     /// @param mcp23017 @ref MCP23017 to use for this feeder.
-    Feeder(std::size_t id, uint32_t uuid, std::shared_ptr<PCA9685> pca9685,
-           uint8_t channel, asio::io_context &context,
-           std::shared_ptr<MCP23017> mcp23017 = nullptr);
+    ///
+    /// NOTE: The @ref PCA9685 and @ref MCP23017 must outlive the feeder.
+    Feeder(std::size_t id, uint32_t uuid, PCA9685 *pca9685, uint8_t channel,
+           FeederManager &manager, strand_type strand, hot_state_t &hot,
+           MCP23017 *mcp23017 = nullptr);
+
+    /// @return Strand which must be used for all access to this feeder.
+    strand_type &strand()
+    {
+        return strand_;
+    }
 
     /// Instructs the feeder to move to a retracted position.
     ///
@@ -42,14 +75,42 @@ public:
     ///
     /// @param distance Distance to move the feeder forward, passing zero will
     /// trigger the default movement distance to be used.
+    /// @param callback Optional callback to invoke once the feeder has
+    /// returned to idle.
     ///
-    /// @return true if command was accepted, false otherwise.
-    bool move(uint8_t distance = 0);
+    /// @return true if command was accepted, false otherwise. When false is
+    /// returned the @param callback will not be invoked.
+    bool move(uint8_t distance = 0, completion_callback callback = nullptr);
 
     /// Instructs the feeder to process any post-pick actions.
     ///
+    /// @param callback Optional callback to invoke once the feeder has
+    /// returned to idle.
+    ///
+    /// @return true if command was accepted, false otherwise. When false is
+    /// returned the @param callback will not be invoked.
+    bool post_pick(completion_callback callback = nullptr);
+
+    /// Queues a movement to pre-feed the next part, the movement will be
+    /// started as soon as the feeder has retracted and is idle.
+    ///
+    /// @param distance Distance to move the feeder forward, passing zero will
+    /// trigger the default movement distance to be used.
+    ///
     /// @return true if command was accepted, false otherwise.
-    bool post_pick();
+    bool prefeed(uint8_t distance = 0);
+
+    /// Claims the pre-feed movement (if any) for a movement request.
+    ///
+    /// @param callback Optional callback to invoke once the pre-feed movement
+    /// has completed, if the part has already been presented this will be
+    /// invoked immediately.
+    ///
+    /// @return true if the pre-feed movement has been claimed, false if
+    /// there is no pre-feed movement and the movement request should be
+    /// processed normally. When false is returned the @param callback will
+    /// not be invoked.
+    bool claim_prefeed(completion_callback callback = nullptr);
 
     /// Converts the state of this feeder to a string which can be sent to a
     /// connected client.
@@ -58,6 +119,26 @@ public:
     /// of this feeder.
     std::string status();
 
+    /// Appends the cached status of this feeder to a buffer, this can be
+    /// called from any thread.
+    ///
+    /// @param buffer Buffer to append the status to.
+    /// @param hex When true the compact hex encoded status record is
+    /// appended, otherwise the same text as @ref status is appended.
+    void append_status(std::string &buffer, bool hex) const;
+
+    /// Number of bytes in the binary status record, see
+    /// @ref read_status_record.
+    static constexpr std::size_t STATUS_RECORD_SIZE = 17;
+
+    /// Copies the cached binary status record of this feeder, this can be
+    /// called from any thread.
+    ///
+    /// @param record Buffer of at least @ref STATUS_RECORD_SIZE bytes to
+    /// receive the record, this is the same record that is hex encoded by
+    /// @ref append_status.
+    void read_status_record(uint8_t *record) const;
+
     /// Enables this feeder for use.
     ///
     /// @return true if command was accepted, false otherwise.
@@ -111,17 +192,37 @@ public:
     /// will always return true.
     bool is_tensioned();
 
+    /// Tracks the latency of the request which started the current
+    /// movement.
+    ///
+    /// @param received Time (from esp_timer_get_time) at which the request
+    /// was received.
+    void track_latency(int64_t received);
+
     /// Callback for the @ref MCP23017 to call when the configured feedback pin
     /// changes state.
     ///
     /// @param state State of the IO pin.
-    void feedback_state_changed(bool state);
+    /// @param when Time at which the state change was reported.
+    void feedback_state_changed(bool state,
+                                std::chrono::steady_clock::time_point when);
 
-    /// Loads configuration for the feeder and starts listening for feedback, if
-    /// enabled.
-    void initialize();
+    /// Applies the persisted configuration for the feeder and starts
+    /// listening for feedback, if enabled.
+    ///
+    /// @param config Persisted configuration for the feeder or nullptr if
+    /// the configuration was not found, in which case the default
+    /// configuration will be used and persisted.
+    ///
+    /// NOTE: The feeder is not moved to the retracted position, this is
+    /// performed by the @ref FeederManager so that the servo movements can be
+    /// staggered.
+    void initialize(const FeederConfigStore::feeder_config_t *config);
 
 private:
+    // Allow @ref FeederManager to drive the movement of this feeder.
+    friend class FeederManager;
+
     /// Log tag to use for this class.
     static constexpr const char *const TAG = "feeder";
 
@@ -129,43 +230,7 @@ private:
     static constexpr uint8_t FEEDER_MECHANICAL_ADVANCE_LENGTH = 4;
 
     /// Persistent Feeder configuration.
-    typedef struct
-    {
-        /// Number of millimeters to move the tape forward to reach the next
-        /// part. Must be a multiple of 2mm.
-        uint8_t feed_length;
-
-        /// Number of milliseconds to allow for the servo movement to complete.
-        uint16_t settle_time_ms;
-
-        /// Angle to move the servo to for fully advanced position.
-        uint8_t servo_full_angle;
-
-        /// Angle to move the servo to for half advanced position.
-        uint8_t servo_half_angle;
-
-        /// Angle to move the servo to for retraction prior to further movement.
-        uint8_t servo_retract_angle;
-
-        /// Minimum number of pulses to send the servo as part of movement.
-        uint16_t servo_min_pulse;
-
-        /// Maximum number of pulses to send the servo as part of movement.
-        uint16_t servo_max_pulse;
-
-        /// When set to non-zero the feedback sensor will be ignored.
-        uint8_t ignore_feedback;
-
-        /// When set to non-zero the servo will move at most this number of
-        /// degrees in a single movement.
-        uint8_t movement_degrees;
-
-        /// Number of milliseconds to delay between servo movements.
-        uint16_t movement_interval_ms;
-
-        /// Reserved space for expansion.
-        uint8_t reserved[124];
-    } feeder_config_t;
+    using feeder_config_t = FeederConfigStore::feeder_config_t;
 
     /// Feeder status definitions.
     typedef enum : uint8_t
@@ -196,8 +261,104 @@ private:
         POSITION_RETRACTED
     } feeder_position_t;
 
-    /// Size of the persistent configuration data.
-    static constexpr std::size_t configsize_ = sizeof(feeder_config_t);
+    /// Feeder fault definitions, reported by feeder events (M621).
+    typedef enum : uint8_t
+    {
+        /// No fault.
+        FAULT_NONE,
+
+        /// Pending movement was aborted because the feeder was disabled.
+        FAULT_ABORTED,
+
+        /// Pre-feed was dropped because the tape cover was not tensioned.
+        FAULT_NOT_TENSIONED,
+
+        /// Movement was stopped because the remaining distance could not be
+        /// completed by the feeder.
+        FAULT_INCOMPLETE
+    } feeder_fault_t;
+
+    /// Servo motion phases, driven by @ref motion_tick.
+    typedef enum : uint8_t
+    {
+        /// Servo is not moving.
+        MOTION_IDLE,
+
+        /// Servo is waiting for the @ref FeederManager to allow it to move.
+        MOTION_WAITING,
+
+        /// Servo is moving towards @ref hot_state_t::target_degrees.
+        MOTION_MOVING,
+
+        /// Servo has reached @ref hot_state_t::target_degrees and is settling.
+        MOTION_SETTLING
+    } motion_phase_t;
+
+    /// Pre-feed states, see @ref prefeed.
+    typedef enum : uint8_t
+    {
+        /// No pre-feed has been requested.
+        PREFEED_NONE,
+
+        /// Pre-feed is waiting for the feeder to retract.
+        PREFEED_PENDING,
+
+        /// Pre-feed is waiting for the feeder to retract and has been claimed
+        /// by a movement request.
+        PREFEED_CLAIMED,
+
+        /// Pre-feed movement is in progress.
+        PREFEED_MOVING,
+
+        /// Pre-feed movement has completed and the part is presented.
+        PREFEED_PRESENTED
+    } prefeed_state_t;
+
+public:
+    /// Runtime state of a feeder which is accessed on every motion tick.
+    ///
+    /// This is kept apart from the rest of the feeder (see
+    /// @ref FeederManager::hot_state_) so that the state of all feeders is
+    /// packed together and the motion tick can skip idle feeders without
+    /// touching their configuration or status cache.
+    struct hot_state_t
+    {
+        /// Time when the current servo movement started while
+        /// @ref phase is MOTION_MOVING, or the time when the servo will have
+        /// settled while @ref phase is MOTION_SETTLING.
+        std::chrono::steady_clock::time_point phase_time;
+
+        /// Duration of the current servo movement in milliseconds.
+        uint32_t duration_ms{0};
+
+        /// Last known status of this feeder, this is only modified on
+        /// @ref strand_ but can be read from any thread.
+        std::atomic<feeder_status_t> status{FEEDER_DISABLED};
+
+        /// Last known position for this feeder, this is only modified on
+        /// @ref strand_ but can be read from any thread.
+        std::atomic<feeder_position_t> position{POSITION_UNKNOWN};
+
+        /// Current servo motion phase.
+        motion_phase_t phase{MOTION_IDLE};
+
+        /// Target to move the servo arm to.
+        uint8_t target_degrees{0};
+
+        /// Last known position of the servo arm.
+        uint8_t current_degrees{0};
+
+        /// Position of the servo arm when the current movement started.
+        uint8_t start_degrees{0};
+
+        /// Remaining movement (if any) for the feeder after it completes the
+        /// current movement action.
+        uint8_t movement{0};
+    };
+
+private:
+    /// Maximum length of the cached status text.
+    static constexpr std::size_t STATUS_TEXT_SIZE = 128;
 
     /// Feeder index number in relation to all other feeders.
     const std::size_t id_;
@@ -205,72 +366,183 @@ private:
     /// Unique ID for this feeder.
     const uint32_t uuid_;
 
-    /// Unique NVS key used for persistent configuration storage.
-    std::string nvskey_;
-
     /// PCA9685 instance to use for this feeder.
-    std::shared_ptr<PCA9685> pca9685_;
+    PCA9685 *const pca9685_;
 
     /// MCP23017 instance to use for this feeder.
-    std::shared_ptr<MCP23017> mcp23017_;
+    MCP23017 *const mcp23017_;
 
     /// IO Expander channel for this feeder.
     const uint8_t channel_;
 
     /// Last known state of the feeder tension feedback line.
-    bool tensioned_{true};
+    std::atomic<bool> tensioned_{true};
+
+    /// Most recent fault for this feeder, this is cleared when the feeder
+    /// next starts moving.
+    std::atomic<feeder_fault_t> fault_{FAULT_NONE};
 
     /// Tracking holder for manual advancement by pressing/releasing the tape
     /// tension arm.
     bool advance_{false};
 
     /// Configuration for this feeder.
-    feeder_config_t config_;
+    feeder_config_t config_{};
+
+    /// Runtime state of this feeder.
+    hot_state_t &hot_;
+
+    /// Sequence counter for the cached status, odd while the cache is being
+    /// updated.
+    std::atomic<uint32_t> status_seq_{0};
+
+    /// Number of characters in @ref status_text_.
+    uint8_t status_length_{0};
+
+    /// Cached status text, see @ref status.
+    char status_text_[STATUS_TEXT_SIZE];
+
+    /// Cached binary status record, this is hex encoded by
+    /// @ref append_status.
+    uint8_t status_record_[STATUS_RECORD_SIZE];
+
+    /// @ref FeederManager which drives the movement of this feeder.
+    FeederManager &manager_;
+
+    /// Strand serializing access to this feeder.
+    strand_type strand_;
+
+    /// Callback to invoke when the current movement completes.
+    completion_callback completion_;
 
-    /// Last known status of this feeder.
-    feeder_status_t status_{FEEDER_DISABLED};
+    /// Time at which the request that started the current movement was
+    /// received, zero when not tracking a request.
+    int64_t request_received_{0};
 
-    /// Last known position for this feeder.
-    feeder_position_t position_{POSITION_UNKNOWN};
-    
-    /// Target to move the servo arm to.
-    uint8_t targetDegrees_{0};
+    /// When true the first servo update for the tracked request has not yet
+    /// been sent.
+    bool request_first_update_{false};
 
-    /// Last known position of the servo arm.
-    uint8_t currentDegrees_{0};
+    /// Current pre-feed state.
+    prefeed_state_t prefeed_{PREFEED_NONE};
 
-    /// Remaining movement (if any) for the feeder after it completes the
-    /// current movement action.
-    std::size_t movement_{0};
+    /// Distance to move the feeder for the pre-feed movement.
+    uint8_t prefeed_distance_{0};
 
-    /// Background timer which invokes @ref update(asio::error_code) based on
-    /// the configured settle time.
-    asio::system_timer timer_;
+    /// Callback to invoke when the claimed pre-feed movement completes.
+    completion_callback prefeed_callback_;
 
-    /// Mutex protecting configuration, status, etc.
-    std::mutex mux_;
+    /// Time at which the servo reached the target angle of the current
+    /// movement.
+    std::chrono::steady_clock::time_point settle_start_;
 
-    /// Callback from @ref timer_ used to handle post-movement actions such as
-    /// continuing movement or turning off the servo.
+    /// Time at which the tension feedback was last restored during the
+    /// current movement, only valid when @ref tension_restored_ is true.
+    std::chrono::steady_clock::time_point tension_restored_at_;
+
+    /// When true the tension feedback has been restored during the current
+    /// movement and has not been lost again since.
+    bool tension_restored_{false};
+
+    /// Learned settle times which have been persisted, used to limit how
+    /// often the learned settle times are written to flash.
+    uint16_t persisted_advance_settle_ms_{0};
+
+    /// See @ref persisted_advance_settle_ms_.
+    uint16_t persisted_retract_settle_ms_{0};
+
+    /// @return true if the settle time should be learned from the tension
+    /// feedback, false if the configured settle time should be used.
+    bool adaptive_settle() const;
+
+    /// @return learned settle time for the current movement direction, zero
+    /// if not learned.
+    uint16_t &learned_settle_ms();
+
+    /// @return number of milliseconds to wait after the servo has reached
+    /// the target angle before the feeder is considered settled.
+    uint16_t settle_time_ms();
+
+    /// Updates the learned settle time for the current movement direction
+    /// once the feeder has settled.
+    ///
+    /// @param now Time at which the feeder has settled.
+    void learn_settle_time(std::chrono::steady_clock::time_point now);
+
+    /// Starts the pending pre-feed movement if the feeder has retracted and
+    /// is idle.
+    void start_prefeed();
+
+    /// Updates the feeder status and the cached status.
+    ///
+    /// @param status New status of the feeder.
+    void set_status(feeder_status_t status);
+
+    /// Updates the feeder position and the cached status.
+    ///
+    /// @param position New position of the feeder.
+    void set_position(feeder_position_t position);
+
+    /// Updates the feeder fault.
     ///
-    /// @param error @ref asio::error_code containing the error status from the
-    /// @ref timer_.
-    void update(asio::error_code error);
+    /// @param fault New fault of the feeder.
+    void set_fault(feeder_fault_t fault);
+
+    /// Rebuilds the cached status, this must be called from @ref strand_
+    /// whenever @ref config_, @ref hot_state_t::status or
+    /// @ref hot_state_t::position change.
+    void refresh_status();
 
-    /// Callback from @ref timer_ used to continue movement of the servo arm to
-    /// the target position.
+    /// Detaches the pending @ref completion_ (if any) so it can be invoked.
     ///
-    /// @param error @ref asio::error_code containing the error status from the
-    /// @ref timer_.
-    void servo_movement_complete(asio::error_code error);
+    /// @return @ref completion_callback that was pending, may be empty.
+    completion_callback take_completion();
+
+    /// Advances the servo motion, called by the @ref FeederManager on
+    /// @ref strand_ once per motion tick. Servo updates are only staged, the
+    /// @ref FeederManager will send all updates for the @ref PCA9685
+    /// together.
+    ///
+    /// @param now Time of the current motion tick.
+    ///
+    /// @return true if the feeder requires further motion ticks, false
+    /// otherwise.
+    bool motion_tick(std::chrono::steady_clock::time_point now);
+
+    /// Handles post-movement actions such as continuing movement or turning
+    /// off the servo once the servo has settled.
+    ///
+    /// @param success Set to true when the movement has completed
+    /// successfully.
+    ///
+    /// @return @ref completion_callback to invoke, may be empty.
+    completion_callback movement_settled(bool &success);
+
+    /// Stops a movement that can not be completed, the feeder is returned to
+    /// idle with @ref FAULT_INCOMPLETE and any pending request (including a
+    /// pre-feed) is completed as failed.
+    void movement_failed();
 
     /// Moves the servo to the retracted position.
-    void retract_locked();
+    void start_retract();
 
     /// Moves the servo as required to complete movement actions.
-    void move_locked();
+    void start_advance();
 
-    /// Moves the servo to a specific angle and starts @ref timer_ to complete
-    /// any pending movement actions.
+    /// Starts moving the servo to a specific angle, the movement will be
+    /// completed by @ref motion_tick.
+    ///
+    /// NOTE: The movement may be delayed until the @ref FeederManager allows
+    /// the servo to move, see @ref FeederManager::acquire_motion_slot. A
+    /// servo that is already moving or waiting to move is retargeted using
+    /// the permission it already has (or is waiting for).
     void set_servo_angle(uint8_t angle);
+
+    /// Starts the servo movement towards @ref hot_state_t::target_degrees
+    /// once permission to move has been granted.
+    void begin_motion();
+
+    /// Called by the @ref FeederManager on @ref strand_ when a feeder that
+    /// was waiting has been allowed to move.
+    void resume_motion();
 };
\ No newline at end of file
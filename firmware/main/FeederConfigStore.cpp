@@ -0,0 +1,202 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <esp_log.h>
+#include <nvs_flash.h>
+
+#include "FeederConfigStore.hxx"
+
+/// NVS key prefix for the current configuration record.
+static constexpr const char *const RECORD_KEY_PREFIX = "fcfg-";
+
+/// NVS key prefix used by older firmware versions.
+static constexpr const char *const LEGACY_KEY_PREFIX = "feeder-";
+
+FeederConfigStore::FeederConfigStore(asio::io_context &context)
+    : timer_(context)
+{
+    ESP_ERROR_CHECK(nvs_open(NVS_FEEDER_NAMESPACE, NVS_READWRITE, &nvs_));
+}
+
+FeederConfigStore::~FeederConfigStore()
+{
+    {
+        const std::lock_guard<std::mutex> lock(mux_);
+        timer_.cancel();
+    }
+    commit();
+    nvs_close(nvs_);
+}
+
+bool FeederConfigStore::load(uint32_t uuid, feeder_config_t &config)
+{
+    char key[KEY_SIZE];
+    feeder_record_t record;
+    size_t record_size = sizeof(feeder_record_t);
+    make_key(key, RECORD_KEY_PREFIX, uuid);
+    esp_err_t res = nvs_get_blob(nvs_, key, &record, &record_size);
+    if (res == ESP_OK && record_size == RECORD_V1_SIZE && record.version == 1)
+    {
+        // version 1 records are identical apart from the learned settle
+        // times, these will be learned again.
+        record.learned_advance_settle_ms = 0;
+        record.learned_retract_settle_ms = 0;
+        record_size = sizeof(feeder_record_t);
+        record.version = RECORD_VERSION;
+    }
+    if (res == ESP_OK && record_size == sizeof(feeder_record_t) &&
+        record.version == RECORD_VERSION)
+    {
+        config.feed_length = record.feed_length;
+        config.settle_time_ms = record.settle_time_ms;
+        config.servo_full_angle = record.servo_full_angle;
+        config.servo_half_angle = record.servo_half_angle;
+        config.servo_retract_angle = record.servo_retract_angle;
+        config.servo_min_pulse = record.servo_min_pulse;
+        config.servo_max_pulse = record.servo_max_pulse;
+        config.ignore_feedback = record.ignore_feedback;
+        config.movement_degrees = record.movement_degrees;
+        config.movement_interval_ms = record.movement_interval_ms;
+        config.learned_advance_settle_ms = record.learned_advance_settle_ms;
+        config.learned_retract_settle_ms = record.learned_retract_settle_ms;
+        return true;
+    }
+
+    // check for a configuration persisted by an older firmware version.
+    char legacy_key[KEY_SIZE];
+    legacy_feeder_config_t legacy;
+    size_t legacy_size = sizeof(legacy_feeder_config_t);
+    make_key(legacy_key, LEGACY_KEY_PREFIX, uuid);
+    res = nvs_get_blob(nvs_, legacy_key, &legacy, &legacy_size);
+    if (res != ESP_OK || legacy_size != sizeof(legacy_feeder_config_t))
+    {
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Migrating configuration %s to %s", legacy_key, key);
+    config.feed_length = legacy.feed_length;
+    config.settle_time_ms = legacy.settle_time_ms;
+    config.servo_full_angle = legacy.servo_full_angle;
+    config.servo_half_angle = legacy.servo_half_angle;
+    config.servo_retract_angle = legacy.servo_retract_angle;
+    config.servo_min_pulse = legacy.servo_min_pulse;
+    config.servo_max_pulse = legacy.servo_max_pulse;
+    config.ignore_feedback = legacy.ignore_feedback;
+    config.movement_degrees = legacy.movement_degrees;
+    config.movement_interval_ms = legacy.movement_interval_ms;
+    config.learned_advance_settle_ms = 0;
+    config.learned_retract_settle_ms = 0;
+
+    // the legacy record is removed only once the migrated record has been
+    // persisted.
+    if (write_record(uuid, config) == ESP_OK)
+    {
+        nvs_erase_key(nvs_, legacy_key);
+        ESP_ERROR_CHECK(nvs_commit(nvs_));
+    }
+    return true;
+}
+
+void FeederConfigStore::store(uint32_t uuid, const feeder_config_t &config)
+{
+    const std::lock_guard<std::mutex> lock(mux_);
+    dirty_[uuid] = config;
+
+    // restart the timer so that the commit happens only once updates have
+    // stopped arriving.
+    timer_.expires_from_now(
+        std::chrono::milliseconds(FEEDER_CONFIG_COMMIT_DELAY_MS));
+    timer_.async_wait(std::bind(&FeederConfigStore::commit_timer_expired,
+                                this, std::placeholders::_1));
+}
+
+esp_err_t FeederConfigStore::commit()
+{
+    std::map<uint32_t, feeder_config_t> pending;
+    {
+        const std::lock_guard<std::mutex> lock(mux_);
+        pending.swap(dirty_);
+    }
+
+    esp_err_t result = ESP_OK;
+    for (auto &[uuid, config] : pending)
+    {
+        esp_err_t res = write_record(uuid, config);
+        if (res != ESP_OK)
+        {
+            if (result == ESP_OK)
+            {
+                result = res;
+            }
+            // retry on the next commit unless a newer configuration has been
+            // queued in the meantime.
+            const std::lock_guard<std::mutex> lock(mux_);
+            dirty_.emplace(uuid, config);
+        }
+    }
+
+    if (!pending.empty())
+    {
+        esp_err_t res = nvs_commit(nvs_);
+        if (res != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to commit configuration: %s",
+                     esp_err_to_name(res));
+            if (result == ESP_OK)
+            {
+                result = res;
+            }
+        }
+        ESP_LOGI(TAG, "Persisted %zu feeder configuration(s)", pending.size());
+    }
+    return result;
+}
+
+esp_err_t FeederConfigStore::write_record(uint32_t uuid,
+                                          const feeder_config_t &config)
+{
+    char key[KEY_SIZE];
+    feeder_record_t record;
+    make_key(key, RECORD_KEY_PREFIX, uuid);
+    record.version = RECORD_VERSION;
+    record.feed_length = config.feed_length;
+    record.settle_time_ms = config.settle_time_ms;
+    record.servo_full_angle = config.servo_full_angle;
+    record.servo_half_angle = config.servo_half_angle;
+    record.servo_retract_angle = config.servo_retract_angle;
+    record.servo_min_pulse = config.servo_min_pulse;
+    record.servo_max_pulse = config.servo_max_pulse;
+    record.ignore_feedback = config.ignore_feedback;
+    record.movement_degrees = config.movement_degrees;
+    record.movement_interval_ms = config.movement_interval_ms;
+    record.learned_advance_settle_ms = config.learned_advance_settle_ms;
+    record.learned_retract_settle_ms = config.learned_retract_settle_ms;
+    esp_err_t res = nvs_set_blob(nvs_, key, &record, sizeof(record));
+    if (res != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to persist %s: %s", key, esp_err_to_name(res));
+    }
+    return res;
+}
+
+void FeederConfigStore::make_key(char (&key)[KEY_SIZE], const char *prefix,
+                                 uint32_t uuid)
+{
+    snprintf(key, KEY_SIZE, "%s%08" PRIX32, prefix, uuid);
+}
+
+void FeederConfigStore::commit_timer_expired(asio::error_code error)
+{
+    // the timer is restarted for every update, only commit once it has
+    // expired without being restarted.
+    if (error)
+    {
+        return;
+    }
+    commit();
+}
@@ -0,0 +1,215 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#pragma once
+
+#include <asio.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <esp_err.h>
+#include <map>
+#include <mutex>
+#include <nvs.h>
+
+#include "config.hxx"
+
+/// Write-behind persistent storage for feeder configuration.
+///
+/// Updated configurations are held in RAM and written to NVS in a single
+/// batch once no further updates have been received for
+/// @ref FEEDER_CONFIG_COMMIT_DELAY_MS or when @ref commit is called.
+class FeederConfigStore
+{
+public:
+    /// Feeder configuration.
+    typedef struct
+    {
+        /// Number of millimeters to move the tape forward to reach the next
+        /// part. Must be a multiple of 2mm.
+        uint8_t feed_length;
+
+        /// Number of milliseconds to allow for the servo movement to complete.
+        uint16_t settle_time_ms;
+
+        /// Angle to move the servo to for fully advanced position.
+        uint8_t servo_full_angle;
+
+        /// Angle to move the servo to for half advanced position.
+        uint8_t servo_half_angle;
+
+        /// Angle to move the servo to for retraction prior to further movement.
+        uint8_t servo_retract_angle;
+
+        /// Minimum number of pulses to send the servo as part of movement.
+        uint16_t servo_min_pulse;
+
+        /// Maximum number of pulses to send the servo as part of movement.
+        uint16_t servo_max_pulse;
+
+        /// When set to non-zero the feedback sensor will be ignored.
+        uint8_t ignore_feedback;
+
+        /// When set to non-zero the servo will move at most this number of
+        /// degrees in a single movement.
+        uint8_t movement_degrees;
+
+        /// Number of milliseconds to delay between servo movements.
+        uint16_t movement_interval_ms;
+
+        /// Learned settle time in milliseconds after advancing, zero when
+        /// not yet learned.
+        uint16_t learned_advance_settle_ms;
+
+        /// Learned settle time in milliseconds after retracting, zero when
+        /// not yet learned.
+        uint16_t learned_retract_settle_ms;
+    } feeder_config_t;
+
+    /// Constructor.
+    ///
+    /// @param context @ref asio::io_context to perform deferred commits on.
+    FeederConfigStore(asio::io_context &context);
+
+    /// Destructor, commits any pending updates.
+    ~FeederConfigStore();
+
+    /// Loads the configuration for a feeder, configurations persisted by
+    /// older firmware versions are migrated to the current format.
+    ///
+    /// @param uuid Unique identifier of the feeder.
+    /// @param config Receives the configuration of the feeder.
+    ///
+    /// @return true if the configuration was loaded, false if it was not
+    /// found or is corrupt.
+    bool load(uint32_t uuid, feeder_config_t &config);
+
+    /// Queues the configuration of a feeder to be persisted.
+    ///
+    /// @param uuid Unique identifier of the feeder.
+    /// @param config Configuration of the feeder.
+    void store(uint32_t uuid, const feeder_config_t &config);
+
+    /// @return NVS handle used by the store, this can be used for other
+    /// configuration data in @ref NVS_FEEDER_NAMESPACE.
+    nvs_handle_t handle() const
+    {
+        return nvs_;
+    }
+
+    /// Persists all queued configurations.
+    ///
+    /// @return ESP_OK if all configurations were persisted, otherwise the
+    /// first error encountered. Configurations which failed to persist will
+    /// be retried on the next commit.
+    esp_err_t commit();
+
+private:
+    /// Log tag to use for this class.
+    static constexpr const char *const TAG = "feeder_cfg";
+
+    /// Version of @ref feeder_record_t.
+    static constexpr uint8_t RECORD_VERSION = 2;
+
+    /// Persisted feeder configuration.
+    typedef struct __attribute__((packed))
+    {
+        /// Version of the record, always @ref RECORD_VERSION.
+        uint8_t version;
+
+        /// See @ref feeder_config_t.
+        uint8_t feed_length;
+
+        /// See @ref feeder_config_t.
+        uint16_t settle_time_ms;
+
+        /// See @ref feeder_config_t.
+        uint8_t servo_full_angle;
+
+        /// See @ref feeder_config_t.
+        uint8_t servo_half_angle;
+
+        /// See @ref feeder_config_t.
+        uint8_t servo_retract_angle;
+
+        /// See @ref feeder_config_t.
+        uint16_t servo_min_pulse;
+
+        /// See @ref feeder_config_t.
+        uint16_t servo_max_pulse;
+
+        /// See @ref feeder_config_t.
+        uint8_t ignore_feedback;
+
+        /// See @ref feeder_config_t.
+        uint8_t movement_degrees;
+
+        /// See @ref feeder_config_t.
+        uint16_t movement_interval_ms;
+
+        /// See @ref feeder_config_t, added in version 2.
+        uint16_t learned_advance_settle_ms;
+
+        /// See @ref feeder_config_t, added in version 2.
+        uint16_t learned_retract_settle_ms;
+    } feeder_record_t;
+
+    /// Size of version 1 of @ref feeder_record_t, which did not include the
+    /// learned settle times.
+    static constexpr std::size_t RECORD_V1_SIZE =
+        offsetof(feeder_record_t, learned_advance_settle_ms);
+
+    /// Configuration persisted by older firmware versions.
+    typedef struct
+    {
+        uint8_t feed_length;
+        uint16_t settle_time_ms;
+        uint8_t servo_full_angle;
+        uint8_t servo_half_angle;
+        uint8_t servo_retract_angle;
+        uint16_t servo_min_pulse;
+        uint16_t servo_max_pulse;
+        uint8_t ignore_feedback;
+        uint8_t movement_degrees;
+        uint16_t movement_interval_ms;
+        uint8_t reserved[124];
+    } legacy_feeder_config_t;
+
+    /// Maximum length of an NVS key, including the null terminator.
+    static constexpr std::size_t KEY_SIZE = 16;
+
+    /// Handle used for all NVS access.
+    nvs_handle_t nvs_;
+
+    /// Timer used to commit queued configurations.
+    asio::system_timer timer_;
+
+    /// Queued configurations, keyed by the feeder uuid.
+    std::map<uint32_t, feeder_config_t> dirty_;
+
+    /// Protects @ref dirty_ and @ref timer_.
+    std::mutex mux_;
+
+    /// Builds the NVS key for a feeder.
+    ///
+    /// @param key Buffer to receive the key.
+    /// @param prefix Prefix for the key.
+    /// @param uuid Unique identifier of the feeder.
+    static void make_key(char (&key)[KEY_SIZE], const char *prefix,
+                         uint32_t uuid);
+
+    /// Writes the record for a feeder, this does not commit the record.
+    ///
+    /// @param uuid Unique identifier of the feeder.
+    /// @param config Configuration of the feeder.
+    ///
+    /// @return ESP_OK if the record was written, otherwise the NVS error.
+    esp_err_t write_record(uint32_t uuid, const feeder_config_t &config);
+
+    /// Commits the queued configurations once the timer expires.
+    ///
+    /// @param error @ref asio::error_code provided by the @ref timer_.
+    void commit_timer_expired(asio::error_code error);
+};
@@ -4,49 +4,86 @@
  * SPDX-License-Identifier: CC-BY-NC-SA-4.0
  */
 
+#include <algorithm>
 #include <asio.hpp>
+#include <driver/gpio.h>
+#include <esp_heap_caps.h>
 #include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <cinttypes>
 #include <cstdint>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include <limits>
 #include <nvs.h>
 #include <nvs_flash.h>
 #include <string>
+#include <string_view>
 
 #include "config.hxx"
 #include "FeederManager.hxx"
 #include "GCodeServer.hxx"
 #include "I2Cbus.hxx"
+#include "Trace.hxx"
 #include "Utils.hxx"
 
-using std::string;
-using std::transform;
+StaticPool<Feeder, FEEDER_POOL_SIZE> FeederManager::feeders_;
+
+std::array<Feeder::hot_state_t, FEEDER_POOL_SIZE> FeederManager::hot_state_;
 
 FeederManager::FeederManager(GCodeServer &server, asio::io_context &context)
-    : i2c_(getI2C(I2C_NUM_0))
+    : context_(context), server_(server), config_store_(context),
+      motion_timer_(context), event_timer_(context), homing_timer_(context),
+      scan_timer_(context), bus_health_timer_(context)
 {
+    const int64_t start_time = esp_timer_get_time();
     size_t config_size = sizeof(feeder_manager_config_t);
     feeder_manager_config_t config;
-    nvs_handle_t nvs;
-
-    server.register_command(FEEDER_MOVE_CMD,
-                            std::bind(&FeederManager::feeder_move, this,
-                                      std::placeholders::_1));
-    server.register_command(FEEDER_POST_PICK_CMD,
-                            std::bind(&FeederManager::feeder_post_pick, this,
-                                      std::placeholders::_1));
-    server.register_command(FEEDER_STATUS_CMD,
-                            std::bind(&FeederManager::feeder_status, this,
-                                      std::placeholders::_1));
-    server.register_command(FEEDER_ENABLE_CMD,
-                            std::bind(&FeederManager::feeder_enable, this,
-                                      std::placeholders::_1));
-    server.register_command(FEEDER_DISABLE_CMD,
-                            std::bind(&FeederManager::feeder_disable, this,
-                                      std::placeholders::_1));
-    server.register_command(FEEDER_CONFIGURE_CMD,
-                            std::bind(&FeederManager::feeder_configure, this,
-                                      std::placeholders::_1));
-
-    ESP_ERROR_CHECK(nvs_open(NVS_FEEDER_NAMESPACE, NVS_READWRITE, &nvs));
+    nvs_handle_t nvs = config_store_.handle();
+
+    server.register_async_command(FEEDER_MOVE_CMD,
+                                  std::bind(&FeederManager::feeder_move, this,
+                                            std::placeholders::_1,
+                                            std::placeholders::_2));
+    server.register_async_command(FEEDER_POST_PICK_CMD,
+                                  std::bind(&FeederManager::feeder_post_pick,
+                                            this, std::placeholders::_1,
+                                            std::placeholders::_2));
+    server.register_async_command(FEEDER_STATUS_CMD,
+                                  std::bind(&FeederManager::feeder_status, this,
+                                            std::placeholders::_1,
+                                            std::placeholders::_2));
+    server.register_async_command(FEEDER_ENABLE_CMD,
+                                  std::bind(&FeederManager::feeder_enable, this,
+                                            std::placeholders::_1,
+                                            std::placeholders::_2));
+    server.register_async_command(FEEDER_DISABLE_CMD,
+                                  std::bind(&FeederManager::feeder_disable, this,
+                                            std::placeholders::_1,
+                                            std::placeholders::_2));
+    server.register_async_command(FEEDER_CONFIGURE_CMD,
+                                  std::bind(&FeederManager::feeder_configure, this,
+                                            std::placeholders::_1,
+                                            std::placeholders::_2));
+    server.register_command(FEEDER_BULK_STATUS_CMD,
+                            [this](GCodeServer::command_view args)
+                            {
+                                return feeder_bulk_status(args);
+                            });
+    server.register_command(BUS_METRICS_CMD,
+                            [this](GCodeServer::command_view args)
+                            {
+                                return bus_metrics(args);
+                            });
+    server.register_async_command(FEEDER_SAVE_CMD,
+                                  std::bind(&FeederManager::feeder_save, this,
+                                            std::placeholders::_1,
+                                            std::placeholders::_2));
+    server.register_async_command(FEEDER_PREFEED_CMD,
+                                  std::bind(&FeederManager::feeder_prefeed, this,
+                                            std::placeholders::_1,
+                                            std::placeholders::_2));
 
     esp_err_t res = nvs_get_blob(nvs, NVS_FEEDER_MGR_CFG_KEY, &config,
                                  &config_size);
@@ -63,283 +100,1321 @@ FeederManager::FeederManager(GCodeServer &server, asio::io_context &context)
                          sizeof(feeder_manager_config_t)));
         ESP_ERROR_CHECK(nvs_commit(nvs));
     }
-    nvs_close(nvs);
 
-    ESP_LOGI(TAG, "Initializing I2C Bus");
-    i2c_.begin(I2C_SDA_PIN_NUM, I2C_SCL_PIN_NUM, I2C_BUS_SPEED);
+    buses_.push_back({&getI2C(I2C_NUM_0), nullptr});
+    if constexpr (I2C2_SCL_PIN_NUM != GPIO_NUM_NC &&
+                  I2C2_SDA_PIN_NUM != GPIO_NUM_NC)
+    {
+        buses_.push_back({&getI2C(I2C_NUM_1), nullptr});
+    }
+
+    // MCP23017 (or nullptr) providing feedback for each PCA9685.
+    std::vector<std::shared_ptr<MCP23017>> group_mcp23017;
+    for (auto &bus : buses_)
+    {
+        probe_bus(bus, group_mcp23017);
+    }
+    ESP_LOGI(TAG, "Detected PCA9685 devices:%zu", pca9685_.size());
+    moving_per_group_.assign(pca9685_.size(), 0);
+
+    if constexpr (MCP23017_INT_PIN != GPIO_NUM_NC)
+    {
+        if (!mcp23017_.empty())
+        {
+            ESP_LOGI(TAG, "Configuring MCP23017 interrupt pin %d",
+                     MCP23017_INT_PIN);
+            gpio_config_t int_pin_cfg = {};
+            int_pin_cfg.pin_bit_mask = 1ULL << MCP23017_INT_PIN;
+            int_pin_cfg.mode = GPIO_MODE_INPUT;
+            int_pin_cfg.pull_up_en = GPIO_PULLUP_ENABLE;
+            int_pin_cfg.pull_down_en = GPIO_PULLDOWN_DISABLE;
+            int_pin_cfg.intr_type = GPIO_INTR_NEGEDGE;
+            ESP_ERROR_CHECK(gpio_config(&int_pin_cfg));
+            // the ISR service may have already been installed by another
+            // component.
+            esp_err_t isr_res = gpio_install_isr_service(0);
+            if (isr_res != ESP_OK && isr_res != ESP_ERR_INVALID_STATE)
+            {
+                ESP_ERROR_CHECK(isr_res);
+            }
+            ESP_ERROR_CHECK(
+                gpio_isr_handler_add(MCP23017_INT_PIN,
+                                     &FeederManager::mcp23017_isr, this));
+        }
+    }
+
+    // calculate how many feeders we should configured based on the the number
+    // of PCA9685 chips that were detected and configured.
+    std::size_t available_feeder_count =
+        std::min(feeders_.capacity(), pca9685_.size() * PCA9685::NUM_CHANNELS);
+    ESP_LOGI(TAG, "Attempting to create %zu feeders", available_feeder_count);
+    ESP_LOGI(TAG, "Detected %zu PCA9685 and %zu MCP23017", pca9685_.size(),
+             mcp23017_.size());
+    const std::size_t heap_before =
+        heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    for (size_t idx = 0; idx < available_feeder_count; idx++)
+    {
+        auto expander_index = idx / PCA9685::NUM_CHANNELS;
+        auto expander_channel = idx % PCA9685::NUM_CHANNELS;
+        uint32_t uuid = config.feeder_uuid[idx];
+        if (group_mcp23017[expander_index].get() != nullptr)
+        {
+            ESP_LOGI(TAG,
+                     "Creating feeder %s (%zu/%zu/%zu/PCA:%p/MCP:%p)",
+                     to_hex(uuid).c_str(), idx, expander_index,
+                     expander_channel, pca9685_[expander_index].get(),
+                     group_mcp23017[expander_index].get());
+        }
+        else
+        {
+            ESP_LOGI(TAG,
+                     "Creating feeder %s (%zu/%zu/%zu/PCA:%p)",
+                     to_hex(uuid).c_str(), idx, expander_index,
+                     expander_channel, pca9685_[expander_index].get());
+        }
+        Feeder *feeder =
+            feeders_.emplace(idx, uuid, pca9685_[expander_index].get(),
+                             expander_channel, *this,
+                             group_strands_[expander_index], hot_state_[idx],
+                             group_mcp23017[expander_index].get());
+
+        // the configuration is loaded here rather than on the feeder strand
+        // so that all configurations are read in a single pass over NVS.
+        FeederConfigStore::feeder_config_t feeder_config;
+        const bool loaded = config_store_.load(uuid, feeder_config);
+        asio::post(feeder->strand(), [feeder, feeder_config, loaded]()
+        {
+            feeder->initialize(loaded ? &feeder_config : nullptr);
+        });
+    }
+    ESP_LOGI(TAG, "Configured Feeders:%zu", feeders_.size());
+
+    // the feeders are constructed in static storage, any heap usage during
+    // creation comes from the feeders themselves (status text, callbacks).
+    const std::size_t heap_after =
+        heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    ESP_LOGI(TAG,
+             "Feeder pool: %zu/%zu used, %zu bytes per feeder + %zu bytes "
+             "runtime state, %zu bytes static, %zu bytes heap",
+             feeders_.size(), feeders_.capacity(), sizeof(Feeder),
+             sizeof(Feeder::hot_state_t),
+             sizeof(feeders_) + sizeof(hot_state_),
+             heap_before > heap_after ? heap_before - heap_after : 0);
+
+    // move the feeders to the retracted position a few at a time.
+    home_feeders({});
+
+    // start the background scanning of the MCP23017 devices.
+    const auto now = std::chrono::steady_clock::now();
+    scan_due_.assign(mcp23017_.size(), now);
+    scan_active_until_.assign(mcp23017_.size(), now);
+    scan_inputs({});
+
+    // watch for a rising I2C error rate, the clock speed selected by the
+    // calibration may no longer be reliable (ie: as the cables warm up).
+    if constexpr (I2C_CLOCK_CALIBRATION)
+    {
+        bus_health_timer_.expires_from_now(
+            std::chrono::milliseconds(I2C_HEALTH_CHECK_INTERVAL_MS));
+        bus_health_timer_.async_wait(
+            std::bind(&FeederManager::check_bus_health, this,
+                      std::placeholders::_1));
+    }
+
+    ESP_LOGI(TAG, "Feeder initialization took %lldms",
+             static_cast<long long>((esp_timer_get_time() - start_time) / 1000));
+}
+
+FeederManager::~FeederManager()
+{
+    // the feeders hold strands of the io_context which must be destroyed
+    // before the io_context itself, the static storage would otherwise only
+    // be released at exit.
+    feeders_.clear();
+}
+
+void FeederManager::probe_bus(
+    i2c_bus_t &bus, std::vector<std::shared_ptr<MCP23017>> &group_mcp23017)
+{
+    I2C_t &i2c = *bus.i2c;
+    const int port = i2c.getPort();
+    const std::size_t first_group = pca9685_.size();
+    std::vector<std::shared_ptr<MCP23017>> mcp23017;
+
+    ESP_LOGI(TAG, "Initializing I2C Bus %d", port);
+    if (port == I2C_NUM_0)
+    {
+        i2c.begin(I2C_SDA_PIN_NUM, I2C_SCL_PIN_NUM, I2C_BUS_SPEED);
+    }
+    else
+    {
+        i2c.begin(I2C2_SDA_PIN_NUM, I2C2_SCL_PIN_NUM, I2C2_BUS_SPEED);
+    }
+    // each bus has it's own queue (and bus thread) so that transactions on
+    // the buses are executed in parallel.
+    bus.queue = std::make_unique<I2CQueue>(i2c, context_);
 
     for (uint8_t addr = PCA9685_BASE_ADDRESS;
          addr < (PCA9685_BASE_ADDRESS + MAX_PCA9685_COUNT);
          addr++)
     {
-        if (i2c_.testConnection(addr) == ESP_OK)
+        if (i2c.testConnection(addr, I2C_PROBE_TIMEOUT_MS) == ESP_OK)
         {
-            auto pca9685 = std::make_shared<PCA9685>(i2c_);
+            auto pca9685 = std::make_shared<PCA9685>(i2c, *bus.queue);
             if (pca9685->configure(addr, PCA9685_FREQUENCY) != ESP_OK)
             {
-                ESP_LOGW(TAG, "PCA9685(%02x) configuration failed!",
-                         pca9685->get_address());
+                ESP_LOGW(TAG, "[bus:%d] PCA9685(%02x) configuration failed!",
+                         port, pca9685->get_address());
             }
             else
             {
-                ESP_LOGI(TAG, "PCA9685(%02x/%p) configured for use.",
-                         pca9685->get_address(),
-                         pca9685.get());
+                ESP_LOGI(TAG, "[bus:%d] PCA9685(%02x/%p) configured for use.",
+                         port, pca9685->get_address(), pca9685.get());
                 pca9685_.push_back(std::move(pca9685));
+                // all feeders using this PCA9685 share a single strand.
+                group_strands_.emplace_back(asio::make_strand(context_));
             }
         }
         else
         {
-            ESP_LOGW(TAG, "PCA9685(%02x) was not detected.", addr);
+            ESP_LOGW(TAG, "[bus:%d] PCA9685(%02x) was not detected.", port,
+                     addr);
         }
     }
-    ESP_LOGI(TAG, "Detected PCA9685 devices:%zu", pca9685_.size());
 
     for (uint8_t addr = MCP23017_BASE_ADDRESS;
          addr < (MCP23017_BASE_ADDRESS + MAX_MCP23017_COUNT);
          addr++)
     {
-        if (i2c_.testConnection(addr) == ESP_OK)
+        if (i2c.testConnection(addr, I2C_PROBE_TIMEOUT_MS) == ESP_OK)
         {
-            auto mcp23017 = std::make_shared<MCP23017>(i2c_, context);
-            if (mcp23017->configure(addr) != ESP_OK)
+            auto device = std::make_shared<MCP23017>(i2c, *bus.queue);
+            if (device->configure(addr, MCP23017_INT_PIN != GPIO_NUM_NC) !=
+                ESP_OK)
             {
-                ESP_LOGW(TAG, "MCP23017(%02x) configuration failed!",
-                         mcp23017->get_address());
+                ESP_LOGW(TAG, "[bus:%d] MCP23017(%02x) configuration failed!",
+                         port, device->get_address());
             }
             else
             {
-                ESP_LOGI(TAG, "MCP23017(%02x/%p) configured for use.",
-                         mcp23017->get_address(),
-                         mcp23017.get());
-                mcp23017_.push_back(std::move(mcp23017));
+                ESP_LOGI(TAG, "[bus:%d] MCP23017(%02x/%p) configured for use.",
+                         port, device->get_address(), device.get());
+                mcp23017.push_back(std::move(device));
             }
         }
         else
         {
-            ESP_LOGW(TAG, "MCP23017(%02x) was not detected!", addr);
+            ESP_LOGW(TAG, "[bus:%d] MCP23017(%02x) was not detected!", port,
+                     addr);
         }
     }
 
-    // calculate how many feeders we should configured based on the the number
-    // of PCA9685 chips that were detected and configured.
-    std::size_t available_feeder_count =
-        std::min(MAX_FEEDER_COUNT, pca9685_.size() * PCA9685::NUM_CHANNELS);
-    ESP_LOGI(TAG, "Attempting to create %zu feeders", available_feeder_count);
-    ESP_LOGI(TAG, "Detected %zu PCA9685 and %zu MCP23017", pca9685_.size(),
-             mcp23017_.size());
-    for (size_t idx = 0; idx < available_feeder_count; idx++)
+    calibrate_bus(bus, first_group, mcp23017);
+
+    // MCP23017 devices are paired with the PCA9685 devices on the same bus
+    // in address order.
+    for (std::size_t idx = 0; idx < mcp23017.size() ||
+         first_group + idx < pca9685_.size(); idx++)
     {
-        auto expander_index = idx / PCA9685::NUM_CHANNELS;
-        auto expander_channel = idx % PCA9685::NUM_CHANNELS;
-        uint32_t uuid = config.feeder_uuid[idx];
-        std::shared_ptr<Feeder> feeder = nullptr;
-        if (mcp23017_.size() > expander_index &&
-            mcp23017_[expander_index].get() != nullptr)
+        if (first_group + idx >= pca9685_.size())
         {
-            ESP_LOGI(TAG,
-                     "Creating feeder %s (%zu/%zu/%zu/PCA:%p/MCP:%p)",
-                     to_hex(uuid).c_str(), idx, expander_index,
-                     expander_channel, pca9685_[expander_index].get(),
-                     mcp23017_[expander_index].get());
-            feeder =
-                std::make_shared<Feeder>(idx, uuid,
-                                         pca9685_[expander_index],
-                                         expander_channel, context,
-                                         mcp23017_[expander_index]);
+            ESP_LOGW(TAG, "[bus:%d] MCP23017(%02x) has no PCA9685, ignoring.",
+                     port, mcp23017[idx]->get_address());
+        }
+        else if (idx < mcp23017.size())
+        {
+            group_mcp23017.push_back(mcp23017[idx]);
+            mcp23017_.push_back(mcp23017[idx]);
+            mcp23017_group_.push_back(first_group + idx);
         }
         else
         {
-            ESP_LOGI(TAG,
-                     "Creating feeder %s (%zu/%zu/%zu/PCA:%p)",
-                     to_hex(uuid).c_str(), idx, expander_index,
-                     expander_channel, pca9685_[expander_index].get());
-            feeder =
-                std::make_shared<Feeder>(idx, uuid,
-                                         pca9685_[expander_index],
-                                         expander_channel, context);
+            group_mcp23017.push_back(nullptr);
+        }
+    }
+}
+
+void FeederManager::calibrate_bus(
+    i2c_bus_t &bus, std::size_t first_group,
+    const std::vector<std::shared_ptr<MCP23017>> &mcp23017)
+{
+    I2C_t &i2c = *bus.i2c;
+    const int port = i2c.getPort();
+    bus.clocks.assign(1, i2c.getClock());
+    for (uint32_t clock : I2C_CLOCK_STEPS)
+    {
+        if (clock > bus.clocks.back())
+        {
+            bus.clocks.push_back(clock);
+        }
+    }
+    bus.clock_index = 0;
+    if (!I2C_CLOCK_CALIBRATION ||
+        (first_group == pca9685_.size() && mcp23017.empty()))
+    {
+        bus.clocks.resize(1);
+        return;
+    }
+
+    // verifies every device on the bus once, returning the number of
+    // devices that failed.
+    auto verify_devices = [&](uint8_t seed)
+    {
+        std::size_t failures = 0;
+        for (std::size_t idx = first_group; idx < pca9685_.size(); idx++)
+        {
+            if (pca9685_[idx]->verify(seed) != ESP_OK)
+            {
+                failures++;
+            }
+        }
+        for (auto &device : mcp23017)
+        {
+            if (device->verify(seed) != ESP_OK)
+            {
+                failures++;
+            }
         }
+        return failures;
+    };
 
-        feeder->initialize();
+    bool failed = false;
+    for (std::size_t index = 1; index < bus.clocks.size() && !failed;
+         index++)
+    {
+        if (i2c.setClock(bus.clocks[index]) != ESP_OK)
+        {
+            break;
+        }
+        std::size_t failures = 0;
+        for (std::size_t round = 0; round < I2C_CALIBRATION_ROUNDS; round++)
+        {
+            failures += verify_devices(round + 1);
+        }
+        if (failures)
+        {
+            ESP_LOGW(TAG, "[bus:%d] %zu verifications failed at %" PRIu32 "Hz",
+                     port, failures, bus.clocks[index]);
+            failed = true;
+        }
+        else
+        {
+            bus.clock_index = index;
+        }
+    }
+
+    // passing the verification does not prove the fastest speed is reliable
+    // under load, step down once more for some headroom.
+    if (bus.clock_index)
+    {
+        bus.clock_index--;
+    }
+    i2c.setClock(bus.clocks[bus.clock_index]);
 
-        if (AUTO_ENABLE_FEEDERS)
+    // a failed verification may have corrupted other registers, restore the
+    // device configuration at the selected speed.
+    if (failed)
+    {
+        for (std::size_t idx = first_group; idx < pca9685_.size(); idx++)
+        {
+            pca9685_[idx]->configure(pca9685_[idx]->get_address(),
+                                     PCA9685_FREQUENCY);
+        }
+        for (auto &device : mcp23017)
         {
-            ESP_LOGI(TAG, "Enabling feeder %s (%zu)",
-                     to_hex(uuid).c_str(), idx + 1);
-            feeder->enable();
+            device->configure(device->get_address(),
+                              MCP23017_INT_PIN != GPIO_NUM_NC);
         }
-        feeders_.push_back(std::move(feeder));
     }
-    ESP_LOGI(TAG, "Configured Feeders:%zu", feeders_.size());
+    if (const std::size_t failures = verify_devices(0); failures)
+    {
+        ESP_LOGE(TAG, "[bus:%d] %zu devices failed verification at %" PRIu32
+                 "Hz", port, failures, bus.clocks[bus.clock_index]);
+    }
+    bus.checked_transfers = i2c.getMetrics().transfers();
+    bus.checked_failures = i2c.getMetrics().failures();
+    ESP_LOGI(TAG, "[bus:%d] I2C clock calibrated to %" PRIu32 "Hz", port,
+             bus.clocks[bus.clock_index]);
 }
 
-template <typename T>
-bool FeederManager::extract_arg(string arg_letter,
-                                GCodeServer::command_args args,
-                                T &value)
+void FeederManager::check_bus_health(asio::error_code error)
 {
-    auto ent = std::find_if(args.begin(), args.end(),
-                            [arg_letter](auto &arg)
-                            {
-                                string arg_upper = arg;
-                                transform(arg_upper.begin(), arg_upper.end(),
-                                          arg_upper.begin(), ::toupper);
-                                return arg.rfind(arg_letter, 0) != string::npos;
-                            });
-    if (ent != args.end())
+    if (error)
+    {
+        return;
+    }
+    for (auto &bus : buses_)
+    {
+        const I2CMetrics &metrics = bus.i2c->getMetrics();
+        const uint32_t transfers = metrics.transfers();
+        const uint32_t failures = metrics.failures();
+        // the counters may have been reset (M624 R1) since the last check.
+        const uint32_t interval_transfers =
+            transfers >= bus.checked_transfers ?
+                transfers - bus.checked_transfers : transfers;
+        const uint32_t interval_failures =
+            failures >= bus.checked_failures ?
+                failures - bus.checked_failures : failures;
+        bus.checked_transfers = transfers;
+        bus.checked_failures = failures;
+
+        if (bus.clock_index &&
+            interval_failures >= I2C_STEP_DOWN_MIN_FAILURES &&
+            interval_failures * 1000 >=
+                static_cast<uint64_t>(interval_transfers) *
+                    I2C_STEP_DOWN_FAILURE_RATE)
+        {
+            bus.clock_index--;
+            ESP_LOGW(TAG, "[bus:%d] %" PRIu32 " of %" PRIu32 " transfers "
+                     "failed, reducing I2C clock to %" PRIu32 "Hz",
+                     bus.i2c->getPort(), interval_failures,
+                     interval_transfers, bus.clocks[bus.clock_index]);
+            bus.i2c->setClock(bus.clocks[bus.clock_index]);
+        }
+    }
+    bus_health_timer_.expires_from_now(
+        std::chrono::milliseconds(I2C_HEALTH_CHECK_INTERVAL_MS));
+    bus_health_timer_.async_wait(
+        std::bind(&FeederManager::check_bus_health, this,
+                  std::placeholders::_1));
+}
+
+void FeederManager::home_feeders(asio::error_code error)
+{
+    if (error)
+    {
+        return;
+    }
+    const std::size_t last =
+        std::min(homing_next_ + FEEDER_HOMING_BATCH_SIZE, feeders_.size());
+    for (; homing_next_ < last; homing_next_++)
+    {
+        Feeder *feeder = &feeders_[homing_next_];
+        asio::post(feeder->strand(), [feeder, idx = homing_next_]()
+        {
+            feeder->start_retract();
+
+            if (AUTO_ENABLE_FEEDERS)
+            {
+                ESP_LOGI(TAG, "Enabling feeder %s (%zu)",
+                         to_hex(feeder->uuid_).c_str(), idx + 1);
+                feeder->enable();
+            }
+        });
+    }
+    if (homing_next_ < feeders_.size())
+    {
+        homing_timer_.expires_from_now(
+            std::chrono::milliseconds(FEEDER_HOMING_INTERVAL_MS));
+        homing_timer_.async_wait(std::bind(&FeederManager::home_feeders, this,
+                                           std::placeholders::_1));
+    }
+}
+
+void FeederManager::start_motion()
+{
+    motion_requested_ = true;
+    if (!motion_running_.exchange(true))
+    {
+        asio::post(context_,
+                   std::bind(&FeederManager::motion_tick, this,
+                             asio::error_code()));
+    }
+}
+
+void FeederManager::feeder_event(std::size_t feeder, uint8_t events)
+{
+    if (!server_.has_event_subscribers())
+    {
+        return;
+    }
+    pending_events_[feeder].fetch_or(events, std::memory_order_relaxed);
+    if (!event_scheduled_.exchange(true))
+    {
+        // all further changes are coalesced until the events are sent, at
+        // most one batch is sent per FEEDER_EVENT_INTERVAL_MS.
+        asio::post(context_,
+            [this]()
+            {
+                event_timer_.expires_at(
+                    events_sent_ +
+                    std::chrono::milliseconds(FEEDER_EVENT_INTERVAL_MS));
+                event_timer_.async_wait(
+                    std::bind(&FeederManager::send_events, this,
+                              std::placeholders::_1));
+            });
+    }
+}
+
+void FeederManager::send_events(asio::error_code error)
+{
+    if (error)
+    {
+        return;
+    }
+    events_sent_ = std::chrono::system_clock::now();
+
+    // changes recorded from this point on will schedule another batch, they
+    // may also be included in this one.
+    event_scheduled_ = false;
+
+    std::string events;
+    for (std::size_t idx = 0; idx < feeders_.size(); idx++)
     {
-        value = std::stoi(ent->substr(arg_letter.length()));
+        const uint8_t flags =
+            pending_events_[idx].exchange(0, std::memory_order_relaxed);
+        if (!flags)
+        {
+            continue;
+        }
+        Feeder &feeder = feeders_[idx];
+        char line[64];
+        const int length =
+            snprintf(line, sizeof(line), "event N%zu X%u Y%u T%u M%u E%u\n",
+                     idx, hot_state_[idx].position.load(),
+                     hot_state_[idx].status.load(), feeder.is_tensioned(),
+                     (flags & FEEDER_EVENT_MANUAL_ADVANCE) ? 1 : 0,
+                     feeder.fault_.load());
+        events.append(line, std::clamp<int>(length, 0, sizeof(line) - 1));
+    }
+    if (!events.empty())
+    {
+        server_.publish_events(std::move(events));
+    }
+}
+
+bool FeederManager::acquire_motion_slot(std::size_t feeder)
+{
+    const std::size_t group = feeder / PCA9685::NUM_CHANNELS;
+    const std::lock_guard<std::mutex> lock(motion_slot_mux_);
+    // feeders which are already waiting take priority so that a busy
+    // PCA9685 can not starve the others.
+    if (motion_waiting_.empty() &&
+        moving_per_group_[group] < FEEDER_MAX_MOVING_PER_PCA9685 &&
+        moving_total_ < FEEDER_MAX_MOVING_TOTAL)
+    {
+        moving_per_group_[group]++;
+        moving_total_++;
         return true;
     }
+    motion_waiting_.push_back(feeder);
     return false;
 }
 
-GCodeServer::command_return_type FeederManager::feeder_move(GCodeServer::command_args args)
+void FeederManager::release_motion_slot(std::size_t feeder)
 {
-    ESP_LOGI(TAG, "feeder move request received");
-    uint8_t feeder = -1;
-    uint8_t distance = 0;
+    std::vector<std::size_t> resume;
+    {
+        const std::lock_guard<std::mutex> lock(motion_slot_mux_);
+        moving_per_group_[feeder / PCA9685::NUM_CHANNELS]--;
+        moving_total_--;
 
-    // optional argument to allow specifying the feed distance.
-    extract_arg("D", args, distance);
+        // start as many of the waiting feeders as possible, skipping any
+        // that are connected to a PCA9685 which has no capacity available.
+        for (auto it = motion_waiting_.begin();
+             it != motion_waiting_.end() &&
+             moving_total_ < FEEDER_MAX_MOVING_TOTAL;)
+        {
+            const std::size_t group = *it / PCA9685::NUM_CHANNELS;
+            if (moving_per_group_[group] < FEEDER_MAX_MOVING_PER_PCA9685)
+            {
+                moving_per_group_[group]++;
+                moving_total_++;
+                resume.push_back(*it);
+                it = motion_waiting_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+    for (auto id : resume)
+    {
+        Feeder *target = &feeders_[id];
+        // always posted as this may be called on the strand of the feeder
+        // being resumed, during it's motion tick.
+        asio::post(target->strand(), std::bind(&Feeder::resume_motion, target));
+    }
+}
 
-    if (!extract_arg("N", args, feeder) || feeder > feeders_.size())
+bool FeederManager::cancel_motion_slot(std::size_t feeder)
+{
+    const std::lock_guard<std::mutex> lock(motion_slot_mux_);
+    auto it = std::find(motion_waiting_.begin(), motion_waiting_.end(), feeder);
+    if (it == motion_waiting_.end())
     {
-        return std::make_pair(false, "Missing/invalid feeder ID");
+        return false;
     }
-    else if (!feeders_[feeder]->is_enabled())
+    motion_waiting_.erase(it);
+    return true;
+}
+
+void FeederManager::motion_tick(asio::error_code error)
+{
+    if (error)
     {
-        return std::make_pair(false, "Feeder has not been enabled!");
+        motion_running_ = false;
+        return;
     }
-    else if (feeders_[feeder]->is_busy())
+    // groups with moving feeders request another tick each time they are
+    // advanced, when no requests have been received the tick stops.
+    if (!motion_requested_.exchange(false))
     {
-        return std::make_pair(false, "Feeder is busy!");
+        motion_running_ = false;
+        // a movement may have started after the request was checked, restart
+        // the tick unless the feeder has already done so.
+        if (!motion_requested_ || motion_running_.exchange(true))
+        {
+            return;
+        }
     }
-    else if (!feeders_[feeder]->is_tensioned())
+    const auto now = std::chrono::steady_clock::now();
+
+    // feeders are grouped by the PCA9685 they are connected to, each group
+    // is advanced on it's own strand and once all feeders in the group have
+    // been advanced the staged servo updates are sent in a single
+    // transaction.
+    for (std::size_t group = 0; group < pca9685_.size(); group++)
     {
-        return std::make_pair(false, "Tape cover does not appear to be tensioned correctly!");
+        asio::post(group_strands_[group], [this, group, now]()
+        {
+            const std::size_t first = group * PCA9685::NUM_CHANNELS;
+            const std::size_t last =
+                std::min(first + PCA9685::NUM_CHANNELS, feeders_.size());
+            bool active = false;
+            for (std::size_t feeder = first; feeder < last; feeder++)
+            {
+                // only moving or settling feeders need to be advanced, this
+                // check avoids touching the idle feeders entirely.
+                const auto phase = hot_state_[feeder].phase;
+                if (phase == Feeder::MOTION_MOVING ||
+                    phase == Feeder::MOTION_SETTLING)
+                {
+                    active |= feeders_[feeder].motion_tick(now);
+                }
+            }
+            pca9685_[group]->flush_async();
+            if (active)
+            {
+                start_motion();
+            }
+        });
     }
-    else if (!feeders_[feeder]->move(distance))
+
+    motion_timer_.expires_from_now(
+        std::chrono::milliseconds(FEEDER_MOTION_TICK_MS));
+    motion_timer_.async_wait(std::bind(&FeederManager::motion_tick, this,
+                                       std::placeholders::_1));
+}
+
+void FeederManager::scan_inputs(asio::error_code error)
+{
+    if (error)
     {
-        return std::make_pair(false, "Feeder reported an error!");
+        return;
     }
+    const auto now = std::chrono::steady_clock::now();
 
-    wait_for_feeder(feeder);
+    // Send any pending servo updates ahead of the input reads so they are
+    // combined into the same bus transfer rather than competing with it.
+    for (auto &pca9685 : pca9685_)
+    {
+        pca9685->flush_async();
+    }
 
-    return std::make_pair(true, "");
+    // Read all devices that are due back-to-back, the I2CQueue will combine
+    // these into a single bus transfer.
+    auto next = now + std::chrono::milliseconds(MCP23017_WATCHDOG_INTERVAL_MS);
+    for (std::size_t index = 0; index < mcp23017_.size(); index++)
+    {
+        if (now >= scan_due_[index])
+        {
+            mcp23017_[index]->refresh();
+            scan_due_[index] = now + scan_interval(index, now);
+        }
+        next = std::min(next, scan_due_[index]);
+    }
+
+    scan_timer_.expires_from_now(next - now);
+    scan_timer_.async_wait(std::bind(&FeederManager::scan_inputs, this,
+                                     std::placeholders::_1));
 }
 
-GCodeServer::command_return_type FeederManager::feeder_post_pick(GCodeServer::command_args args)
+std::chrono::milliseconds
+FeederManager::scan_interval(std::size_t index,
+                             std::chrono::steady_clock::time_point now)
 {
-    ESP_LOGI(TAG, "feeder post pick request received");
-    uint8_t feeder = -1;
+    if (MCP23017_INT_PIN != GPIO_NUM_NC)
+    {
+        // state changes are reported via the interrupt, the scan is only
+        // necessary to catch any missed interrupts.
+        return std::chrono::milliseconds(MCP23017_WATCHDOG_INTERVAL_MS);
+    }
 
-    if (!extract_arg("N", args, feeder) || feeder > feeders_.size())
+    // feeders are assigned to the MCP23017 paired with the PCA9685 they are
+    // connected to.
+    const std::size_t first = mcp23017_group_[index] * PCA9685::NUM_CHANNELS;
+    const std::size_t last =
+        std::min(first + PCA9685::NUM_CHANNELS, feeders_.size());
+    auto hold = std::chrono::milliseconds(MCP23017_SCAN_ACTIVE_HOLD_MS);
+    for (std::size_t feeder = first; feeder < last; feeder++)
     {
-        return std::make_pair(false, "Missing/invalid feeder ID");
+        if (feeders_[feeder].is_busy())
+        {
+            scan_active_until_[index] = now + hold;
+            break;
+        }
     }
-    else if (!feeders_[feeder]->is_enabled())
+    if (scan_active_until_[index] > now ||
+        mcp23017_[index]->last_change() + hold > now)
     {
-        return std::make_pair(false, "Feeder has not been enabled!");
+        return std::chrono::milliseconds(MCP23017_SCAN_FAST_INTERVAL_MS);
     }
-    else if (feeders_[feeder]->is_busy())
+    return std::chrono::milliseconds(MCP23017_SCAN_IDLE_INTERVAL_MS);
+}
+
+void IRAM_ATTR FeederManager::mcp23017_isr(void *arg)
+{
+    FeederManager *mgr = static_cast<FeederManager *>(arg);
+    BaseType_t woken = pdFALSE;
+    // the ISR can not interact with the asio::io_context directly, defer the
+    // processing to the FreeRTOS timer task. Multiple edges received before
+    // the interrupt has been serviced will be combined.
+    if (!mgr->mcp23017_interrupt_pending_.exchange(true))
     {
-        return std::make_pair(false, "Feeder is busy!");
+        xTimerPendFunctionCallFromISR(&FeederManager::mcp23017_interrupt, arg,
+                                      0, &woken);
     }
-    else if (!feeders_[feeder]->post_pick())
+    portYIELD_FROM_ISR(woken);
+}
+
+void FeederManager::mcp23017_interrupt(void *arg, uint32_t)
+{
+    FeederManager *mgr = static_cast<FeederManager *>(arg);
+    asio::post(mgr->context_,
+               std::bind(&FeederManager::service_mcp23017_interrupt, mgr));
+}
+
+void FeederManager::service_mcp23017_interrupt()
+{
+    mcp23017_interrupt_pending_ = false;
+    auto remaining =
+        std::make_shared<std::atomic<std::size_t>>(mcp23017_.size());
+    for (auto &mcp23017 : mcp23017_)
     {
-        return std::make_pair(false, "Feeder reported an error!");
+        mcp23017->refresh([this, remaining]()
+        {
+            // once all devices have been read, verify that the interrupt
+            // line has been released. If another input changed while the
+            // devices were being read the line will remain low without a new
+            // edge being generated.
+            if (--(*remaining) == 0 && gpio_get_level(MCP23017_INT_PIN) == 0 &&
+                !mcp23017_interrupt_pending_.exchange(true))
+            {
+                asio::post(context_,
+                           std::bind(&FeederManager::service_mcp23017_interrupt,
+                                     this));
+            }
+        });
     }
+}
+
+void FeederManager::feeder_move(GCodeServer::command_view args,
+                                GCodeServer::command_completion done)
+{
+    trace(TRACE_FEEDER_REQUEST, TRACE_NO_FEEDER, args.code());
+    int32_t distance = 0;
+    const int64_t received = done.received();
 
-    wait_for_feeder(feeder);
+    // optional argument to allow specifying the feed distance.
+    if (args.get('D', distance) && !valid_distance(distance))
+    {
+        done(to_response(REQUEST_INVALID_DISTANCE));
+        return;
+    }
 
-    return std::make_pair(true, "");
+    for_each_feeder(args, std::move(done),
+        [this, distance, received](Feeder *target, bool deferred,
+                                   feeder_result result)
+    {
+        move_feeder(target, distance, deferred, received, text_result(result));
+    });
 }
 
-GCodeServer::command_return_type FeederManager::feeder_status(GCodeServer::command_args args)
+void FeederManager::feeder_post_pick(GCodeServer::command_view args,
+                                     GCodeServer::command_completion done)
 {
-    ESP_LOGI(TAG, "feeder status request received");
-    uint8_t feeder = -1;
+    trace(TRACE_FEEDER_REQUEST, TRACE_NO_FEEDER, args.code());
+    std::size_t feeder = -1;
 
-    if (!extract_arg("N", args, feeder) || feeder > feeders_.size())
+    if (!args.get('N', feeder) || feeder >= feeders_.size())
     {
-        return std::make_pair(false, "Missing/invalid feeder ID");
+        done(std::make_pair(false, "Missing/invalid feeder ID"));
+        return;
     }
 
-    return std::make_pair(true, feeders_[feeder]->status());
+    Feeder *target = &feeders_[feeder];
+    asio::dispatch(target->strand(), [this, target, done]()
+    {
+        post_pick_feeder(target, done.deferred(), done.received(),
+                         text_result(done));
+    });
 }
 
-GCodeServer::command_return_type FeederManager::feeder_enable(GCodeServer::command_args args)
+void FeederManager::feeder_prefeed(GCodeServer::command_view args,
+                                   GCodeServer::command_completion done)
 {
-    ESP_LOGI(TAG, "feeder enable request received");
-    uint8_t feeder = -1;
-    if (!extract_arg("N", args, feeder) || feeder > feeders_.size())
+    trace(TRACE_FEEDER_REQUEST, TRACE_NO_FEEDER, args.code());
+    std::size_t feeder = -1;
+    int32_t distance = 0;
+
+    // optional argument to allow specifying the feed distance.
+    if (args.get('D', distance) && !valid_distance(distance))
+    {
+        done(to_response(REQUEST_INVALID_DISTANCE));
+        return;
+    }
+
+    if (!args.get('N', feeder) || feeder >= feeders_.size())
     {
-        return std::make_pair(false, "Missing/invalid feeder ID");
+        done(std::make_pair(false, "Missing/invalid feeder ID"));
+        return;
     }
-    if (feeders_[feeder]->enable())
+
+    Feeder *target = &feeders_[feeder];
+    asio::dispatch(target->strand(), [target, distance, done]()
+    {
+        prefeed_feeder(target, distance, text_result(done));
+    });
+}
+
+void FeederManager::feeder_status(GCodeServer::command_view args,
+                                  GCodeServer::command_completion done)
+{
+    trace(TRACE_FEEDER_REQUEST, TRACE_NO_FEEDER, args.code());
+    for_each_feeder(args, std::move(done),
+        [](Feeder *target, bool, feeder_result result)
     {
-        return std::make_pair(true, "");
+        result(std::make_pair(true, target->status()));
+    });
+}
+
+GCodeServer::command_return_type
+FeederManager::feeder_bulk_status(GCodeServer::command_view args)
+{
+    int8_t hex = 0;
+    args.get('H', hex);
+
+    // the status of each feeder is read from it's cache so there is no need
+    // to dispatch to the feeder strands.
+    std::string response = std::to_string(feeders_.size());
+    response.reserve(feeders_.size() * (hex ? 40 : 96));
+    for (auto &feeder : feeders_)
+    {
+        response.append("\n");
+        feeder.append_status(response, hex);
     }
-    return std::make_pair(false, "Feeder reported an error");
+    return std::make_pair(true, response);
 }
 
-GCodeServer::command_return_type FeederManager::feeder_disable(GCodeServer::command_args args)
+GCodeServer::command_return_type
+FeederManager::bus_metrics(GCodeServer::command_view args)
 {
-    ESP_LOGI(TAG, "feeder disable request received");
-    uint8_t feeder = -1;
-    if (!extract_arg("N", args, feeder) || feeder > feeders_.size())
+    int8_t reset = 0;
+    args.get('R', reset);
+
+    std::string response;
+    for (auto &bus : buses_)
     {
-        return std::make_pair(false, "Missing/invalid feeder ID");
+        if (!response.empty())
+        {
+            response.append("\n");
+        }
+        bus.i2c->getMetrics().format(bus.i2c->getPort(), response);
+        if (reset)
+        {
+            bus.i2c->getMetrics().reset();
+        }
     }
-    if (feeders_[feeder]->disable())
+    return std::make_pair(true, response);
+}
+
+void FeederManager::log_bus_metrics()
+{
+    for (auto &bus : buses_)
     {
-        return std::make_pair(true, "");
+        bus.i2c->getMetrics().log(bus.i2c->getPort());
     }
-    return std::make_pair(false, "Feeder reported an error");
 }
 
-GCodeServer::command_return_type FeederManager::feeder_configure(GCodeServer::command_args args)
+void FeederManager::feeder_save(GCodeServer::command_view args,
+                                GCodeServer::command_completion done)
+{
+    ESP_LOGI(TAG, "feeder save request received");
+    // NVS writes block until the flash has been updated, perform them on the
+    // feeder context rather than the network context.
+    asio::post(context_, [this, done]()
+    {
+        if (config_store_.commit() == ESP_OK)
+        {
+            done(std::make_pair(true, ""));
+        }
+        else
+        {
+            done(std::make_pair(false, "Failed to persist configuration!"));
+        }
+    });
+}
+
+void FeederManager::feeder_enable(GCodeServer::command_view args,
+                                  GCodeServer::command_completion done)
+{
+    ESP_LOGI(TAG, "feeder enable request received");
+    for_each_feeder(args, std::move(done),
+        [](Feeder *target, bool, feeder_result result)
+    {
+        if (target->enable())
+        {
+            result(std::make_pair(true, ""));
+        }
+        else
+        {
+            result(std::make_pair(false, "Feeder reported an error"));
+        }
+    });
+}
+
+void FeederManager::feeder_disable(GCodeServer::command_view args,
+                                   GCodeServer::command_completion done)
+{
+    ESP_LOGI(TAG, "feeder disable request received");
+    for_each_feeder(args, std::move(done),
+        [](Feeder *target, bool, feeder_result result)
+    {
+        if (target->disable())
+        {
+            result(std::make_pair(true, ""));
+        }
+        else
+        {
+            result(std::make_pair(false, "Feeder reported an error"));
+        }
+    });
+}
+
+void FeederManager::feeder_configure(GCodeServer::command_view args,
+                                     GCodeServer::command_completion done)
 {
     ESP_LOGI(TAG, "feeder reconfigure request received");
-    uint8_t feeder = -1;
+    std::size_t feeder = -1;
     int8_t feedback_enabled = -1;
     int16_t advance_angle = 0, half_advance_angle = 0, retract_angle = 0,
             movement_speed = -1;
     uint16_t feed_length = 0, settle_time = 0, min_pulse = 0, max_pulse = 0,
              movement_degrees = 0;
 
-    if (!extract_arg("N", args, feeder) || feeder > feeders_.size())
+    if (!args.get('N', feeder) || feeder >= feeders_.size())
+    {
+        done(std::make_pair(false, "Missing/invalid feeder ID"));
+        return;
+    }
+    if (args.get('F', feed_length) && feed_length % 2)
     {
-        return std::make_pair(false, "Missing/invalid feeder ID");
+        done(std::make_pair(false, "Feed length must be a multiple of 2."));
+        return;
     }
-    if (extract_arg("F", args, feed_length) && feed_length % 2)
+    args.get('A', advance_angle);
+    args.get('B', half_advance_angle);
+    args.get('C', retract_angle);
+    args.get('D', movement_degrees);
+    args.get('S', movement_speed);
+    args.get('U', settle_time);
+    args.get('V', min_pulse);
+    args.get('W', max_pulse);
+    args.get('Z', feedback_enabled);
+
+    // the arguments are only valid during this call, capture the parsed
+    // values for use on the feeder strand.
+    Feeder *target = &feeders_[feeder];
+    asio::dispatch(target->strand(),
+        [target, done, advance_angle, half_advance_angle, retract_angle,
+         feed_length, settle_time, min_pulse, max_pulse, feedback_enabled,
+         movement_speed, movement_degrees]()
+    {
+        target->configure(advance_angle, half_advance_angle, retract_angle,
+                          feed_length, settle_time, min_pulse, max_pulse,
+                          feedback_enabled, movement_speed, movement_degrees);
+        done(std::make_pair(true, target->status()));
+    });
+}
+
+/// Parses a single feeder index from a feeder list.
+///
+/// @param list Feeder list being parsed.
+/// @param pos Position within @param list, updated to the first character
+/// after the index.
+/// @param id Receives the parsed index.
+///
+/// @return true if at least one digit was found, false otherwise.
+static bool parse_feeder_id(std::string_view list, std::size_t &pos,
+                            std::size_t &id)
+{
+    const std::size_t start = pos;
+    id = 0;
+    for (; pos < list.size() && list[pos] >= '0' && list[pos] <= '9'; pos++)
     {
-        return std::make_pair(false, "Feed length must be a multiple of 2.");
+        // saturate rather than overflow, the caller will reject the index.
+        if (id < std::numeric_limits<uint16_t>::max())
+        {
+            id = (id * 10) + (list[pos] - '0');
+        }
     }
-    extract_arg("A", args, advance_angle);
-    extract_arg("B", args, half_advance_angle);
-    extract_arg("C", args, retract_angle);
-    extract_arg("D", args, movement_degrees);
-    extract_arg("S", args, movement_speed);
-    extract_arg("U", args, settle_time);
-    extract_arg("V", args, min_pulse);
-    extract_arg("W", args, max_pulse);
-    extract_arg("Z", args, feedback_enabled);
-    
-    feeders_[feeder]->configure(advance_angle, half_advance_angle,
-                                retract_angle, feed_length, settle_time,
-                                min_pulse, max_pulse, feedback_enabled,
-                                movement_speed, movement_degrees);
+    return pos > start;
+}
 
-    return std::make_pair(true, feeders_[feeder]->status());
+bool FeederManager::parse_feeder_list(GCodeServer::command_view args,
+                                      feeder_set &feeders) const
+{
+    const std::string_view list = args.raw('N');
+    std::size_t pos = 0;
+    feeders.reset();
+    while (true)
+    {
+        std::size_t first = 0;
+        std::size_t last = 0;
+        if (!parse_feeder_id(list, pos, first))
+        {
+            return false;
+        }
+        last = first;
+        if (pos < list.size() && list[pos] == '-')
+        {
+            pos++;
+            if (!parse_feeder_id(list, pos, last) || last < first)
+            {
+                return false;
+            }
+        }
+        if (last >= feeders_.size())
+        {
+            return false;
+        }
+        for (std::size_t id = first; id <= last; id++)
+        {
+            feeders.set(id);
+        }
+        if (pos == list.size())
+        {
+            return true;
+        }
+        else if (list[pos] != ',')
+        {
+            return false;
+        }
+        pos++;
+    }
 }
 
-void FeederManager::wait_for_feeder(std::size_t feeder)
+void FeederManager::for_each_feeder(GCodeServer::command_view args,
+                                    GCodeServer::command_completion done,
+                                    feeder_operation operation)
 {
-    // wait for the feeder to finish processing the request.
-    while (feeders_[feeder]->is_busy())
+    feeder_set feeders;
+    if (!parse_feeder_list(args, feeders))
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(FEEDER_ASYNC_CHECK_DELAY_MS));
+        done(std::make_pair(false, "Missing/invalid feeder ID"));
+        return;
     }
-}
\ No newline at end of file
+
+    const std::size_t count = feeders.count();
+    std::size_t id = 0;
+    if (count == 1)
+    {
+        // single feeder, the response is sent exactly as the feeder reports.
+        while (!feeders.test(id))
+        {
+            id++;
+        }
+        Feeder *target = &feeders_[id];
+        asio::dispatch(target->strand(), [target, done, operation]()
+        {
+            operation(target, done.deferred(), done);
+        });
+        return;
+    }
+
+    // populate the batch before dispatching any of the operations as they
+    // will run concurrently on the feeder strands.
+    auto batch = std::make_shared<feeder_batch>(std::move(done), count);
+    for (std::size_t slot = 0; slot < count; slot++, id++)
+    {
+        while (!feeders.test(id))
+        {
+            id++;
+        }
+        batch->ids[slot] = id;
+    }
+    for (std::size_t slot = 0; slot < count; slot++)
+    {
+        Feeder *target = &feeders_[batch->ids[slot]];
+        asio::dispatch(target->strand(), [batch, slot, target, operation]()
+        {
+            operation(target, batch->done.deferred(),
+                      std::bind(&feeder_batch::complete, batch, slot,
+                                std::placeholders::_1));
+        });
+    }
+}
+
+void FeederManager::feeder_batch::complete(
+    std::size_t slot, GCodeServer::command_return_type result)
+{
+    results[slot] = std::move(result);
+    if (--remaining != 0)
+    {
+        return;
+    }
+
+    // All feeders have reported, the response starts with the number of
+    // feeders which succeeded followed by one line per feeder.
+    std::size_t succeeded = 0;
+    std::string response;
+    response.reserve(results.size() * 16);
+    for (std::size_t idx = 0; idx < results.size(); idx++)
+    {
+        response.append("\n");
+        if (!results[idx].first)
+        {
+            response.append("N").append(std::to_string(ids[idx]));
+            response.append(" error: ").append(results[idx].second);
+            continue;
+        }
+        succeeded++;
+        if (results[idx].second.empty())
+        {
+            response.append("N").append(std::to_string(ids[idx]));
+            response.append(" ok");
+        }
+        else
+        {
+            response.append(results[idx].second);
+        }
+    }
+    std::string summary = std::to_string(succeeded);
+    summary.append("/").append(std::to_string(results.size()));
+    done(std::make_pair(succeeded == results.size(),
+                        summary.append(response)));
+}
+
+void FeederManager::register_binary_handlers(BinaryServer &server)
+{
+    for (auto opcode : {BinaryServer::OPCODE_FEED,
+                        BinaryServer::OPCODE_POST_PICK,
+                        BinaryServer::OPCODE_STATUS,
+                        BinaryServer::OPCODE_PREFEED,
+                        BinaryServer::OPCODE_ENABLE,
+                        BinaryServer::OPCODE_DISABLE})
+    {
+        server.register_handler(opcode,
+            std::bind(&FeederManager::binary_request, this,
+                      std::placeholders::_1, std::placeholders::_2));
+    }
+}
+
+void FeederManager::binary_request(const BinaryServer::request_frame &request,
+                                   BinaryServer::completion done)
+{
+    if (request.feeder >= feeders_.size())
+    {
+        done(REQUEST_INVALID_FEEDER);
+        return;
+    }
+
+    Feeder *target = &feeders_[request.feeder];
+    if (request.opcode == BinaryServer::OPCODE_STATUS)
+    {
+        // the status is read from the feeder's cache so there is no need to
+        // dispatch to the feeder strand.
+        uint8_t record[Feeder::STATUS_RECORD_SIZE];
+        target->read_status_record(record);
+        done(REQUEST_OK, record, sizeof(record));
+        return;
+    }
+
+    if ((request.opcode == BinaryServer::OPCODE_FEED ||
+         request.opcode == BinaryServer::OPCODE_PREFEED) &&
+        !valid_distance(request.arg))
+    {
+        done(REQUEST_INVALID_DISTANCE);
+        return;
+    }
+    const uint8_t distance = request.arg;
+    asio::dispatch(target->strand(),
+        [this, target, opcode = request.opcode, distance, done]()
+    {
+        status_result result = [done](request_status_t status)
+        {
+            done(status);
+        };
+        switch (opcode)
+        {
+            case BinaryServer::OPCODE_FEED:
+                move_feeder(target, distance, done.deferred(), done.received(),
+                            result);
+                break;
+            case BinaryServer::OPCODE_POST_PICK:
+                post_pick_feeder(target, done.deferred(), done.received(),
+                                 result);
+                break;
+            case BinaryServer::OPCODE_PREFEED:
+                prefeed_feeder(target, distance, result);
+                break;
+            case BinaryServer::OPCODE_ENABLE:
+                result(target->enable() ? REQUEST_OK : REQUEST_FAILED);
+                break;
+            case BinaryServer::OPCODE_DISABLE:
+                result(target->disable() ? REQUEST_OK : REQUEST_FAILED);
+                break;
+            default:
+                done(BinaryServer::STATUS_INVALID_OPCODE);
+        }
+    });
+}
+
+GCodeServer::command_return_type
+FeederManager::to_response(request_status_t status)
+{
+    switch (status)
+    {
+        case REQUEST_OK:
+            return std::make_pair(true, "");
+        case REQUEST_INVALID_FEEDER:
+            return std::make_pair(false, "Missing/invalid feeder ID");
+        case REQUEST_NOT_ENABLED:
+            return std::make_pair(false, "Feeder has not been enabled!");
+        case REQUEST_BUSY:
+            return std::make_pair(false, "Feeder is busy!");
+        case REQUEST_NOT_TENSIONED:
+            return std::make_pair(false, "Tape cover does not appear to be tensioned correctly!");
+        case REQUEST_INCOMPLETE:
+            return std::make_pair(false, "Feeder movement did not complete!");
+        case REQUEST_PREFEED_PENDING:
+            return std::make_pair(false, "Feeder already has a pre-feed pending!");
+        case REQUEST_INVALID_DISTANCE:
+            return std::make_pair(false, "Distance must be a multiple of 2 up to 254.");
+        default:
+            return std::make_pair(false, "Feeder reported an error!");
+    }
+}
+
+FeederManager::status_result FeederManager::text_result(feeder_result result)
+{
+    return [result](request_status_t status)
+    {
+        result(to_response(status));
+    };
+}
+
+bool FeederManager::valid_distance(int32_t distance)
+{
+    return distance >= 0 && distance <= UINT8_MAX && (distance % 2) == 0;
+}
+
+void FeederManager::move_feeder(Feeder *target, uint8_t distance,
+                                bool deferred, int64_t received,
+                                status_result result)
+{
+    if (!target->is_enabled())
+    {
+        result(REQUEST_NOT_ENABLED);
+    }
+    else if (target->claim_prefeed(movement_callback(deferred, result)))
+    {
+        // the part has been (or is being) presented by a pre-feed.
+        if (!deferred)
+        {
+            result(REQUEST_OK);
+        }
+    }
+    else if (target->is_busy())
+    {
+        result(REQUEST_BUSY);
+    }
+    else if (!target->is_tensioned())
+    {
+        result(REQUEST_NOT_TENSIONED);
+    }
+    else if (!target->move(distance, movement_callback(deferred, result)))
+    {
+        result(REQUEST_FAILED);
+    }
+    else
+    {
+        target->track_latency(received);
+        if (!deferred)
+        {
+            result(REQUEST_OK);
+        }
+    }
+}
+
+void FeederManager::post_pick_feeder(Feeder *target, bool deferred,
+                                     int64_t received, status_result result)
+{
+    if (!target->is_enabled())
+    {
+        result(REQUEST_NOT_ENABLED);
+    }
+    else if (target->is_busy())
+    {
+        result(REQUEST_BUSY);
+    }
+    else if (!target->post_pick(movement_callback(deferred, result)))
+    {
+        result(REQUEST_FAILED);
+    }
+    else
+    {
+        if (target->is_moving())
+        {
+            target->track_latency(received);
+        }
+        if (!deferred)
+        {
+            result(REQUEST_OK);
+        }
+    }
+}
+
+void FeederManager::prefeed_feeder(Feeder *target, uint8_t distance,
+                                   status_result result)
+{
+    if (!target->is_enabled())
+    {
+        result(REQUEST_NOT_ENABLED);
+    }
+    else if (!target->prefeed(distance))
+    {
+        result(REQUEST_PREFEED_PENDING);
+    }
+    else
+    {
+        result(REQUEST_OK);
+    }
+}
+
+Feeder::completion_callback
+FeederManager::movement_callback(bool deferred, status_result result)
+{
+    // When the client has not requested deferred responses the command will
+    // be completed as soon as the feeder accepts the request.
+    if (!deferred)
+    {
+        return nullptr;
+    }
+    return [result](bool success)
+    {
+        result(success ? REQUEST_OK : REQUEST_INCOMPLETE);
+    };
+}
@@ -6,15 +6,46 @@
 
 #pragma once
 
+#include <array>
 #include <asio.hpp>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <deque>
 #include <map>
+#include <mutex>
 
 #include "config.hxx"
+#include "BinaryServer.hxx"
+#include "FeederConfigStore.hxx"
 #include "I2Cbus.hxx"
+#include "I2CQueue.hxx"
 #include "PCA9685.hxx"
 #include "MCP23017.hxx"
 #include "GCodeServer.hxx"
 #include "Feeder.hxx"
+#include "StaticPool.hxx"
+
+/// Builds an S-curve motion profile table.
+///
+/// Each entry is the fraction of the movement (scaled by @param SCALE) that
+/// has been completed at evenly spaced points in time. The profile follows
+/// the quintic smoothstep curve so that both the velocity and acceleration
+/// are zero at the start and end of the movement.
+///
+/// @return motion profile table.
+template <std::size_t SIZE, uint16_t SCALE>
+constexpr std::array<uint16_t, SIZE> make_motion_profile()
+{
+    std::array<uint16_t, SIZE> profile{};
+    for (std::size_t idx = 0; idx < SIZE; idx++)
+    {
+        const double t = static_cast<double>(idx) / (SIZE - 1);
+        const double position = t * t * t * (t * (t * 6 - 15) + 10);
+        profile[idx] = static_cast<uint16_t>((position * SCALE) + 0.5);
+    }
+    return profile;
+}
 
 /// Manages all connected Feeders.
 ///
@@ -23,6 +54,9 @@
 /// feeders and can contain up to 48 feeders total.
 ///
 /// The maximum number of banks can be defined in config.hxx.
+///
+/// When the second I2C bus is configured the feeders on the first bus are
+/// numbered first, followed by the feeders on the second bus.
 class FeederManager
 {
 public:
@@ -31,6 +65,49 @@ public:
     /// @param server @ref GCodeServer to register feeder commands with.
     FeederManager(GCodeServer &server, asio::io_context &context);
 
+    /// Destructor.
+    ~FeederManager();
+
+    /// Result of a request on a single feeder, these values are also used as
+    /// the response status of the binary protocol (@ref BinaryServer).
+    typedef enum : uint8_t
+    {
+        /// Request was successful.
+        REQUEST_OK = 0,
+
+        /// Feeder ID is not valid.
+        REQUEST_INVALID_FEEDER,
+
+        /// Feeder has not been enabled.
+        REQUEST_NOT_ENABLED,
+
+        /// Feeder is busy with another request.
+        REQUEST_BUSY,
+
+        /// Tape cover does not appear to be tensioned correctly.
+        REQUEST_NOT_TENSIONED,
+
+        /// Feeder rejected the request.
+        REQUEST_FAILED,
+
+        /// Feeder movement failed or was aborted.
+        REQUEST_INCOMPLETE,
+
+        /// Feeder already has a pre-feed pending.
+        REQUEST_PREFEED_PENDING,
+
+        /// Requested distance is not a multiple of 2 or is too long.
+        REQUEST_INVALID_DISTANCE
+    } request_status_t;
+
+    /// Logs the usage counters for each I2C bus.
+    void log_bus_metrics();
+
+    /// Registers the feeder operations with the binary protocol server.
+    ///
+    /// @param server @ref BinaryServer to register the operations with.
+    void register_binary_handlers(BinaryServer &server);
+
 protected:
     // Allow @ref Feeder to access protected fields.
     friend class Feeder;
@@ -53,6 +130,88 @@ protected:
     /// Command ID for disabling a feeder.
     static constexpr const char *const FEEDER_DISABLE_CMD = "M615";
 
+    /// Command ID for pre-feeding a feeder.
+    static constexpr const char *const FEEDER_PREFEED_CMD = "M616";
+
+    /// Command ID for displaying the status of all feeders.
+    static constexpr const char *const FEEDER_BULK_STATUS_CMD = "M617";
+
+    /// Command ID for persisting feeder configuration changes.
+    static constexpr const char *const FEEDER_SAVE_CMD = "M618";
+
+    /// Command ID for reporting the I2C bus usage counters.
+    static constexpr const char *const BUS_METRICS_CMD = "M624";
+
+    /// Number of entries in @ref MOTION_PROFILE.
+    static constexpr std::size_t MOTION_PROFILE_SIZE = 65;
+
+    /// Value of @ref MOTION_PROFILE entries for a completed movement.
+    static constexpr uint16_t MOTION_PROFILE_SCALE = 1024;
+
+    /// S-curve profile used for all servo movements, this is scaled to the
+    /// start and target angle of each movement.
+    static constexpr std::array<uint16_t, MOTION_PROFILE_SIZE> MOTION_PROFILE =
+        make_motion_profile<MOTION_PROFILE_SIZE, MOTION_PROFILE_SCALE>();
+
+    /// Requests another motion tick, starting the tick if it is not already
+    /// running. Called by @ref Feeder when a movement starts and for each
+    /// group of feeders which remain in motion.
+    void start_motion();
+
+    /// Requests permission for a feeder to start moving it's servo, the
+    /// number of servos moving at the same time is limited per PCA9685
+    /// (@ref FEEDER_MAX_MOVING_PER_PCA9685) and globally
+    /// (@ref FEEDER_MAX_MOVING_TOTAL).
+    ///
+    /// @param feeder Index of the feeder requesting to move.
+    ///
+    /// @return true if the feeder can start moving, false if the feeder has
+    /// been queued and will be resumed via @ref Feeder::resume_motion once
+    /// another servo has finished moving.
+    bool acquire_motion_slot(std::size_t feeder);
+
+    /// Releases the permission granted by @ref acquire_motion_slot, called
+    /// when the servo has reached it's target angle.
+    ///
+    /// @param feeder Index of the feeder that has finished moving.
+    void release_motion_slot(std::size_t feeder);
+
+    /// Removes a feeder from the queue of feeders waiting to move, called
+    /// when the feeder is disabled before it has been allowed to move.
+    ///
+    /// @param feeder Index of the feeder to remove.
+    ///
+    /// @return true if the feeder was removed, false if it was not queued
+    /// because it has already been granted permission to move, in which case
+    /// @ref Feeder::resume_motion has been posted to the feeder.
+    bool cancel_motion_slot(std::size_t feeder);
+
+    /// Feeder changes which are reported to event subscribers (M621).
+    typedef enum : uint8_t
+    {
+        /// Feeder status or position has changed.
+        FEEDER_EVENT_STATE = 0x01,
+
+        /// Tension feedback state has changed.
+        FEEDER_EVENT_TENSION = 0x02,
+
+        /// Feeder has been manually advanced using the tape tension arm.
+        FEEDER_EVENT_MANUAL_ADVANCE = 0x04,
+
+        /// Feeder fault has been raised or cleared.
+        FEEDER_EVENT_FAULT = 0x08
+    } feeder_event_t;
+
+    /// Records a feeder change for the event subscribers (M621), changes
+    /// are coalesced and sent at most every @ref FEEDER_EVENT_INTERVAL_MS.
+    ///
+    /// @param feeder Index of the feeder that has changed.
+    /// @param events @ref feeder_event_t flags describing the change.
+    ///
+    /// NOTE: This does nothing when no client has subscribed to events and
+    /// can be called from any thread.
+    void feeder_event(std::size_t feeder, uint8_t events);
+
 private:
     /// Log tag to use for this class.
     static constexpr const char *const TAG = "feeder_mgr";
@@ -76,8 +235,59 @@ private:
     static constexpr std::size_t MAX_FEEDER_COUNT =
         MAX_PCA9685_COUNT * PCA9685::NUM_CHANNELS;
 
-    /// Interval at which to check a feeder has completed it's async action(s).
-    static constexpr std::size_t FEEDER_ASYNC_CHECK_DELAY_MS = 50;
+    static_assert(FEEDER_POOL_SIZE <= MAX_FEEDER_COUNT,
+                  "FEEDER_POOL_SIZE exceeds the supported number of feeders");
+
+    /// Set of feeders targeted by a single command.
+    using feeder_set = std::bitset<MAX_FEEDER_COUNT>;
+
+    /// Callback which receives the result of an operation on a single
+    /// feeder.
+    using feeder_result = std::function<void(GCodeServer::command_return_type)>;
+
+    /// Callback which receives the status of a request on a single feeder.
+    using status_result = std::function<void(request_status_t)>;
+
+    /// Operation to perform on a single feeder, this is invoked on the
+    /// feeder's strand and must invoke the @ref feeder_result exactly once.
+    ///
+    /// Signature: void function(Feeder *feeder, bool deferred,
+    ///                          feeder_result result).
+    using feeder_operation = std::function<void(Feeder *, bool, feeder_result)>;
+
+    /// Collects the results of an operation on multiple feeders and sends a
+    /// single aggregated response once all feeders have reported.
+    struct feeder_batch
+    {
+        /// Constructor.
+        ///
+        /// @param done Completion token for the request.
+        /// @param count Number of feeders in the batch.
+        feeder_batch(GCodeServer::command_completion done, std::size_t count)
+            : done(std::move(done)), ids(count), results(count),
+              remaining(count)
+        {
+        }
+
+        /// Records the result for a single feeder.
+        ///
+        /// @param slot Index of the feeder within the batch.
+        /// @param result Result of the operation.
+        void complete(std::size_t slot,
+                      GCodeServer::command_return_type result);
+
+        /// Completion token for the request.
+        GCodeServer::command_completion done;
+
+        /// Feeder index for each slot in the batch.
+        std::vector<std::size_t> ids;
+
+        /// Result for each slot in the batch.
+        std::vector<GCodeServer::command_return_type> results;
+
+        /// Number of feeders which have not yet reported a result.
+        std::atomic<std::size_t> remaining;
+    };
 
     /// Configuration parameters that are persisted.
     typedef struct
@@ -85,8 +295,39 @@ private:
         uint32_t feeder_uuid[MAX_FEEDER_COUNT];
     } feeder_manager_config_t;
 
-    /// I2C instance used for managing feeders.
-    I2C_t &i2c_;
+    /// I2C bus used for managing feeders.
+    struct i2c_bus_t
+    {
+        /// I2C instance for the bus.
+        I2C_t *i2c;
+
+        /// @ref I2CQueue used for all access to the bus from asio handlers.
+        std::unique_ptr<I2CQueue> queue;
+
+        /// Clock speeds which can be used for the bus, slowest first.
+        std::vector<uint32_t> clocks;
+
+        /// Index of the clock speed in use in @ref clocks.
+        std::size_t clock_index{0};
+
+        /// @ref I2CMetrics::transfers at the previous health check.
+        uint32_t checked_transfers{0};
+
+        /// @ref I2CMetrics::failures at the previous health check.
+        uint32_t checked_failures{0};
+    };
+
+    /// @ref asio::io_context used for all feeder processing.
+    asio::io_context &context_;
+
+    /// @ref GCodeServer which feeder events are published to.
+    GCodeServer &server_;
+
+    /// I2C buses used for managing feeders.
+    std::vector<i2c_bus_t> buses_;
+
+    /// Persistent storage for the feeder configurations.
+    FeederConfigStore config_store_;
 
     /// Collection of PCA9685 devices used by the feeders for servo control.
     std::vector<std::shared_ptr<PCA9685>> pca9685_;
@@ -94,77 +335,351 @@ private:
     /// Collection of MCP23017 devices used by the feeders for feedback.
     std::vector<std::shared_ptr<MCP23017>> mcp23017_;
 
+    /// Index of the @ref PCA9685 (feeder group) that each entry in
+    /// @ref mcp23017_ provides feedback for.
+    std::vector<std::size_t> mcp23017_group_;
+
     /// Collection of feeders.
-    std::vector<std::shared_ptr<Feeder>> feeders_;
+    ///
+    /// The feeders are held in static storage rather than being allocated
+    /// individually from the heap, as a result only a single
+    /// @ref FeederManager can exist at a time.
+    static StaticPool<Feeder, FEEDER_POOL_SIZE> feeders_;
+
+    /// Runtime state of each feeder, this is kept separate from the
+    /// @ref Feeder instances so that the motion tick can check which feeders
+    /// are moving without touching the (much larger) @ref Feeder instances.
+    static std::array<Feeder::hot_state_t, FEEDER_POOL_SIZE> hot_state_;
+
+    /// Timer used for the motion tick.
+    asio::system_timer motion_timer_;
+
+    /// When true the motion tick is running.
+    std::atomic<bool> motion_running_{false};
+
+    /// When true a movement has been started since the last motion tick.
+    std::atomic<bool> motion_requested_{false};
+
+    /// @ref feeder_event_t flags for each feeder which have not yet been
+    /// sent to the event subscribers.
+    std::array<std::atomic<uint8_t>, FEEDER_POOL_SIZE> pending_events_{};
+
+    /// Timer used to rate limit the feeder events.
+    asio::system_timer event_timer_;
+
+    /// When true sending of the pending feeder events has been scheduled.
+    std::atomic<bool> event_scheduled_{false};
+
+    /// Time at which the pending feeder events were last sent.
+    std::chrono::system_clock::time_point events_sent_;
 
-    /// Utility function to extract a parameter from the provided arguments.
+    /// Number of moving servos on each @ref PCA9685.
+    std::vector<std::size_t> moving_per_group_;
+
+    /// Number of moving servos across all @ref PCA9685 devices.
+    std::size_t moving_total_{0};
+
+    /// Feeders waiting to start moving, in the order they were queued.
+    std::deque<std::size_t> motion_waiting_;
+
+    /// Protects @ref moving_per_group_, @ref moving_total_ and
+    /// @ref motion_waiting_.
+    std::mutex motion_slot_mux_;
+
+    /// Strands used by the feeders, one per @ref PCA9685.
+    std::vector<Feeder::strand_type> group_strands_;
+
+    /// Timer used to stagger homing of the feeders during startup.
+    asio::system_timer homing_timer_;
+
+    /// Index of the next feeder to be homed.
+    std::size_t homing_next_{0};
+
+    /// Timer used for scanning the @ref MCP23017 devices.
+    asio::system_timer scan_timer_;
+
+    /// Timer used for checking the I2C bus error rates.
+    asio::system_timer bus_health_timer_;
+
+    /// Time at which each @ref MCP23017 device should next be read.
+    std::vector<std::chrono::steady_clock::time_point> scan_due_;
+
+    /// Time until which each @ref MCP23017 device should be read at the
+    /// fast scan interval.
+    std::vector<std::chrono::steady_clock::time_point> scan_active_until_;
+
+    /// When true the MCP23017 interrupt has been raised and not yet
+    /// serviced.
+    std::atomic<bool> mcp23017_interrupt_pending_{false};
+
+    /// ISR for @ref MCP23017_INT_PIN.
+    ///
+    /// @param arg @ref FeederManager instance.
+    static void mcp23017_isr(void *arg);
+
+    /// Called from the FreeRTOS timer task after @ref mcp23017_isr to hand
+    /// off the interrupt to the @ref asio::io_context.
+    ///
+    /// @param arg @ref FeederManager instance.
+    static void mcp23017_interrupt(void *arg, uint32_t);
+
+    /// Reads all @ref MCP23017 devices after the interrupt has been raised.
+    void service_mcp23017_interrupt();
+
+    /// Initializes an I2C bus and detects the PCA9685 and MCP23017 devices
+    /// connected to it.
+    ///
+    /// @param bus @ref i2c_bus_t to probe.
+    /// @param group_mcp23017 Receives the @ref MCP23017 (or nullptr) for each
+    /// @ref PCA9685 detected on the bus.
+    void probe_bus(i2c_bus_t &bus,
+                   std::vector<std::shared_ptr<MCP23017>> &group_mcp23017);
+
+    /// Selects the fastest clock speed that all devices on an I2C bus can
+    /// reliably communicate at, see @ref I2C_CLOCK_CALIBRATION.
     ///
-    /// @param arg Argument to search for.
-    /// @param args Arguments to search through.
-    /// @param value Variable to capture the parameter value.
+    /// @param bus @ref i2c_bus_t to calibrate.
+    /// @param first_group Index of the first @ref PCA9685 on the bus.
+    /// @param mcp23017 @ref MCP23017 devices detected on the bus.
+    void calibrate_bus(i2c_bus_t &bus, std::size_t first_group,
+                       const std::vector<std::shared_ptr<MCP23017>> &mcp23017);
+
+    /// Reduces the clock speed of any I2C bus with a rising error rate and
+    /// schedules the next check.
+    ///
+    /// @param error @ref asio::error_code provided by the
+    /// @ref bus_health_timer_.
+    void check_bus_health(asio::error_code error);
+
+    /// Moves the next batch of feeders to the retracted position and enables
+    /// them (if @ref AUTO_ENABLE_FEEDERS is set), at most
+    /// @ref FEEDER_HOMING_BATCH_SIZE feeders are started at a time.
+    ///
+    /// @param error @ref asio::error_code provided by the @ref homing_timer_.
+    void home_feeders(asio::error_code error);
+
+    /// Advances all moving feeders and sends the staged servo updates for
+    /// each @ref PCA9685 in a single transaction.
+    ///
+    /// @param error @ref asio::error_code provided by the @ref motion_timer_.
+    void motion_tick(asio::error_code error);
+
+    /// Formats the pending feeder events and sends them to the event
+    /// subscribers.
+    ///
+    /// @param error @ref asio::error_code provided by the @ref event_timer_.
+    void send_events(asio::error_code error);
+
+    /// Reads all @ref MCP23017 devices which are due to be read and
+    /// schedules the next scan.
+    ///
+    /// @param error @ref asio::error_code provided by the @ref scan_timer_.
+    void scan_inputs(asio::error_code error);
+
+    /// Calculates the interval at which an @ref MCP23017 should be read.
+    ///
+    /// @param index Index of the @ref MCP23017 in @ref mcp23017_.
+    /// @param now Current time.
+    ///
+    /// @return interval until the next read.
+    std::chrono::milliseconds
+    scan_interval(std::size_t index, std::chrono::steady_clock::time_point now);
+
+    /// Parses the feeder list from the "N" argument of a command.
+    ///
+    /// @param args Arguments to the command.
+    /// @param feeders Receives the set of feeders, this can be a single
+    /// feeder (N3), a range of feeders (N0-15) or a comma separated list of
+    /// feeders and ranges (N3,7,9-11).
+    ///
+    /// @return true if the list was valid and all feeders exist, false
+    /// otherwise.
+    bool parse_feeder_list(GCodeServer::command_view args,
+                           feeder_set &feeders) const;
+
+    /// Performs an operation on all feeders listed in the "N" argument of a
+    /// command.
     ///
-    /// @return true upon successful extraction of parameter, false otherwise.
+    /// @param args Arguments to the command.
+    /// @param done Completion token for the request.
+    /// @param operation @ref feeder_operation to perform on each feeder.
     ///
-    /// NOTE: @param arg can be more than one character but typically will be
-    /// a single character string.
-    template <typename T>
-    bool extract_arg(std::string arg, GCodeServer::command_args args,
-                     T &value);
+    /// When a single feeder is listed the response from the operation is
+    /// sent as-is, otherwise the operation is performed on all feeders
+    /// concurrently and a single aggregated response is sent once all
+    /// feeders have reported.
+    void for_each_feeder(GCodeServer::command_view args,
+                         GCodeServer::command_completion done,
+                         feeder_operation operation);
 
     /// Handles the request to move a feeder (M610).
     ///
     /// @param args Arguments to the command.
-    /// @return status of the request.
+    /// @param done Completion token for the request.
     ///
-    /// Command format: M610 N{feeder} {D{distance}}
-    GCodeServer::command_return_type feeder_move(GCodeServer::command_args args);
+    /// Command format: M610 N{feeder(s)} {D{distance}}
+    void feeder_move(GCodeServer::command_view args,
+                     GCodeServer::command_completion done);
 
     /// Handles the post-pick action for a feeder (M611).
     ///
     /// @param args Arguments to the command.
-    /// @return status of the request.
+    /// @param done Completion token for the request.
     ///
     /// Command format: M611 N{feeder}
-    GCodeServer::command_return_type feeder_post_pick(GCodeServer::command_args args);
+    void feeder_post_pick(GCodeServer::command_view args,
+                          GCodeServer::command_completion done);
+
+    /// Handles the pre-feed request for a feeder (M616).
+    ///
+    /// @param args Arguments to the command.
+    /// @param done Completion token for the request.
+    ///
+    /// Command format: M616 N{feeder} {D{distance}}
+    void feeder_prefeed(GCodeServer::command_view args,
+                        GCodeServer::command_completion done);
 
     /// Handles the status request for a feeder (M612).
     ///
     /// @param args Arguments to the command.
-    /// @return status of the request.
+    /// @param done Completion token for the request.
+    ///
+    /// Command format: M612 N{feeder(s)}
+    void feeder_status(GCodeServer::command_view args,
+                       GCodeServer::command_completion done);
+
+    /// Handles the status request for all feeders (M617).
+    ///
+    /// @param args Arguments to the command.
     ///
-    /// Command format: M612 N{feeder}
-    GCodeServer::command_return_type feeder_status(GCodeServer::command_args args);
+    /// @return status of all feeders.
+    ///
+    /// Command format: M617 {H1}
+    GCodeServer::command_return_type
+    feeder_bulk_status(GCodeServer::command_view args);
+
+    /// Handles the I2C bus usage counters request (M624).
+    ///
+    /// @param args Arguments to the command.
+    ///
+    /// @return usage counters for each I2C bus and the devices on it.
+    ///
+    /// Command format: M624 {R1}
+    GCodeServer::command_return_type
+    bus_metrics(GCodeServer::command_view args);
+
+    /// Handles the request to persist feeder configuration changes (M618).
+    ///
+    /// @param args Arguments to the command.
+    /// @param done Completion token for the request.
+    ///
+    /// Command format: M618
+    void feeder_save(GCodeServer::command_view args,
+                     GCodeServer::command_completion done);
 
     /// Handles the feeder enable request (M614).
     ///
     /// @param args Arguments to the command.
-    /// @return status of the request.
+    /// @param done Completion token for the request.
     ///
-    /// Command format: M614 N{feeder}
-    GCodeServer::command_return_type feeder_enable(GCodeServer::command_args args);
+    /// Command format: M614 N{feeder(s)}
+    void feeder_enable(GCodeServer::command_view args,
+                       GCodeServer::command_completion done);
 
     /// Handles the feeder disable request (M615).
     ///
     /// @param args Arguments to the command.
-    /// @return status of the request.
+    /// @param done Completion token for the request.
     ///
-    /// Command format: M615 N{feeder}
-    GCodeServer::command_return_type feeder_disable(GCodeServer::command_args args);
+    /// Command format: M615 N{feeder(s)}
+    void feeder_disable(GCodeServer::command_view args,
+                        GCodeServer::command_completion done);
 
     /// Handles the configure request for a feeder (M613).
     ///
     /// @param args Arguments to the command.
-    /// @return status of the request.
+    /// @param done Completion token for the request.
     ///
     /// Command format: M613 N{feeder} A{advance angle}
     ///                 B{half advance angle} C{retract angle}
     ///                 F{feed length} U{settle time} V{min pulse} W{max pulse}
     ///                 Z{feedback enabled}
-    GCodeServer::command_return_type feeder_configure(GCodeServer::command_args args);
+    void feeder_configure(GCodeServer::command_view args,
+                          GCodeServer::command_completion done);
+
+    /// Handles a binary protocol request for a single feeder.
+    ///
+    /// @param request @ref BinaryServer::request_frame received.
+    /// @param done Completion token for the request.
+    void binary_request(const BinaryServer::request_frame &request,
+                        BinaryServer::completion done);
+
+    /// Converts a @ref request_status_t to a GCode response.
+    ///
+    /// @param status @ref request_status_t to convert.
+    ///
+    /// @return GCode response for @param status.
+    static GCodeServer::command_return_type
+    to_response(request_status_t status);
+
+    /// Creates a @ref status_result which forwards the GCode response to a
+    /// @ref feeder_result.
+    ///
+    /// @param result @ref feeder_result to receive the GCode response.
+    ///
+    /// @return @ref status_result wrapping @param result.
+    static status_result text_result(feeder_result result);
 
-    /// Utility method which waits for a specific feeder to reach a stopped
-    /// position prior to returning.
+    /// Checks that a requested feed distance can be completed by the feeder,
+    /// the feeder moves in steps of half the mechanical advance length.
+    ///
+    /// @param distance Requested distance in mm, zero for the feed length.
+    ///
+    /// @return true if @param distance is zero or a multiple of 2 which fits
+    /// in the feeder's movement counter.
+    static bool valid_distance(int32_t distance);
+
+    /// Starts moving a feeder forward, this must be called on the feeder's
+    /// strand.
+    ///
+    /// @param target @ref Feeder to move.
+    /// @param distance Distance to move, zero uses the feed length.
+    /// @param deferred Set to true when the result should be reported once
+    /// the movement has finished.
+    /// @param received Time at which the request was received.
+    /// @param result Callback to receive the result of the request.
+    void move_feeder(Feeder *target, uint8_t distance,
+                     bool deferred, int64_t received, status_result result);
+
+    /// Starts the post-pick action of a feeder, this must be called on the
+    /// feeder's strand.
+    ///
+    /// @param target @ref Feeder to retract.
+    /// @param deferred Set to true when the result should be reported once
+    /// the movement has finished.
+    /// @param received Time at which the request was received.
+    /// @param result Callback to receive the result of the request.
+    void post_pick_feeder(Feeder *target, bool deferred,
+                          int64_t received, status_result result);
+
+    /// Queues a pre-feed for a feeder, this must be called on the feeder's
+    /// strand.
+    ///
+    /// @param target @ref Feeder to pre-feed.
+    /// @param distance Distance to move, zero uses the feed length.
+    /// @param result Callback to receive the result of the request.
+    static void prefeed_feeder(Feeder *target, uint8_t distance,
+                               status_result result);
+
+    /// Creates the @ref Feeder::completion_callback for a movement request.
+    ///
+    /// @param deferred Set to true when the client has requested deferred
+    /// responses.
+    /// @param result Callback to receive the result of the movement.
     ///
-    /// @param feeder Feeder ID to wait for.
-    void wait_for_feeder(std::size_t feeder);
+    /// @return @ref Feeder::completion_callback which will report the result
+    /// once the movement has finished or nullptr if the client has not
+    /// requested deferred responses.
+    Feeder::completion_callback movement_callback(bool deferred,
+                                                  status_result result);
 };
\ No newline at end of file
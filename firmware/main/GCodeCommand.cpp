@@ -0,0 +1,159 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#include <cstdint>
+#include <limits>
+#include "GCodeCommand.hxx"
+
+/// Character used to start a comment.
+static constexpr char COMMENT_START = ';';
+
+static inline bool is_space(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+static inline bool is_digit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+static inline bool is_letter(char ch)
+{
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
+
+/// Parses a numeric value from the provided buffer.
+///
+/// @param str Start of the numeric value.
+/// @param length Number of characters available in @param str.
+/// @param integer Receives the integer portion of the value.
+/// @param real Receives the full value, including fractional portion.
+///
+/// @return true if at least one digit was found, false otherwise.
+static bool parse_number(const char *str, std::size_t length,
+                         int32_t &integer, float &real)
+{
+    std::size_t pos = 0;
+    bool negative = false;
+    bool digits = false;
+    int64_t whole = 0;
+    float fraction = 0.0f;
+
+    if (pos < length && (str[pos] == '-' || str[pos] == '+'))
+    {
+        negative = str[pos] == '-';
+        pos++;
+    }
+    for (; pos < length && is_digit(str[pos]); pos++)
+    {
+        digits = true;
+        // saturate rather than overflow for overly long values.
+        if (whole < std::numeric_limits<int32_t>::max())
+        {
+            whole = (whole * 10) + (str[pos] - '0');
+        }
+    }
+    if (pos < length && str[pos] == '.')
+    {
+        float scale = 0.1f;
+        for (pos++; pos < length && is_digit(str[pos]); pos++)
+        {
+            digits = true;
+            fraction += (str[pos] - '0') * scale;
+            scale *= 0.1f;
+        }
+    }
+    if (!digits)
+    {
+        return false;
+    }
+    if (whole > std::numeric_limits<int32_t>::max())
+    {
+        whole = std::numeric_limits<int32_t>::max();
+    }
+    integer = negative ? -static_cast<int32_t>(whole)
+                       : static_cast<int32_t>(whole);
+    real = static_cast<float>(whole) + fraction;
+    if (negative)
+    {
+        real = -real;
+    }
+    return true;
+}
+
+bool GCodeCommand::parse(const char *line, std::size_t length)
+{
+    line_ = line;
+    letter_ = 0;
+    code_ = 0;
+    present_ = 0;
+    seen_ = 0;
+    command_offset_ = 0;
+    command_length_ = 0;
+    line_length_ = 0;
+
+    // the offsets are stored as 16-bit values, anything longer is not a
+    // valid command line.
+    if (length > std::numeric_limits<uint16_t>::max())
+    {
+        return false;
+    }
+
+    std::size_t pos = 0;
+    while (pos < length && line[pos] != COMMENT_START)
+    {
+        if (is_space(line[pos]) || !is_letter(line[pos]))
+        {
+            // skip whitespace and any characters that can not start a word.
+            pos++;
+            continue;
+        }
+
+        const char letter = line[pos];
+        const std::size_t start = ++pos;
+        // the word value extends until whitespace, comment or the start of
+        // the next word.
+        while (pos < length && !is_space(line[pos]) &&
+               !is_letter(line[pos]) && line[pos] != COMMENT_START)
+        {
+            pos++;
+        }
+
+        int32_t integer = 0;
+        float real = 0.0f;
+        bool valid = parse_number(line + start, pos - start, integer, real);
+
+        if (!letter_)
+        {
+            // first word is the command itself, ie: M610.
+            letter_ = letter & ~0x20;
+            code_ = valid ? integer : 0;
+            command_offset_ = start - 1;
+            command_length_ = pos - command_offset_;
+        }
+        else
+        {
+            const int idx = index(letter);
+            words_[idx].integer = integer;
+            words_[idx].real = real;
+            words_[idx].offset = start;
+            words_[idx].length = pos - start;
+            seen_ |= (1UL << idx);
+            if (valid)
+            {
+                present_ |= (1UL << idx);
+            }
+            else
+            {
+                present_ &= ~(1UL << idx);
+            }
+        }
+        line_length_ = pos - command_offset_;
+    }
+
+    return letter_ != 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+/// Parsed view of a single GCode command line.
+///
+/// The command line is parsed exactly once into a fixed size table of words
+/// indexed by their letter, no heap allocations are performed during parsing
+/// or when looking up a word value.
+///
+/// NOTE: The parsed view references the buffer that was provided to
+/// @ref parse, it is only valid for as long as that buffer is unmodified.
+class GCodeCommand
+{
+public:
+    /// Parses a single command line.
+    ///
+    /// @param line Command line to parse, does not need to be null terminated
+    /// and may contain a trailing comment (started with a ";" character).
+    /// @param length Number of characters in @param line.
+    ///
+    /// @return true if a command word was found, false if the line was empty
+    /// or contained only a comment.
+    bool parse(const char *line, std::size_t length);
+
+    /// @return Letter of the command word, ie: "M" for "M610".
+    char letter() const
+    {
+        return letter_;
+    }
+
+    /// @return Numeric code of the command word, ie: 610 for "M610". The
+    /// value is not range checked, it may be negative or exceed the range of
+    /// any registered command.
+    int32_t code() const
+    {
+        return code_;
+    }
+
+    /// @return Text of the command word, ie: "M610".
+    std::string_view command() const
+    {
+        return std::string_view(line_ + command_offset_, command_length_);
+    }
+
+    /// @return Text of the full command line with comments and surrounding
+    /// whitespace removed.
+    std::string_view line() const
+    {
+        return std::string_view(line_ + command_offset_, line_length_);
+    }
+
+    /// @return bit mask of all words present in the command line, bit zero
+    /// represents "A", bit one "B", etc.
+    uint32_t mask() const
+    {
+        return present_;
+    }
+
+    /// Checks if a word is present in the command line.
+    ///
+    /// @param letter Word letter to check for, case insensitive.
+    ///
+    /// @return true if the word is present and has a valid numeric value.
+    bool has(char letter) const
+    {
+        int idx = index(letter);
+        return idx >= 0 && (present_ & (1UL << idx));
+    }
+
+    /// Retrieves the value of a word.
+    ///
+    /// @param letter Word letter to retrieve, case insensitive.
+    /// @param value Variable to receive the value of the word, for integer
+    /// types the value is truncated towards zero.
+    ///
+    /// @return true if the word was present and @param value has been
+    /// updated, false otherwise.
+    template <typename T>
+    bool get(char letter, T &value) const
+    {
+        if (!has(letter))
+        {
+            return false;
+        }
+        auto const &word = words_[index(letter)];
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            value = static_cast<T>(word.real);
+        }
+        else
+        {
+            value = static_cast<T>(word.integer);
+        }
+        return true;
+    }
+
+    /// Retrieves the unparsed text of a word, this can be used for values
+    /// that are not a single number such as lists or ranges.
+    ///
+    /// @param letter Word letter to retrieve, case insensitive.
+    ///
+    /// @return Text following the word letter, empty if the word was not
+    /// present.
+    std::string_view raw(char letter) const
+    {
+        int idx = index(letter);
+        if (idx < 0 || !(seen_ & (1UL << idx)))
+        {
+            return std::string_view();
+        }
+        return std::string_view(line_ + words_[idx].offset,
+                                words_[idx].length);
+    }
+
+private:
+    /// Number of unique word letters supported.
+    static constexpr std::size_t MAX_WORDS = 26;
+
+    /// Storage for a single parsed word.
+    struct Word
+    {
+        /// Integer portion of the value.
+        int32_t integer;
+
+        /// Full value including any fractional portion.
+        float real;
+
+        /// Offset into the command line of the word value.
+        uint16_t offset;
+
+        /// Number of characters in the word value.
+        uint16_t length;
+    };
+
+    /// Converts a word letter to an index into @ref words_.
+    ///
+    /// @param letter Word letter to convert, case insensitive.
+    ///
+    /// @return index of the word or -1 if @param letter is not valid.
+    static int index(char letter)
+    {
+        if (letter >= 'a' && letter <= 'z')
+        {
+            return letter - 'a';
+        }
+        else if (letter >= 'A' && letter <= 'Z')
+        {
+            return letter - 'A';
+        }
+        return -1;
+    }
+
+    /// Start of the command line.
+    const char *line_{nullptr};
+
+    /// Offset of the command word within @ref line_.
+    uint16_t command_offset_{0};
+
+    /// Length of the command word.
+    uint16_t command_length_{0};
+
+    /// Length of the command line from the command word until the end of the
+    /// last word.
+    uint16_t line_length_{0};
+
+    /// Letter of the command word, always upper case.
+    char letter_{0};
+
+    /// Numeric code of the command word.
+    int32_t code_{0};
+
+    /// Bit mask of words that have a valid numeric value.
+    uint32_t present_{0};
+
+    /// Bit mask of words that have been seen, with or without a valid
+    /// numeric value.
+    uint32_t seen_{0};
+
+    /// Parsed words.
+    Word words_[MAX_WORDS];
+};
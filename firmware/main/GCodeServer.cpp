@@ -5,15 +5,19 @@
  */
 
 #include <asio.hpp>
+#include <cstring>
 #include <esp_netif.h>
 #include <esp_ota_ops.h>
+#include <esp_timer.h>
 #include <functional>
-#include <map>
-#include <queue>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <vector>
 #include "GCodeServer.hxx"
+#include "Latency.hxx"
+#include "Trace.hxx"
 #include "Utils.hxx"
 
 GCodeServer::GCodeServer(asio::io_context &context,
@@ -22,6 +26,8 @@ GCodeServer::GCodeServer(asio::io_context &context,
     : acceptor_(context, tcp::endpoint(tcp::v4(), port)),
       clientManager_(context)
 {
+    register_builtin_commands();
+
     auto endpoint = acceptor_.local_endpoint();
     ESP_LOGI(TAG, "Waiting for connections on " IPSTR ":%d...",
              IP2STR(&local_addr), endpoint.port());
@@ -31,7 +37,224 @@ GCodeServer::GCodeServer(asio::io_context &context,
 void GCodeServer::register_command(std::string const &command,
                                    command_handler &&method)
 {
-    dispatcher_.emplace(command, std::move(method));
+    if (command_entry *entry = get_entry(command); entry != nullptr)
+    {
+        entry->args_handler = std::move(method);
+    }
+}
+
+void GCodeServer::register_command(std::string const &command,
+                                   command_view_handler &&method)
+{
+    if (command_entry *entry = get_entry(command); entry != nullptr)
+    {
+        entry->view_handler = std::move(method);
+    }
+}
+
+void GCodeServer::register_async_command(std::string const &command,
+                                         command_async_handler &&method)
+{
+    if (command_entry *entry = get_entry(command); entry != nullptr)
+    {
+        entry->async_handler = std::move(method);
+    }
+}
+
+void GCodeServer::command_completion::operator()(
+    command_return_type response) const
+{
+    record_latency(LATENCY_RESPONSE, received_);
+
+    // Hand the response over to the client strand, if this is called from
+    // within the command handler the response will be queued immediately.
+    asio::dispatch(client_->strand_,
+        [client = client_, slot = slot_, response = std::move(response)]()
+        {
+            client->send_response(slot, response);
+        });
+}
+
+void GCodeServer::publish_events(std::string events)
+{
+    clientManager_.publish(std::move(events));
+}
+
+bool GCodeServer::has_event_subscribers() const
+{
+    return clientManager_.has_subscribers();
+}
+
+GCodeServer::command_entry *GCodeServer::get_entry(std::string const &command)
+{
+    GCodeCommand parsed;
+    command_entry *entry = nullptr;
+    if (parsed.parse(command.data(), command.length()))
+    {
+        entry = dispatcher_.insert(parsed.letter(), parsed.code());
+    }
+    if (entry == nullptr)
+    {
+        ESP_LOGE(TAG, "Unable to register command:%s", command.c_str());
+    }
+    return entry;
+}
+
+void GCodeServer::register_builtin_commands()
+{
+    // automatic discard of certain commands that are not implemented or
+    // needed with the feeder.
+    std::string not_implemented = COMMAND_OK;
+    not_implemented.append(" - not implemented\n");
+    dispatcher_.insert_default('G')->reply = not_implemented;
+    dispatcher_.insert('M', 82)->reply = not_implemented;
+    dispatcher_.insert('M', 204)->reply = not_implemented;
+    dispatcher_.insert('M', 400)->reply = not_implemented;
+
+    // M115 sends back firmware details, since these will not change at
+    // runtime the response is built only once.
+    // NOTE: For M115 the "ok" ACK should be on it's own line after the
+    // firmware details!
+    const esp_app_desc_t *app_data = esp_app_get_description();
+    std::string &firmware = dispatcher_.insert('M', 115)->reply;
+    firmware.reserve(128);
+    firmware.append(" ");
+    firmware.append("FIRMWARE_NAME:Esp32FeederController (");
+    firmware.append(app_data->version);
+    firmware.append(")\n");
+    firmware.append(COMMAND_OK);
+    firmware.append("\n");
+
+    if (command_entry *entry = get_entry(DEFERRED_RESPONSE_CMD);
+        entry != nullptr)
+    {
+        entry->client_method = &GCodeClient::configure_deferred;
+    }
+
+    if (command_entry *entry = get_entry(EVENT_SUBSCRIBE_CMD);
+        entry != nullptr)
+    {
+        entry->client_method = &GCodeClient::configure_events;
+    }
+
+    if (command_entry *entry = get_entry(LATENCY_REPORT_CMD);
+        entry != nullptr)
+    {
+        entry->view_handler = [](command_view)
+        {
+            return std::make_pair(true, format_latency());
+        };
+    }
+
+    if (command_entry *entry = get_entry(LATENCY_RESET_CMD);
+        entry != nullptr)
+    {
+        entry->view_handler = [](command_view)
+        {
+            reset_latency();
+            return std::make_pair(true, std::string());
+        };
+    }
+
+    if (command_entry *entry = get_entry(TRACE_DUMP_CMD);
+        entry != nullptr)
+    {
+        entry->view_handler = [](command_view args)
+        {
+            uint32_t count = TRACE_DUMP_DEFAULT_COUNT;
+            args.get('C', count);
+            return std::make_pair(true, format_trace(count));
+        };
+    }
+}
+
+GCodeServer::dispatcher_type::dispatcher_type()
+{
+    std::fill(std::begin(defaults_), std::end(defaults_), UNUSED_SLOT);
+}
+
+uint8_t GCodeServer::dispatcher_type::allocate_entry()
+{
+    if (entries_.size() >= UNUSED_SLOT)
+    {
+        return UNUSED_SLOT;
+    }
+    entries_.emplace_back();
+    return entries_.size() - 1;
+}
+
+GCodeServer::command_entry *
+GCodeServer::dispatcher_type::insert(char letter, int32_t code)
+{
+    if (!valid_code(code))
+    {
+        return nullptr;
+    }
+    const uint32_t key = make_key(letter, code);
+    for (std::size_t probe = 0; probe < TABLE_SIZE; probe++)
+    {
+        const std::size_t slot = (hash(key) + probe) & (TABLE_SIZE - 1);
+        if (keys_[slot] == key)
+        {
+            return &entries_[slots_[slot]];
+        }
+        else if (keys_[slot] == 0)
+        {
+            uint8_t index = allocate_entry();
+            if (index == UNUSED_SLOT)
+            {
+                return nullptr;
+            }
+            keys_[slot] = key;
+            slots_[slot] = index;
+            return &entries_[index];
+        }
+    }
+    return nullptr;
+}
+
+GCodeServer::command_entry *
+GCodeServer::dispatcher_type::insert_default(char letter)
+{
+    if (letter < 'A' || letter > 'Z')
+    {
+        return nullptr;
+    }
+    uint8_t &index = defaults_[letter - 'A'];
+    if (index == UNUSED_SLOT)
+    {
+        index = allocate_entry();
+        if (index == UNUSED_SLOT)
+        {
+            return nullptr;
+        }
+    }
+    return &entries_[index];
+}
+
+const GCodeServer::command_entry *
+GCodeServer::dispatcher_type::find(char letter, int32_t code) const
+{
+    const uint32_t key = make_key(letter, code);
+    for (std::size_t probe = 0; valid_code(code) && probe < TABLE_SIZE;
+         probe++)
+    {
+        const std::size_t slot = (hash(key) + probe) & (TABLE_SIZE - 1);
+        if (keys_[slot] == key)
+        {
+            return &entries_[slots_[slot]];
+        }
+        else if (keys_[slot] == 0)
+        {
+            break;
+        }
+    }
+    if (letter >= 'A' && letter <= 'Z' &&
+        defaults_[letter - 'A'] != UNUSED_SLOT)
+    {
+        return &entries_[defaults_[letter - 'A']];
+    }
+    return nullptr;
 }
 
 void GCodeServer::do_accept()
@@ -43,6 +266,16 @@ void GCodeServer::do_accept()
             {
                 auto peer = socket.remote_endpoint().address().to_string();
                 ESP_LOGI(TAG, "New client:%s", peer.c_str());
+
+                // Responses are small and latency sensitive, disable Nagle's
+                // algorithm so they are sent immediately.
+                asio::error_code ec;
+                socket.set_option(tcp::no_delay(true), ec);
+                if (ec)
+                {
+                    ESP_LOGW(TAG, "[%s] Unable to set TCP_NODELAY: %s (%d)",
+                             peer.c_str(), ec.message().c_str(), ec.value());
+                }
                 clientManager_.start(
                     std::make_shared<GCodeClient>(std::move(socket),
                                                   clientManager_,
@@ -68,10 +301,37 @@ void GCodeServer::GCodeClientManager::start(std::shared_ptr<GCodeClient> client)
 
 void GCodeServer::GCodeClientManager::stop(std::shared_ptr<GCodeClient> client)
 {
+    subscribe(client, false);
     clients_.erase(client);
     client->stop();
 }
 
+void GCodeServer::GCodeClientManager::subscribe(
+    std::shared_ptr<GCodeClient> client, bool subscribed)
+{
+    const std::lock_guard<std::mutex> lock(subscribers_mux_);
+    if (subscribed)
+    {
+        subscribers_.insert(client);
+    }
+    else
+    {
+        subscribers_.erase(client);
+    }
+    subscriber_count_.store(subscribers_.size(), std::memory_order_relaxed);
+}
+
+void GCodeServer::GCodeClientManager::publish(std::string events)
+{
+    // The events are shared by all subscribers rather than copied for each.
+    auto shared = std::make_shared<const std::string>(std::move(events));
+    const std::lock_guard<std::mutex> lock(subscribers_mux_);
+    for (auto &client : subscribers_)
+    {
+        client->queue_events(shared);
+    }
+}
+
 void GCodeServer::GCodeClientManager::report_client_count(const asio::error_code &ec)
 {
     if (!ec)
@@ -86,8 +346,8 @@ void GCodeServer::GCodeClientManager::report_client_count(const asio::error_code
 
 GCodeServer::GCodeClient::GCodeClient(tcp::socket &&socket,
                                       GCodeClientManager &manager,
-                                      dispatcher_type dispatcher)
-    : socket_(std::move(socket)),
+                                      const dispatcher_type &dispatcher)
+    : socket_(std::move(socket)), strand_(socket_.get_executor()),
       manager_(manager), dispatcher_(dispatcher),
       peer_(socket_.remote_endpoint().address().to_string())
 {
@@ -107,34 +367,60 @@ void GCodeServer::GCodeClient::stop()
 void GCodeServer::GCodeClient::read()
 {
     ESP_LOGD(CLIENT_TAG, "[%s] Waiting for data", peer_.c_str());
+    reading_ = true;
     asio::async_read_until(socket_, streambuf_, EOL,
-                           std::bind(&GCodeClient::on_read, shared_from_this(),
-                                     std::placeholders::_1, std::placeholders::_2));
+        asio::bind_executor(strand_,
+            std::bind(&GCodeClient::on_read, shared_from_this(),
+                      std::placeholders::_1, std::placeholders::_2)));
 }
 
 void GCodeServer::GCodeClient::write()
 {
-    ESP_LOGD(CLIENT_TAG, "[%s] Sending:%s", peer_.c_str(), outgoing_.front().c_str());
-    asio::async_write(socket_, asio::buffer(outgoing_.front()),
-                      std::bind(&GCodeClient::on_write, shared_from_this(),
-                                std::placeholders::_1, std::placeholders::_2));
+    // Gather all responses that are ready to be sent into a single write,
+    // responses that become ready while this write is pending will be sent as
+    // part of the next write.
+    write_count_ = 0;
+    for (uint32_t slot = response_head_;
+         slot != response_tail_ &&
+            responses_[slot % MAX_PENDING_RESPONSES].ready;
+         slot++)
+    {
+        auto const &reply = responses_[slot % MAX_PENDING_RESPONSES].reply;
+        ESP_LOGD(CLIENT_TAG, "[%s] Sending:%s", peer_.c_str(), reply.c_str());
+        write_buffers_[write_count_++] = asio::buffer(reply);
+    }
+    std::size_t buffer_count = write_count_;
+
+    // Events are sent after the responses, the pending events are swapped
+    // out so that new events can be queued while this write is pending.
+    if (!events_.empty())
+    {
+        std::swap(events_, events_sending_);
+        write_buffers_[buffer_count++] = asio::buffer(events_sending_);
+    }
+    writing_ = true;
+    asio::async_write(socket_,
+        buffer_range{write_buffers_.data(), write_buffers_.data() + buffer_count},
+        asio::bind_executor(strand_,
+            std::bind(&GCodeClient::on_write, shared_from_this(),
+                      std::placeholders::_1, std::placeholders::_2)));
+}
+
+bool GCodeServer::GCodeClient::write_ready() const
+{
+    return !events_.empty() ||
+           (response_head_ != response_tail_ &&
+            responses_[response_head_ % MAX_PENDING_RESPONSES].ready);
 }
 
 void GCodeServer::GCodeClient::on_read(asio::error_code error, std::size_t size)
 {
+    reading_ = false;
     if (!error)
     {
-        std::istream stream(&streambuf_);
-        std::string line;
-        std::getline(stream, line);
-        streambuf_.consume(size);
-
-        string_trim(line);
-        if (!line.empty())
-        {
-            ESP_LOGD(CLIENT_TAG, "[%s] Received:%s", peer_.c_str(), line.c_str());
-            process_line(line);
-        }
+        received_ = esp_timer_get_time();
+        ESP_LOGD(CLIENT_TAG, "[%s] Received %zu bytes", peer_.c_str(), size);
+        process_buffered_lines();
     }
     else if (error != asio::error::operation_aborted)
     {
@@ -146,18 +432,31 @@ void GCodeServer::GCodeClient::on_read(asio::error_code error, std::size_t size)
 
 void GCodeServer::GCodeClient::on_write(asio::error_code error, std::size_t size)
 {
+    writing_ = false;
     if (!error)
     {
-        ESP_LOGD(CLIENT_TAG, "[%s] Write successful", peer_.c_str());
-        outgoing_.pop();
+        ESP_LOGD(CLIENT_TAG, "[%s] Wrote %zu responses", peer_.c_str(),
+                 write_count_);
+        for (; write_count_ > 0; write_count_--)
+        {
+            auto &reply = responses_[response_head_ % MAX_PENDING_RESPONSES];
+            reply.ready = false;
+            reply.reply.clear();
+            response_head_++;
+        }
+        events_sending_.clear();
 
-        if (!outgoing_.empty())
+        // Send the next batch of responses (and events) if they are ready.
+        if (write_ready())
         {
             write();
         }
-        else
+
+        // If reading was paused due to the pending response limit being
+        // reached, resume processing now that a response slot is free.
+        if (!reading_)
         {
-            read();
+            process_buffered_lines();
         }
     }
     else if (error != asio::error::operation_aborted)
@@ -168,64 +467,202 @@ void GCodeServer::GCodeClient::on_write(asio::error_code error, std::size_t size
     }
 }
 
-void GCodeServer::GCodeClient::process_line(std::string &line)
+void GCodeServer::GCodeClient::process_buffered_lines()
 {
-    std::vector<std::string> args;
-    // break the string on the first ; character
-    tokenize(break_string(line, ";").first, args);
-    std::string command = std::move(args[0]);
-    args.erase(args.begin());
+    // Process all complete lines that have been received, the streambuf
+    // storage is contiguous so the lines are processed in place rather than
+    // copying them out.
+    while (response_tail_ - response_head_ < MAX_PENDING_RESPONSES &&
+           socket_.is_open())
+    {
+        auto data = streambuf_.data();
+        const char *line = static_cast<const char *>(data.data());
+        const char *eol =
+            static_cast<const char *>(memchr(line, EOL, data.size()));
+        if (eol == nullptr)
+        {
+            break;
+        }
+        // include the EOL character in the line length so it is consumed
+        // from the streambuf.
+        std::size_t length = (eol - line) + 1;
+        process_line(line, length);
+        streambuf_.consume(length);
+    }
+
+    // Continue reading as long as there is space for more responses,
+    // otherwise reading will resume when a response has been sent.
+    if (response_tail_ - response_head_ < MAX_PENDING_RESPONSES &&
+        socket_.is_open())
+    {
+        read();
+    }
+    else
+    {
+        ESP_LOGD(CLIENT_TAG, "[%s] Pending response limit reached",
+                 peer_.c_str());
+    }
+}
+
+bool GCodeServer::GCodeClient::process_line(const char *line,
+                                            std::size_t length)
+{
+    if (!command_.parse(line, length))
+    {
+        return false;
+    }
 
+    std::string_view command = command_.command();
     std::string reply;
 
-    ESP_LOGI(CLIENT_TAG, "[%s] Command:%s", peer_.c_str(), command.c_str());
+    // Reserve the response slot for this command, responses are always sent
+    // in the order the commands were received.
+    const uint32_t slot = response_tail_++;
+    responses_[slot % MAX_PENDING_RESPONSES].ready = false;
 
-    if (auto it = dispatcher_.find(command); it != dispatcher_.cend())
-    {
-        ESP_LOGD(CLIENT_TAG, "[%s] Found command:%s", peer_.c_str(), command.c_str());
-        auto const &method = it->second;
+    trace(TRACE_COMMAND, TRACE_NO_FEEDER, command_.letter(), command_.code());
 
-        auto response = method(args);
-        reply = response.first ? COMMAND_OK : COMMAND_ERROR;
-        reply.reserve(response.second.length() + reply.length() + 2);
-        reply.append(" ");
-        reply.append(response.second);
+    if (auto entry = dispatcher_.find(command_.letter(), command_.code());
+        entry == nullptr)
+    {
+        reply = COMMAND_OK;
+        reply.append(" - invalid command token: ").append(command);
+        reply.append("\n");
+        queue_reply(slot, std::move(reply));
     }
-    else
+    else if (entry->async_handler)
+    {
+        ESP_LOGD(CLIENT_TAG, "[%s] Found async command:%.*s", peer_.c_str(),
+                 static_cast<int>(command.length()), command.data());
+        // The response will be queued when the command completes.
+        entry->async_handler(command_,
+                             command_completion(shared_from_this(), slot,
+                                                deferred_, received_));
+    }
+    else if (entry->client_method)
+    {
+        send_response(slot, (this->*(entry->client_method))(command_));
+    }
+    else if (entry->view_handler || entry->args_handler)
     {
-        if (command.at(0) == 'G' || command == "M82" ||
-            command == "M204" || command == "M400")
+        ESP_LOGD(CLIENT_TAG, "[%s] Found command:%.*s", peer_.c_str(),
+                 static_cast<int>(command.length()), command.data());
+        if (entry->view_handler)
         {
-            // automatic discard of certain commands that are not implemented
-            // or needed with the feeder.
-            reply = COMMAND_OK;
-            reply.append(" - not implemented");
-        }
-        else if (command == "M115")
-        {
-            // If the command is M115 send back firmware details.
-            // NOTE: For M115 the "ok" ACK should be on it's own line after the
-            // firmware details!
-            const esp_app_desc_t *app_data = esp_app_get_description();
-            reply.reserve(128);
-            reply.append(" ");
-            reply.append("FIRMWARE_NAME:Esp32FeederController (");
-            reply.append(app_data->version);
-            reply.append(")\n");
-            reply.append(COMMAND_OK);
-
+            send_response(slot, entry->view_handler(command_));
         }
         else
         {
-            reply = COMMAND_OK;
-            reply.append(" - invalid command token: ").append(command);
+            std::vector<std::string> args;
+            tokenize(std::string(command_.line()), args, " ", true, true);
+            args.erase(args.begin());
+            send_response(slot, entry->args_handler(args));
+        }
+    }
+    else
+    {
+        queue_reply(slot, entry->reply);
+    }
+    record_latency(LATENCY_DISPATCH, received_);
+    return true;
+}
+
+GCodeServer::command_return_type
+GCodeServer::GCodeClient::configure_deferred(command_view args)
+{
+    int8_t enabled = 0;
+    if (args.get('S', enabled))
+    {
+        deferred_ = enabled;
+        ESP_LOGI(CLIENT_TAG, "[%s] Deferred responses %s", peer_.c_str(),
+                 deferred_ ? "enabled" : "disabled");
+    }
+    return std::make_pair(true, deferred_ ? "S1" : "S0");
+}
+
+GCodeServer::command_return_type
+GCodeServer::GCodeClient::configure_events(command_view args)
+{
+    int8_t enabled = 0;
+    if (args.get('S', enabled))
+    {
+        subscribed_ = enabled;
+        if (!subscribed_)
+        {
+            events_.clear();
+            events_dropped_ = false;
         }
+        manager_.subscribe(shared_from_this(), subscribed_);
+        ESP_LOGI(CLIENT_TAG, "[%s] Feeder events %s", peer_.c_str(),
+                 subscribed_ ? "enabled" : "disabled");
     }
+    return std::make_pair(true, subscribed_ ? "S1" : "S0");
+}
+
+void GCodeServer::GCodeClient::queue_events(
+    std::shared_ptr<const std::string> events)
+{
+    asio::post(strand_,
+        [client = shared_from_this(), events = std::move(events)]()
+        {
+            // Events may still arrive shortly after the client has
+            // unsubscribed or disconnected.
+            if (!client->subscribed_ || !client->socket_.is_open())
+            {
+                return;
+            }
+            if (client->events_.size() + events->size() >
+                GCODE_EVENT_BUFFER_SIZE)
+            {
+                if (!client->events_dropped_)
+                {
+                    ESP_LOGW(CLIENT_TAG, "[%s] Event buffer full, dropping "
+                             "events", client->peer_.c_str());
+                }
+                client->events_dropped_ = true;
+                return;
+            }
+            // Let the client know that events were lost so it can request
+            // the current state of all feeders (M617).
+            if (client->events_dropped_)
+            {
+                client->events_.append(EVENT_OVERFLOW);
+                client->events_dropped_ = false;
+            }
+            client->events_.append(*events);
+            if (!client->writing_)
+            {
+                client->write();
+            }
+        });
+}
+
+void GCodeServer::GCodeClient::send_response(
+    uint32_t slot, const command_return_type &response)
+{
+    std::string reply = response.first ? COMMAND_OK : COMMAND_ERROR;
+    reply.reserve(response.second.length() + reply.length() + 2);
+    reply.append(" ");
+    reply.append(response.second);
     reply.append("\n");
-    outgoing_.push(reply);
+    queue_reply(slot, std::move(reply));
+}
+
+void GCodeServer::GCodeClient::queue_reply(uint32_t slot, std::string reply)
+{
+    // If the client has disconnected while a command was pending there is
+    // no need to send the response.
+    if (!socket_.is_open())
+    {
+        return;
+    }
+
+    auto &entry = responses_[slot % MAX_PENDING_RESPONSES];
+    entry.reply = std::move(reply);
+    entry.ready = true;
 
-    // If we have only one entry in the queue, send it now.
-    if (outgoing_.size() == 1)
+    // If this is the oldest pending response, send it now.
+    if (slot == response_head_ && !writing_)
     {
         write();
     }
@@ -6,30 +6,218 @@
 
 #pragma once
 
+#include <array>
 #include <asio.hpp>
+#include <atomic>
 #include <esp_netif.h>
 #include <functional>
-#include <map>
-#include <queue>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <vector>
 
+#include "config.hxx"
+#include "GCodeCommand.hxx"
+
 class GCodeServer
 {
+    // Forward declaration of client class
+    class GCodeClient;
+
 public:
 
     using command_args = std::vector<std::string> const &;
+    using command_view = GCodeCommand const &;
     using command_return_type = std::pair<bool, std::string>;
 
+    /// Completion token provided to asynchronous command handlers.
+    ///
+    /// The response to the command is queued for the client only when this
+    /// is invoked, it must be invoked exactly once and can be invoked from
+    /// any thread.
+    class command_completion
+    {
+    public:
+        /// @return true if the client has requested that responses are sent
+        /// only after the command has fully completed (ie: feeder movement has
+        /// finished), false if the response should be sent as soon as the
+        /// command has been accepted.
+        bool deferred() const
+        {
+            return deferred_;
+        }
+
+        /// @return time (from esp_timer_get_time) at which the command was
+        /// received.
+        int64_t received() const
+        {
+            return received_;
+        }
+
+        /// Queues the response to the command for the client.
+        ///
+        /// @param response Response to send.
+        void operator()(command_return_type response) const;
+
+    private:
+        friend class GCodeClient;
+
+        /// Constructor.
+        ///
+        /// @param client @ref GCodeClient that received the command.
+        /// @param slot Response slot reserved for the command.
+        /// @param deferred Value to return from @ref deferred.
+        /// @param received Value to return from @ref received.
+        command_completion(std::shared_ptr<GCodeClient> client, uint32_t slot,
+                           bool deferred, int64_t received)
+            : client_(std::move(client)), slot_(slot), deferred_(deferred),
+              received_(received)
+        {
+        }
+
+        /// @ref GCodeClient that will receive the response.
+        std::shared_ptr<GCodeClient> client_;
+
+        /// Response slot reserved for the command.
+        uint32_t slot_;
+
+        /// Indicates the client has requested deferred responses.
+        bool deferred_;
+
+        /// Time at which the command was received.
+        int64_t received_;
+    };
+
 private:
     using tcp = asio::ip::tcp;
 
     /// Type used for the command handlers
     using command_handler = std::function<command_return_type(command_args)>;
 
-    /// Type for the command dispatcher collection.
-    using dispatcher_type = std::map<std::string, command_handler>;
+    /// Type used for the command handlers which receive the parsed command.
+    using command_view_handler =
+        std::function<command_return_type(command_view)>;
+
+    /// Type used for the command handlers which complete asynchronously.
+    using command_async_handler =
+        std::function<void(command_view, command_completion)>;
+
+    /// Type used for commands that are handled by the @ref GCodeClient.
+    using client_handler =
+        command_return_type (GCodeClient::*)(command_view);
+
+    /// Registered handler(s) for a single command.
+    struct command_entry
+    {
+        /// Handler which receives the tokenized arguments.
+        command_handler args_handler;
+
+        /// Handler which receives the parsed command.
+        command_view_handler view_handler;
+
+        /// Handler which receives the parsed command and completes
+        /// asynchronously.
+        command_async_handler async_handler;
+
+        /// Handler which is implemented by the @ref GCodeClient.
+        client_handler client_method{nullptr};
+
+        /// Pre-formatted response to send when there is no handler.
+        std::string reply;
+    };
+
+    /// Command dispatch table shared by all connected clients.
+    ///
+    /// Commands are keyed by their letter and numeric code (ie: "M610" is
+    /// stored as {'M', 610}) and located via an open-addressed hash table
+    /// so that dispatching does not require any string comparisons.
+    class dispatcher_type
+    {
+    public:
+        /// Constructor.
+        dispatcher_type();
+
+        /// Registers (or replaces) the entry for a command.
+        ///
+        /// @param letter Command letter, ie: 'M'.
+        /// @param code Command numeric code, ie: 610.
+        ///
+        /// @return @ref command_entry for the command or nullptr if the
+        /// table is full or @param code is not in the range 0-65535.
+        command_entry *insert(char letter, int32_t code);
+
+        /// Registers (or replaces) the entry used for any command with the
+        /// provided letter that does not have a specific entry.
+        ///
+        /// @param letter Command letter, ie: 'G'.
+        ///
+        /// @return @ref command_entry for the command letter or nullptr if
+        /// the letter is not valid.
+        command_entry *insert_default(char letter);
+
+        /// Locates the entry for a command.
+        ///
+        /// @param letter Command letter, ie: 'M'.
+        /// @param code Command numeric code, ie: 610.
+        ///
+        /// @return @ref command_entry for the command or nullptr if the
+        /// command has not been registered. A @param code outside the range
+        /// 0-65535 never matches a specific entry.
+        const command_entry *find(char letter, int32_t code) const;
+
+    private:
+        /// Number of bits used for the hash table index.
+        static constexpr std::size_t TABLE_BITS = 6;
+
+        /// Number of slots in the hash table, this should be at least double
+        /// the number of registered commands.
+        static constexpr std::size_t TABLE_SIZE = 1 << TABLE_BITS;
+
+        /// Marker for an unused @ref defaults_ slot.
+        static constexpr uint8_t UNUSED_SLOT = 0xFF;
+
+        /// Converts a command letter and code to a unique key.
+        ///
+        /// NOTE: @param code must be range checked by the caller via
+        /// @ref valid_code, wider values would alias other keys.
+        static constexpr uint32_t make_key(char letter, uint16_t code)
+        {
+            return (static_cast<uint32_t>(letter) << 16) | code;
+        }
+
+        /// @return true if @param code can be used with @ref make_key.
+        static constexpr bool valid_code(int32_t code)
+        {
+            return code >= 0 && code <= std::numeric_limits<uint16_t>::max();
+        }
+
+        /// Calculates the initial hash table slot for a key.
+        static constexpr std::size_t hash(uint32_t key)
+        {
+            return static_cast<uint32_t>(key * 2654435761UL) >>
+                (32 - TABLE_BITS);
+        }
+
+        /// Allocates a new @ref command_entry.
+        ///
+        /// @return index of the new entry in @ref entries_ or
+        /// @ref UNUSED_SLOT if no more entries can be allocated.
+        uint8_t allocate_entry();
+
+        /// Hash table of command keys, zero indicates an unused slot.
+        uint32_t keys_[TABLE_SIZE] = {0};
+
+        /// Index into @ref entries_ for each used slot of @ref keys_.
+        uint8_t slots_[TABLE_SIZE] = {0};
+
+        /// Index into @ref entries_ for the default entry of each letter.
+        uint8_t defaults_[26];
+
+        /// Registered command entries.
+        std::vector<command_entry> entries_;
+    };
 
 public:
 
@@ -37,9 +225,50 @@ public:
                 const esp_ip4_addr_t local_addr,
                 const uint16_t port = DEFAULT_PORT);
 
+    /// Registers a command handler which receives the tokenized arguments.
+    ///
+    /// @param command Command to register, ie: "M610".
+    /// @param method Handler to invoke for the command.
+    ///
+    /// NOTE: Tokenizing requires heap allocations for every invocation, the
+    /// @ref command_view_handler variant should be preferred.
     void register_command(std::string const &command,
                           command_handler &&method);
 
+    /// Registers a command handler which receives the parsed command.
+    ///
+    /// @param command Command to register, ie: "M610".
+    /// @param method Handler to invoke for the command.
+    ///
+    /// NOTE: The @ref GCodeCommand passed to @param method is only valid
+    /// for the duration of the call.
+    void register_command(std::string const &command,
+                          command_view_handler &&method);
+
+    /// Registers a command handler which completes asynchronously.
+    ///
+    /// @param command Command to register, ie: "M610".
+    /// @param method Handler to invoke for the command.
+    ///
+    /// NOTE: The @ref GCodeCommand passed to @param method is only valid
+    /// for the duration of the call, the @ref command_completion can be
+    /// retained until the command has completed. Commands received after this
+    /// command will continue to be processed but their responses will be held
+    /// until the @ref command_completion has been invoked.
+    void register_async_command(std::string const &command,
+                                command_async_handler &&method);
+
+    /// Sends feeder event lines to all clients which have subscribed to
+    /// events (M621).
+    ///
+    /// @param events One or more newline terminated event lines.
+    ///
+    /// NOTE: This can be called from any thread.
+    void publish_events(std::string events);
+
+    /// @return true if at least one client has subscribed to events (M621).
+    bool has_event_subscribers() const;
+
 private:
     /// Log tag to use for this class.
     static constexpr const char * const TAG = "gcode_server";
@@ -53,21 +282,47 @@ private:
     /// Prefix for responses that contain a failure.
     static constexpr const char * const COMMAND_ERROR = "error:";
 
+    /// Event line sent when events have been dropped for a client.
+    static constexpr const char * const EVENT_OVERFLOW = "event overflow\n";
+
+    /// Command ID for configuring deferred responses for a client.
+    static constexpr const char * const DEFERRED_RESPONSE_CMD = "M620";
+
+    /// Command ID for subscribing a client to feeder events.
+    static constexpr const char * const EVENT_SUBSCRIBE_CMD = "M621";
+
+    /// Command ID for reporting the command latency histograms.
+    static constexpr const char * const LATENCY_REPORT_CMD = "M622";
+
+    /// Command ID for resetting the command latency histograms.
+    static constexpr const char * const LATENCY_RESET_CMD = "M623";
+
+    /// Command ID for dumping the most recent trace records.
+    static constexpr const char * const TRACE_DUMP_CMD = "M625";
+
     GCodeServer(const GCodeServer &) = delete;
     GCodeServer &operator=(const GCodeServer &) = delete;
 
     /// TCP/IP listener that handles accepting new clients.
     tcp::acceptor acceptor_;
 
-    /// Collection of registered commands.
+    /// Collection of registered commands, shared by all clients.
     dispatcher_type dispatcher_;
 
+    /// Looks up (or creates) the @ref command_entry for a command.
+    ///
+    /// @param command Command to register, ie: "M610".
+    ///
+    /// @return @ref command_entry for the command or nullptr if the command
+    /// is not valid or can not be registered.
+    command_entry *get_entry(std::string const &command);
+
+    /// Registers the commands that are handled by the server itself.
+    void register_builtin_commands();
+
     /// Starts accepting client connections in an asynchronous manner.
     void do_accept();
 
-    // Forward declaration of client class
-    class GCodeClient;
-
     /// Lifecycle manager for @ref GCodeClient.
     class GCodeClientManager
     {
@@ -85,6 +340,23 @@ private:
         /// @param client @ref GCodeClient to stop and cleanup.
         void stop(std::shared_ptr<GCodeClient> client);
 
+        /// Adds or removes a @ref GCodeClient from the event subscribers.
+        ///
+        /// @param client @ref GCodeClient to add or remove.
+        /// @param subscribed When true the client will receive events.
+        void subscribe(std::shared_ptr<GCodeClient> client, bool subscribed);
+
+        /// Queues event lines for all subscribed clients.
+        ///
+        /// @param events One or more newline terminated event lines.
+        void publish(std::string events);
+
+        /// @return true if at least one client has subscribed to events.
+        bool has_subscribers() const
+        {
+            return subscriber_count_.load(std::memory_order_relaxed) != 0;
+        }
+
     private:
         /// Log tag to use for this class.
         static constexpr const char * const TAG = "gcode_client_mgr";
@@ -92,6 +364,17 @@ private:
         /// Collection of connected clients.
         std::set<std::shared_ptr<GCodeClient>> clients_;
 
+        /// Clients which have subscribed to events.
+        std::set<std::shared_ptr<GCodeClient>> subscribers_;
+
+        /// Protects @ref subscribers_, events are published from outside the
+        /// network context.
+        std::mutex subscribers_mux_;
+
+        /// Number of entries in @ref subscribers_, this allows event
+        /// producers to check for subscribers without locking.
+        std::atomic<std::size_t> subscriber_count_{0};
+
         /// Timer used for periodic reporting of client status.
         asio::system_timer timer_;
 
@@ -121,7 +404,7 @@ private:
         /// @param dispatcher Collection of commands that can be dispatched.
         GCodeClient(tcp::socket &&socket,
                     GCodeClientManager &manager,
-                    dispatcher_type dispatcher);
+                    const dispatcher_type &dispatcher);
 
         /// Starts this client.
         void start();
@@ -129,7 +412,38 @@ private:
         /// Stops this client.
         void stop();
 
+        /// Handles the request to configure deferred responses (M620).
+        ///
+        /// @param args Arguments to the command.
+        /// @return status of the request.
+        ///
+        /// Command format: M620 S{0|1}
+        ///
+        /// When enabled, commands that trigger feeder movement will not send
+        /// their response until the movement has completed.
+        command_return_type configure_deferred(command_view args);
+
+        /// Handles the request to subscribe to feeder events (M621).
+        ///
+        /// @param args Arguments to the command.
+        /// @return status of the request.
+        ///
+        /// Command format: M621 S{0|1}
+        ///
+        /// When enabled, feeder state changes are sent to the client as
+        /// unsolicited event lines.
+        command_return_type configure_events(command_view args);
+
+        /// Queues event lines to be sent to the remote client.
+        ///
+        /// @param events One or more newline terminated event lines.
+        ///
+        /// NOTE: This can be called from any thread.
+        void queue_events(std::shared_ptr<const std::string> events);
+
     private:
+        friend class command_completion;
+
         /// Log tag to use for this class.
         static constexpr const char *CLIENT_TAG = "gcode_client";
 
@@ -139,11 +453,14 @@ private:
         /// Socket connected to the remote peer.
         tcp::socket socket_;
 
+        /// Strand used to serialize all operations for this client.
+        asio::strand<tcp::socket::executor_type> strand_;
+
         /// Client Manager.
         GCodeClientManager &manager_;
 
         /// Collection of supported commands.
-        dispatcher_type dispatcher_;
+        const dispatcher_type &dispatcher_;
 
         /// String format of the remote peer's address.
         std::string peer_;
@@ -151,8 +468,87 @@ private:
         /// Buffer to use for receiving data from the peer.
         asio::streambuf streambuf_;
 
-        /// Queue used for outbound responses to the peer.
-        std::queue<std::string> outgoing_;
+        /// Response to a single command.
+        struct response_slot
+        {
+            /// Formatted response to send.
+            std::string reply;
+
+            /// When true @ref reply is ready to be sent.
+            bool ready{false};
+        };
+
+        /// Maximum number of commands that can be awaiting a response, once
+        /// reached no further commands will be read until a response has been
+        /// sent.
+        static constexpr std::size_t MAX_PENDING_RESPONSES =
+            GCODE_MAX_PIPELINED_COMMANDS;
+
+        /// Ring of outbound responses to the peer, indexed by the slot number
+        /// modulo @ref MAX_PENDING_RESPONSES.
+        std::array<response_slot, MAX_PENDING_RESPONSES> responses_;
+
+        /// Slot number of the oldest response that has not been sent.
+        uint32_t response_head_{0};
+
+        /// Slot number to assign to the next command.
+        uint32_t response_tail_{0};
+
+        /// Lightweight buffer sequence referencing a portion of
+        /// @ref write_buffers_, this avoids copying the full array into the
+        /// pending write operation.
+        struct buffer_range
+        {
+            const asio::const_buffer *begin_;
+            const asio::const_buffer *end_;
+
+            const asio::const_buffer *begin() const
+            {
+                return begin_;
+            }
+
+            const asio::const_buffer *end() const
+            {
+                return end_;
+            }
+        };
+
+        /// Buffers for the responses (and events) included in the pending
+        /// write.
+        std::array<asio::const_buffer, MAX_PENDING_RESPONSES + 1>
+            write_buffers_;
+
+        /// Number of responses included in the pending write.
+        std::size_t write_count_{0};
+
+        /// When true a read operation is pending.
+        bool reading_{false};
+
+        /// When true a write operation is pending.
+        bool writing_{false};
+
+        /// Parsed form of the command line currently being processed.
+        GCodeCommand command_;
+
+        /// When true, responses to asynchronous commands are deferred until
+        /// the command has completed.
+        bool deferred_{false};
+
+        /// When true, feeder events are sent to the client.
+        bool subscribed_{false};
+
+        /// When true, events have been dropped since they were last queued.
+        bool events_dropped_{false};
+
+        /// Event lines which have not yet been sent.
+        std::string events_;
+
+        /// Event lines included in the pending write.
+        std::string events_sending_;
+
+        /// Time (from esp_timer_get_time) at which the most recent data was
+        /// received, used as the arrival time of the buffered commands.
+        int64_t received_{0};
 
         /// Utility function that starts (or restarts) a read operation on the
         /// connected remote client.
@@ -162,6 +558,9 @@ private:
         /// remote client.
         void write();
 
+        /// @return true if there is a response or event ready to be sent.
+        bool write_ready() const;
+
         /// Callback for read completion.
         ///
         /// @param error When non-zero an error occurred, otherwise the read
@@ -176,9 +575,31 @@ private:
         /// @param size Number of bytes sent to the remote client.
         void on_write(asio::error_code error, std::size_t size);
 
+        /// Processes all complete command lines that have been received and
+        /// resumes reading when there is space for more responses.
+        void process_buffered_lines();
+
         /// Processes a single command line received from the remote client.
         ///
-        /// @param line Command line received.
-        void process_line(std::string &line);
+        /// @param line Command line received, this does not need to be null
+        /// terminated.
+        /// @param length Number of characters in @param line.
+        ///
+        /// @return true if a response has been (or will be) queued, false if
+        /// the line did not contain a command.
+        bool process_line(const char *line, std::size_t length);
+
+        /// Formats and queues a command response to be sent to the remote
+        /// client.
+        ///
+        /// @param slot Response slot reserved for the command.
+        /// @param response Response to send.
+        void send_response(uint32_t slot, const command_return_type &response);
+
+        /// Queues a fully formatted response to be sent to the remote client.
+        ///
+        /// @param slot Response slot reserved for the command.
+        /// @param reply Response to send.
+        void queue_reply(uint32_t slot, std::string reply);
     };
 };
\ No newline at end of file
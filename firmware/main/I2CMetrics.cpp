@@ -0,0 +1,205 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "I2CMetrics.hxx"
+
+void I2CMetrics::record_lock_wait(int64_t wait_us)
+{
+    const uint32_t wait = std::clamp<int64_t>(wait_us, 0, UINT32_MAX);
+    wait_us_.fetch_add(wait, std::memory_order_relaxed);
+    uint32_t max = max_wait_us_.load(std::memory_order_relaxed);
+    while (wait > max &&
+           !max_wait_us_.compare_exchange_weak(max, wait,
+                                               std::memory_order_relaxed))
+    {
+    }
+}
+
+void I2CMetrics::record_transfer(int64_t hold_us, esp_err_t result)
+{
+    transfers_.fetch_add(1, std::memory_order_relaxed);
+    hold_us_.fetch_add(std::max<int64_t>(hold_us, 0),
+                       std::memory_order_relaxed);
+    if (result == ESP_FAIL)
+    {
+        naks_.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if (result == ESP_ERR_TIMEOUT)
+    {
+        timeouts_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void I2CMetrics::record_retry(esp_err_t result)
+{
+    // only failures counted by record_transfer can be excluded.
+    if (result == ESP_FAIL || result == ESP_ERR_TIMEOUT)
+    {
+        retries_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void I2CMetrics::record_device(uint8_t addr, std::size_t length,
+                               esp_err_t result)
+{
+    if (result == ESP_OK)
+    {
+        bytes_.fetch_add(length, std::memory_order_relaxed);
+    }
+    device_t *device = find_device(addr, result == ESP_OK);
+    if (device == nullptr)
+    {
+        return;
+    }
+    device->transactions.fetch_add(1, std::memory_order_relaxed);
+    if (result == ESP_OK)
+    {
+        device->bytes.fetch_add(length, std::memory_order_relaxed);
+    }
+    else if (result == ESP_FAIL)
+    {
+        device->naks.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if (result == ESP_ERR_TIMEOUT)
+    {
+        device->timeouts.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void I2CMetrics::record_clock(uint32_t clock_hz)
+{
+    clock_hz_.store(clock_hz, std::memory_order_relaxed);
+}
+
+void I2CMetrics::reset()
+{
+    transfers_.store(0, std::memory_order_relaxed);
+    bytes_.store(0, std::memory_order_relaxed);
+    naks_.store(0, std::memory_order_relaxed);
+    timeouts_.store(0, std::memory_order_relaxed);
+    retries_.store(0, std::memory_order_relaxed);
+    hold_us_.store(0, std::memory_order_relaxed);
+    wait_us_.store(0, std::memory_order_relaxed);
+    max_wait_us_.store(0, std::memory_order_relaxed);
+    // the device addresses are retained so that the devices remain in the
+    // same order.
+    for (auto &device : devices_)
+    {
+        device.transactions.store(0, std::memory_order_relaxed);
+        device.bytes.store(0, std::memory_order_relaxed);
+        device.naks.store(0, std::memory_order_relaxed);
+        device.timeouts.store(0, std::memory_order_relaxed);
+    }
+    reset_us_.store(esp_timer_get_time(), std::memory_order_relaxed);
+}
+
+void I2CMetrics::format(int port, std::string &out) const
+{
+    char line[160];
+    const int64_t elapsed =
+        esp_timer_get_time() - reset_us_.load(std::memory_order_relaxed);
+    const uint64_t hold = hold_us_.load(std::memory_order_relaxed);
+    const uint32_t util = utilization(hold, elapsed);
+    snprintf(line, sizeof(line),
+             "port:%d clock=%" PRIu32 "Hz transfers=%" PRIu32 " bytes=%" PRIu32
+             " naks=%" PRIu32 " timeouts=%" PRIu32 " hold=%" PRIu64
+             "us wait=%" PRIu64 "us max_wait=%" PRIu32 "us util=%" PRIu32
+             ".%" PRIu32 "%%",
+             port, clock_hz_.load(std::memory_order_relaxed),
+             transfers_.load(std::memory_order_relaxed),
+             bytes_.load(std::memory_order_relaxed),
+             naks_.load(std::memory_order_relaxed),
+             timeouts_.load(std::memory_order_relaxed), hold,
+             wait_us_.load(std::memory_order_relaxed),
+             max_wait_us_.load(std::memory_order_relaxed), util / 10,
+             util % 10);
+    out.append(line);
+    for (auto &device : devices_)
+    {
+        const uint8_t addr = device.addr.load(std::memory_order_relaxed);
+        if (!addr)
+        {
+            continue;
+        }
+        snprintf(line, sizeof(line),
+                 "\nport:%d addr:0x%02X transactions=%" PRIu32
+                 " bytes=%" PRIu32 " naks=%" PRIu32 " timeouts=%" PRIu32,
+                 port, addr,
+                 device.transactions.load(std::memory_order_relaxed),
+                 device.bytes.load(std::memory_order_relaxed),
+                 device.naks.load(std::memory_order_relaxed),
+                 device.timeouts.load(std::memory_order_relaxed));
+        out.append(line);
+    }
+}
+
+void I2CMetrics::log(int port)
+{
+    const int64_t now = esp_timer_get_time();
+    const uint64_t hold = hold_us_.load(std::memory_order_relaxed);
+    // the counters may have been reset since the previous call.
+    const uint64_t interval_hold = hold >= log_hold_us_ ? hold - log_hold_us_
+                                                        : hold;
+    const uint32_t util = utilization(interval_hold, now - log_us_);
+    log_us_ = now;
+    log_hold_us_ = hold;
+
+    ESP_LOGI(TAG,
+             "[port:%d] clock:%" PRIu32 "Hz, transfers:%" PRIu32
+             ", bytes:%" PRIu32 ", naks:%" PRIu32 ", timeouts:%" PRIu32
+             ", max wait:%" PRIu32 "us, utilization:%" PRIu32 ".%" PRIu32
+             "%%", port, clock_hz_.load(std::memory_order_relaxed),
+             transfers_.load(std::memory_order_relaxed),
+             bytes_.load(std::memory_order_relaxed),
+             naks_.load(std::memory_order_relaxed),
+             timeouts_.load(std::memory_order_relaxed),
+             max_wait_us_.load(std::memory_order_relaxed), util / 10,
+             util % 10);
+}
+
+I2CMetrics::device_t *I2CMetrics::find_device(uint8_t addr, bool allocate)
+{
+    for (auto &device : devices_)
+    {
+        uint8_t current = device.addr.load(std::memory_order_relaxed);
+        if (current == addr)
+        {
+            return &device;
+        }
+        if (!current && allocate)
+        {
+            // another thread may claim the entry first, in which case it may
+            // have claimed it for the same device.
+            if (device.addr.compare_exchange_strong(current, addr,
+                                                    std::memory_order_relaxed) ||
+                current == addr)
+            {
+                return &device;
+            }
+        }
+        else if (!current)
+        {
+            // entries are claimed in order, the device is not tracked.
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+uint32_t I2CMetrics::utilization(uint64_t hold_us, int64_t elapsed_us)
+{
+    if (elapsed_us <= 0)
+    {
+        return 0;
+    }
+    return std::min<uint64_t>((hold_us * 1000) / elapsed_us, 1000);
+}
@@ -0,0 +1,181 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <esp_err.h>
+#include <string>
+
+#include "config.hxx"
+
+/// Usage counters for a single I2C bus and the devices connected to it.
+///
+/// All counters are updated with relaxed atomic operations so that they can
+/// be recorded from the bus thread and read from any other thread without
+/// additional locking.
+class I2CMetrics
+{
+public:
+    /// Records the time spent waiting for the bus lock.
+    ///
+    /// @param wait_us Number of microseconds spent waiting.
+    void record_lock_wait(int64_t wait_us);
+
+    /// Records a single bus transfer (command link execution).
+    ///
+    /// @param hold_us Number of microseconds the bus was held.
+    /// @param result Result of the transfer.
+    void record_transfer(int64_t hold_us, esp_err_t result);
+
+    /// Records that a failed transfer combining several transactions is
+    /// being retried one transaction at a time, the combined transfer is then
+    /// excluded from @ref transfers and @ref failures so that the retries do
+    /// not count the same failure twice.
+    ///
+    /// @param result Result of the combined transfer.
+    void record_retry(esp_err_t result);
+
+    /// Records a transaction with a single device.
+    ///
+    /// @param addr I2C device address.
+    /// @param length Number of data bytes transferred.
+    /// @param result Result of the transaction.
+    ///
+    /// NOTE: Devices are tracked once they have completed a transaction
+    /// successfully so that probing for absent devices does not consume the
+    /// device table, failures for untracked devices are only counted for the
+    /// bus.
+    void record_device(uint8_t addr, std::size_t length, esp_err_t result);
+
+    /// Records the clock speed of the bus.
+    ///
+    /// @param clock_hz Clock speed in Hz.
+    void record_clock(uint32_t clock_hz);
+
+    /// @return clock speed of the bus in Hz.
+    uint32_t clock() const
+    {
+        return clock_hz_.load(std::memory_order_relaxed);
+    }
+
+    /// @return number of bus transfers since the counters were last reset,
+    /// excluding combined transfers which were retried.
+    uint32_t transfers() const
+    {
+        return transfers_.load(std::memory_order_relaxed) -
+               retries_.load(std::memory_order_relaxed);
+    }
+
+    /// @return number of bus transfers that were not acknowledged or timed
+    /// out since the counters were last reset, excluding combined transfers
+    /// which were retried.
+    uint32_t failures() const
+    {
+        return naks_.load(std::memory_order_relaxed) +
+               timeouts_.load(std::memory_order_relaxed) -
+               retries_.load(std::memory_order_relaxed);
+    }
+
+    /// Discards all recorded counters, the clock speed is retained.
+    void reset();
+
+    /// Formats the bus and device counters.
+    ///
+    /// @param port I2C port to report the counters as.
+    /// @param out Buffer to append the counters to, one line for the bus
+    /// followed by one line per device.
+    ///
+    /// Bus utilization is reported since the counters were last reset.
+    void format(int port, std::string &out) const;
+
+    /// Logs the bus counters and the bus utilization since the previous call.
+    ///
+    /// @param port I2C port to report the counters as.
+    void log(int port);
+
+private:
+    /// Log tag to use for this class.
+    static constexpr const char *const TAG = "i2c_metrics";
+
+    /// Counters for a single device.
+    struct device_t
+    {
+        /// I2C device address, zero when the entry is not in use.
+        std::atomic<uint8_t> addr{0};
+
+        /// Number of transactions.
+        std::atomic<uint32_t> transactions{0};
+
+        /// Number of data bytes transferred.
+        std::atomic<uint32_t> bytes{0};
+
+        /// Number of transactions that were not acknowledged.
+        std::atomic<uint32_t> naks{0};
+
+        /// Number of transactions that timed out.
+        std::atomic<uint32_t> timeouts{0};
+    };
+
+    /// Number of bus transfers.
+    std::atomic<uint32_t> transfers_{0};
+
+    /// Number of data bytes transferred.
+    std::atomic<uint32_t> bytes_{0};
+
+    /// Number of transfers that were not acknowledged.
+    std::atomic<uint32_t> naks_{0};
+
+    /// Number of transfers that timed out.
+    std::atomic<uint32_t> timeouts_{0};
+
+    /// Number of failed combined transfers that were retried, these are
+    /// included in @ref naks_ or @ref timeouts_.
+    std::atomic<uint32_t> retries_{0};
+
+    /// Cumulative time the bus was held, in microseconds.
+    std::atomic<uint64_t> hold_us_{0};
+
+    /// Cumulative time spent waiting for the bus lock, in microseconds.
+    std::atomic<uint64_t> wait_us_{0};
+
+    /// Longest time spent waiting for the bus lock, in microseconds.
+    std::atomic<uint32_t> max_wait_us_{0};
+
+    /// Clock speed of the bus in Hz.
+    std::atomic<uint32_t> clock_hz_{0};
+
+    /// Time (from esp_timer_get_time) at which the counters were last reset.
+    std::atomic<int64_t> reset_us_{0};
+
+    /// Time (from esp_timer_get_time) of the previous @ref log call.
+    int64_t log_us_{0};
+
+    /// Value of @ref hold_us_ at the previous @ref log call.
+    uint64_t log_hold_us_{0};
+
+    /// Per device counters.
+    device_t devices_[I2C_METRICS_MAX_DEVICES];
+
+    /// Locates (or allocates) the counters for a device.
+    ///
+    /// @param addr I2C device address.
+    /// @param allocate When true an unused entry will be claimed for the
+    /// device if it is not already tracked.
+    ///
+    /// @return @ref device_t for the device or nullptr if the device is not
+    /// tracked.
+    device_t *find_device(uint8_t addr, bool allocate);
+
+    /// Calculates the percentage of time the bus was held.
+    ///
+    /// @param hold_us Number of microseconds the bus was held.
+    /// @param elapsed_us Number of microseconds elapsed.
+    ///
+    /// @return utilization in tenths of a percent.
+    static uint32_t utilization(uint64_t hold_us, int64_t elapsed_us);
+};
@@ -0,0 +1,212 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#include <cstring>
+#include <esp_log.h>
+#include <esp_pthread.h>
+#include <string>
+
+#include "I2CQueue.hxx"
+
+I2CQueue::I2CQueue(I2C_t &i2c, asio::io_context &context)
+    : i2c_(i2c), context_(context)
+{
+    // std::thread does not expose options for thread name, stack size or
+    // pinning to a core. ESP-IDF provides a pthread extension for this which
+    // must be called prior to thread creation.
+    auto cfg = esp_pthread_get_default_config();
+    std::string name = "i2c-";
+    name.append(std::to_string(i2c_.getPort()));
+    cfg.thread_name = name.c_str();
+    cfg.pin_to_core = I2C_QUEUE_CORE;
+    cfg.prio = I2C_QUEUE_PRIORITY;
+    esp_pthread_set_cfg(&cfg);
+    thread_ = std::thread(&I2CQueue::run, this);
+
+    // restore the default configuration for any threads created later.
+    cfg = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&cfg);
+}
+
+I2CQueue::~I2CQueue()
+{
+    {
+        const std::lock_guard<std::mutex> lock(mux_);
+        shutdown_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+esp_err_t I2CQueue::write(uint8_t addr, uint8_t reg, const uint8_t *data,
+                          std::size_t length, completion_t done)
+{
+    if (length > MAX_WRITE_LENGTH)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    {
+        const std::lock_guard<std::mutex> lock(mux_);
+        job_t *job = reserve_locked();
+        if (job == nullptr)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        job->read = false;
+        job->addr = addr;
+        job->reg = reg;
+        job->length = length;
+        job->dest = nullptr;
+        memcpy(job->data, data, length);
+        job->done = std::move(done);
+    }
+    cv_.notify_one();
+    return ESP_OK;
+}
+
+esp_err_t I2CQueue::read(uint8_t addr, uint8_t reg, uint8_t *data,
+                         std::size_t length, completion_t done)
+{
+    {
+        const std::lock_guard<std::mutex> lock(mux_);
+        job_t *job = reserve_locked();
+        if (job == nullptr)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        job->read = true;
+        job->addr = addr;
+        job->reg = reg;
+        job->length = length;
+        job->dest = data;
+        job->done = std::move(done);
+    }
+    cv_.notify_one();
+    return ESP_OK;
+}
+
+I2CQueue::job_t *I2CQueue::reserve_locked()
+{
+    if (count_ >= jobs_.size())
+    {
+        ESP_LOGW(TAG, "[port:%d] Queue full, rejecting job", i2c_.getPort());
+        return nullptr;
+    }
+    job_t *job = &jobs_[(head_ + count_) % jobs_.size()];
+    count_++;
+    return job;
+}
+
+void I2CQueue::run()
+{
+    while (true)
+    {
+        std::size_t count = 0;
+        {
+            std::unique_lock<std::mutex> lock(mux_);
+            cv_.wait(lock, [&]() { return count_ || shutdown_; });
+            if (!count_)
+            {
+                // shutdown requested and no jobs remain.
+                return;
+            }
+            // move as many jobs as possible out of the queue so that new jobs
+            // can be submitted while the bus is busy.
+            while (count_ && count < batch_.size())
+            {
+                batch_[count++] = std::move(jobs_[head_]);
+                jobs_[head_].done = nullptr;
+                head_ = (head_ + 1) % jobs_.size();
+                count_--;
+            }
+        }
+
+        esp_err_t res = execute(batch_.data(), count);
+        if (res != ESP_OK && count > 1)
+        {
+            // each job is retried below, the bus health is judged by the
+            // retries alone.
+            i2c_.getMetrics().record_retry(res);
+        }
+        for (std::size_t idx = 0; idx < count; idx++)
+        {
+            auto &job = batch_[idx];
+            // when the combined transaction fails retry each job on it's own
+            // so that only the failing job(s) report the failure.
+            esp_err_t job_res = res;
+            if (res != ESP_OK && count > 1)
+            {
+                job_res = execute(&job, 1);
+            }
+            if (job_res != ESP_OK)
+            {
+                ESP_LOGE(TAG,
+                         "[port:%d, slave:0x%X] Failed to %s %d bytes %s "
+                         "register 0x%X, error: 0x%X", i2c_.getPort(),
+                         job.addr, job.read ? "read" : "write", job.length,
+                         job.read ? "from" : "to", job.reg, job_res);
+            }
+            i2c_.getMetrics().record_device(job.addr, job.length, job_res);
+            if (job.done)
+            {
+                asio::post(context_, std::bind(std::move(job.done), job_res));
+                job.done = nullptr;
+            }
+        }
+    }
+}
+
+esp_err_t I2CQueue::execute(job_t *jobs, std::size_t count)
+{
+    i2c_cmd_handle_t cmd =
+        i2c_cmd_link_create_static(link_buffer_, sizeof(link_buffer_));
+    esp_err_t res = ESP_OK;
+    for (std::size_t idx = 0; idx < count && res == ESP_OK; idx++)
+    {
+        auto &job = jobs[idx];
+        // each job starts with a (repeated) start condition followed by the
+        // device and register address.
+        res = i2c_master_start(cmd);
+        if (res == ESP_OK)
+        {
+            res = i2c_master_write_byte(cmd, (job.addr << 1) | I2C_MASTER_WRITE,
+                                        true);
+        }
+        if (res == ESP_OK)
+        {
+            res = i2c_master_write_byte(cmd, job.reg, true);
+        }
+        if (res == ESP_OK && job.read)
+        {
+            res = i2c_master_start(cmd);
+            if (res == ESP_OK)
+            {
+                res = i2c_master_write_byte(cmd,
+                                            (job.addr << 1) | I2C_MASTER_READ,
+                                            true);
+            }
+            if (res == ESP_OK)
+            {
+                res = i2c_master_read(cmd, job.dest, job.length,
+                                      I2C_MASTER_LAST_NACK);
+            }
+        }
+        else if (res == ESP_OK && job.length)
+        {
+            res = i2c_master_write(cmd, job.data, job.length, true);
+        }
+    }
+    if (res == ESP_OK)
+    {
+        res = i2c_master_stop(cmd);
+    }
+    if (res == ESP_OK)
+    {
+        res = i2c_.execute(cmd, I2C_QUEUE_TIMEOUT_MS);
+    }
+    i2c_cmd_link_delete_static(cmd);
+    return res;
+}
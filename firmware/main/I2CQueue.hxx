@@ -0,0 +1,160 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#pragma once
+
+#include <array>
+#include <asio.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <esp_err.h>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "config.hxx"
+#include "I2Cbus.hxx"
+
+/// Queue of I2C transactions executed by a dedicated bus thread.
+///
+/// Jobs are submitted from any thread without blocking on the bus, the bus
+/// thread combines all waiting jobs (up to @ref I2C_QUEUE_MAX_BATCH) into a
+/// single command link and posts the completion callbacks back to the
+/// @ref asio::io_context.
+class I2CQueue
+{
+public:
+    /// Callback invoked upon completion of a job.
+    ///
+    /// Signature: void function(esp_err_t result).
+    using completion_t = std::function<void(esp_err_t)>;
+
+    /// Maximum number of bytes that can be written by a single job.
+    static constexpr std::size_t MAX_WRITE_LENGTH = 64;
+
+    /// Constructor.
+    ///
+    /// @param i2c @ref I2C_t instance to execute jobs on.
+    /// @param context @ref asio::io_context to post completions to.
+    I2CQueue(I2C_t &i2c, asio::io_context &context);
+
+    /// Destructor, stops the bus thread after pending jobs have completed.
+    ~I2CQueue();
+
+    /// Queues a register write.
+    ///
+    /// @param addr I2C device address.
+    /// @param reg Register address to start writing at.
+    /// @param data Data to write, copied into the job.
+    /// @param length Number of bytes in @param data.
+    /// @param done Optional callback to invoke upon completion.
+    ///
+    /// @return ESP_OK if the job was queued, ESP_ERR_INVALID_SIZE if
+    /// @param length exceeds @ref MAX_WRITE_LENGTH, ESP_ERR_NO_MEM if the
+    /// queue is full.
+    esp_err_t write(uint8_t addr, uint8_t reg, const uint8_t *data,
+                    std::size_t length, completion_t done = nullptr);
+
+    /// Queues a register read.
+    ///
+    /// @param addr I2C device address.
+    /// @param reg Register address to start reading at.
+    /// @param data Buffer to receive the data, must remain valid until
+    /// @param done has been invoked.
+    /// @param length Number of bytes to read.
+    /// @param done Callback to invoke upon completion.
+    ///
+    /// @return ESP_OK if the job was queued, ESP_ERR_NO_MEM if the queue is
+    /// full.
+    esp_err_t read(uint8_t addr, uint8_t reg, uint8_t *data,
+                   std::size_t length, completion_t done);
+
+    /// @return @ref asio::io_context that completions are posted to.
+    asio::io_context &context()
+    {
+        return context_;
+    }
+
+private:
+    /// Log tag to use for this class.
+    static constexpr const char *const TAG = "i2c_queue";
+
+    /// Single queued transaction.
+    struct job_t
+    {
+        /// When true the job reads from the device.
+        bool read;
+
+        /// I2C device address.
+        uint8_t addr;
+
+        /// Register address.
+        uint8_t reg;
+
+        /// Number of bytes to transfer.
+        uint8_t length;
+
+        /// Destination for read jobs.
+        uint8_t *dest;
+
+        /// Data for write jobs.
+        uint8_t data[MAX_WRITE_LENGTH];
+
+        /// Callback to invoke upon completion.
+        completion_t done;
+    };
+
+    /// @ref I2C_t instance that jobs are executed on.
+    I2C_t &i2c_;
+
+    /// @ref asio::io_context that completions are posted to.
+    asio::io_context &context_;
+
+    /// Ring buffer of queued jobs.
+    std::array<job_t, I2C_QUEUE_DEPTH> jobs_;
+
+    /// Index of the oldest job in @ref jobs_.
+    std::size_t head_{0};
+
+    /// Number of jobs in @ref jobs_.
+    std::size_t count_{0};
+
+    /// When true the bus thread will exit once @ref jobs_ is empty.
+    bool shutdown_{false};
+
+    /// Protects @ref jobs_, @ref head_, @ref count_ and @ref shutdown_.
+    std::mutex mux_;
+
+    /// Signalled when a job has been queued.
+    std::condition_variable cv_;
+
+    /// Jobs removed from @ref jobs_ that are being executed, only accessed
+    /// by the bus thread.
+    std::array<job_t, I2C_QUEUE_MAX_BATCH> batch_;
+
+    /// Command link storage, only accessed by the bus thread. Read jobs use
+    /// roughly twice the link entries of a write job.
+    uint8_t link_buffer_[I2C_LINK_RECOMMENDED_SIZE(I2C_QUEUE_MAX_BATCH * 2)];
+
+    /// Bus thread.
+    std::thread thread_;
+
+    /// Reserves a slot in @ref jobs_ for a new job.
+    ///
+    /// @return the reserved job or nullptr if the queue is full.
+    job_t *reserve_locked();
+
+    /// Bus thread entry point.
+    void run();
+
+    /// Executes a group of jobs as a single command link.
+    ///
+    /// @param jobs First job to execute.
+    /// @param count Number of jobs to execute.
+    ///
+    /// @return result of the transaction.
+    esp_err_t execute(job_t *jobs, std::size_t count);
+};
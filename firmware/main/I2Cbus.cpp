@@ -29,9 +29,10 @@ IN THE SOFTWARE.
 #include "esp_log.h"
 #include "driver/i2c.h"
 #include "driver/gpio.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 
-#define SEMAPHORE_TAKE_RECURSIVE() xSemaphoreTakeRecursive(_i2c_mutex, portMAX_DELAY)
+#define SEMAPHORE_TAKE_RECURSIVE() takeMutex()
 #define SEMAPHORE_GIVE_RECURSIVE() xSemaphoreGiveRecursive(_i2c_mutex)
 
 #define I2C_MASTER_ACK_EN true   /*!< Enable ack check for master */
@@ -85,6 +86,30 @@ namespace i2cbus
         {
             err = i2c_driver_install(port, conf.mode, 0, 0, 0);
         }
+        if (!err)
+        {
+            config = conf;
+            metrics.record_clock(clk_speed);
+        }
+        SEMAPHORE_GIVE_RECURSIVE();
+        return err;
+    }
+
+    esp_err_t I2C::setClock(uint32_t clk_speed) const
+    {
+        SEMAPHORE_TAKE_RECURSIVE();
+        esp_err_t err = ESP_ERR_INVALID_STATE;
+        if (config.master.clk_speed)
+        {
+            i2c_config_t conf = config;
+            conf.master.clk_speed = clk_speed;
+            err = i2c_param_config(port, &conf);
+            if (!err)
+            {
+                config = conf;
+                metrics.record_clock(clk_speed);
+            }
+        }
         SEMAPHORE_GIVE_RECURSIVE();
         return err;
     }
@@ -97,6 +122,26 @@ namespace i2cbus
         return err;
     }
 
+    i2c_cmd_handle_t I2C::createCmdLink() const
+    {
+        return i2c_cmd_link_create_static(cmdLinkBuffer, sizeof(cmdLinkBuffer));
+    }
+
+    void I2C::takeMutex() const
+    {
+        const int64_t start = esp_timer_get_time();
+        xSemaphoreTakeRecursive(_i2c_mutex, portMAX_DELAY);
+        metrics.record_lock_wait(esp_timer_get_time() - start);
+    }
+
+    esp_err_t I2C::transfer(i2c_cmd_handle_t cmd, int32_t timeout) const
+    {
+        const int64_t start = esp_timer_get_time();
+        esp_err_t err = i2c_master_cmd_begin(port, cmd, (timeout < 0 ? ticksToWait : pdMS_TO_TICKS(timeout)));
+        metrics.record_transfer(esp_timer_get_time() - start, err);
+        return err;
+    }
+
     void I2C::setTimeout(uint32_t ms)
     {
         SEMAPHORE_TAKE_RECURSIVE();
@@ -104,6 +149,14 @@ namespace i2cbus
         SEMAPHORE_GIVE_RECURSIVE();
     }
 
+    esp_err_t I2C::execute(i2c_cmd_handle_t cmd, int32_t timeout) const
+    {
+        SEMAPHORE_TAKE_RECURSIVE();
+        esp_err_t err = transfer(cmd, timeout);
+        SEMAPHORE_GIVE_RECURSIVE();
+        return err;
+    }
+
     /*******************************************************************************
      * WRITING
      ******************************************************************************/
@@ -147,7 +200,7 @@ namespace i2cbus
     esp_err_t I2C::writeBytes(uint8_t devAddr, uint8_t regAddr, size_t length, const uint8_t *data, int32_t timeout) const
     {
         SEMAPHORE_TAKE_RECURSIVE();
-        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+        i2c_cmd_handle_t cmd = createCmdLink();
         i2c_master_start(cmd);
         i2c_master_write_byte(cmd, (devAddr << 1) | I2C_MASTER_WRITE, I2C_MASTER_ACK_EN);
         i2c_master_write_byte(cmd, regAddr, I2C_MASTER_ACK_EN);
@@ -156,38 +209,14 @@ namespace i2cbus
            i2c_master_write(cmd, (uint8_t *) data, length, I2C_MASTER_ACK_EN);
         }
         i2c_master_stop(cmd);
-        esp_err_t err = i2c_master_cmd_begin(port, cmd, (timeout < 0 ? ticksToWait : pdMS_TO_TICKS(timeout)));
-        i2c_cmd_link_delete(cmd);
+        esp_err_t err = transfer(cmd, timeout);
+        i2c_cmd_link_delete_static(cmd);
         SEMAPHORE_GIVE_RECURSIVE();
+        metrics.record_device(devAddr, length, err);
         if (err)
         {
             ESP_LOGE(TAG, "[port:%d, slave:0x%X] Failed to write %d bytes to__ register 0x%X, error: 0x%X",
-                     port, devAddr, length, regAddr, err);
-        }
-        return err;
-    }
-
-    esp_err_t I2C::writeBytes(uint8_t devAddr, uint8_t regAddr, std::vector<uint16_t> values, int32_t timeout) const
-    {
-        SEMAPHORE_TAKE_RECURSIVE();
-        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-        i2c_master_start(cmd);
-        i2c_master_write_byte(cmd, (devAddr << 1) | I2C_MASTER_WRITE, I2C_MASTER_ACK_EN);
-        i2c_master_write_byte(cmd, regAddr, I2C_MASTER_ACK_EN);
-
-        for (uint16_t value : values)
-        {
-            i2c_master_write_byte(cmd, (value & 0xff), I2C_MASTER_ACK_DIS);
-            i2c_master_write_byte(cmd, (value >> 8) & 0xff, I2C_MASTER_ACK_EN);
-        }
-        i2c_master_stop(cmd);
-        esp_err_t err = i2c_master_cmd_begin(port, cmd, (timeout < 0 ? ticksToWait : pdMS_TO_TICKS(timeout)));
-        i2c_cmd_link_delete(cmd);
-        SEMAPHORE_GIVE_RECURSIVE();
-        if (err)
-        {
-            ESP_LOGE(TAG, "[port:%d, slave:0x%X] Failed to write %d bytes to__ register 0x%X, error: 0x%X",
-                     port, devAddr, values.size() * 2, regAddr, err);
+                     port, devAddr, static_cast<int>(length), regAddr, err);
         }
         return err;
     }
@@ -222,7 +251,7 @@ namespace i2cbus
     esp_err_t I2C::readBytes(uint8_t devAddr, uint8_t regAddr, size_t length, uint8_t *data, int32_t timeout) const
     {
         SEMAPHORE_TAKE_RECURSIVE();
-        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+        i2c_cmd_handle_t cmd = createCmdLink();
         i2c_master_start(cmd);
         i2c_master_write_byte(cmd, (devAddr << 1) | I2C_MASTER_WRITE, I2C_MASTER_ACK_EN);
         i2c_master_write_byte(cmd, regAddr, I2C_MASTER_ACK_EN);
@@ -230,13 +259,14 @@ namespace i2cbus
         i2c_master_write_byte(cmd, (devAddr << 1) | I2C_MASTER_READ, I2C_MASTER_ACK_EN);
         i2c_master_read(cmd, data, length, I2C_MASTER_LAST_NACK);
         i2c_master_stop(cmd);
-        esp_err_t err = i2c_master_cmd_begin(port, cmd, (timeout < 0 ? ticksToWait : pdMS_TO_TICKS(timeout)));
-        i2c_cmd_link_delete(cmd);
+        esp_err_t err = transfer(cmd, timeout);
+        i2c_cmd_link_delete_static(cmd);
         SEMAPHORE_GIVE_RECURSIVE();
+        metrics.record_device(devAddr, length, err);
         if (err)
         {
             ESP_LOGE(TAG, "[port:%d, slave:0x%X] Failed to read %d bytes from register 0x%X, error: 0x%X",
-                     port, devAddr, length, regAddr, err);
+                     port, devAddr, static_cast<int>(length), regAddr, err);
         }
         return err;
     }
@@ -247,13 +277,14 @@ namespace i2cbus
     esp_err_t I2C::testConnection(uint8_t devAddr, int32_t timeout) const
     {
         SEMAPHORE_TAKE_RECURSIVE();
-        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+        i2c_cmd_handle_t cmd = createCmdLink();
         i2c_master_start(cmd);
         i2c_master_write_byte(cmd, (devAddr << 1) | I2C_MASTER_WRITE, I2C_MASTER_ACK_EN);
         i2c_master_stop(cmd);
-        esp_err_t err = i2c_master_cmd_begin(port, cmd, (timeout < 0 ? ticksToWait : pdMS_TO_TICKS(timeout)));
-        i2c_cmd_link_delete(cmd);
+        esp_err_t err = transfer(cmd, timeout);
+        i2c_cmd_link_delete_static(cmd);
         SEMAPHORE_GIVE_RECURSIVE();
+        metrics.record_device(devAddr, 0, err);
         return err;
     }
 
@@ -267,7 +298,7 @@ namespace i2cbus
         {
             if (testConnection(i, scanTimeout) == ESP_OK)
             {
-                ESP_LOGI(TAG, "- Device found at address 0x%X", i);
+                ESP_LOGI(TAG, "- Device found at address 0x%X", static_cast<unsigned>(i));
                 count++;
             }
         }
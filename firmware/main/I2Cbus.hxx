@@ -30,7 +30,8 @@ IN THE SOFTWARE.
 #include <esp_log.h>
 #include <freertos/semphr.h>
 #include <hal/gpio_types.h>
-#include <vector>
+
+#include "I2CMetrics.hxx"
 
 /* ^^^^^^
  * I2Cbus
@@ -39,6 +40,7 @@ namespace i2cbus
 {
     constexpr uint32_t kDefaultClockSpeed = 100000; /*!< Clock speed in Hz, default: 100KHz */
     constexpr uint32_t kDefaultTimeout = 1000;      /*!< Timeout in milliseconds, default: 1000ms */
+    constexpr size_t kCmdLinkTransactions = 2;      /*!< Transactions reserved in the static command link buffer */
     class I2C;
 } // namespace i2cbus
 
@@ -58,6 +60,29 @@ namespace i2cbus
         i2c_port_t port;      /*!< I2C port: I2C_NUM_0 or I2C_NUM_1 */
         uint32_t ticksToWait; /*!< Timeout in ticks for read and write */
         SemaphoreHandle_t _i2c_mutex = xSemaphoreCreateRecursiveMutex();
+        /** Storage for the command link, reused by every transaction while holding _i2c_mutex */
+        mutable uint8_t cmdLinkBuffer[I2C_LINK_RECOMMENDED_SIZE(kCmdLinkTransactions)];
+        /** Usage counters for this bus */
+        mutable I2CMetrics metrics;
+        /** Configuration applied by begin(), retained so the clock can be changed */
+        mutable i2c_config_t config{};
+
+        /**
+         * @brief  Creates a command link using cmdLinkBuffer, must be called with _i2c_mutex held
+         *         and released with i2c_cmd_link_delete_static().
+         */
+        i2c_cmd_handle_t createCmdLink() const;
+
+        /**
+         * @brief  Takes _i2c_mutex, recording the time spent waiting in metrics.
+         */
+        void takeMutex() const;
+
+        /**
+         * @brief  Executes a command link, recording the time the bus was held in metrics.
+         *         Must be called with _i2c_mutex held.
+         */
+        esp_err_t transfer(i2c_cmd_handle_t cmd, int32_t timeout) const;
 
     public:
         explicit I2C(i2c_port_t port);
@@ -86,11 +111,57 @@ namespace i2cbus
          */
         esp_err_t close() const;
 
+        /** *** I2C Clock ***
+         * @brief  Change the clock frequency of a started bus, this waits for any
+         *         transaction in progress to complete.
+         * @param  clk_speed [I2C clock frequency for master mode, (no higher than 1MHz for now)]
+         * @return  - ESP_OK Success
+         *          - ESP_ERR_INVALID_ARG Parameter error
+         *          - ESP_ERR_INVALID_STATE Bus has not been started.
+         */
+        esp_err_t setClock(uint32_t clk_speed) const;
+
+        /**
+         * I2C clock frequency in Hz, zero if the bus has not been started
+         */
+        uint32_t getClock() const
+        {
+            return config.master.clk_speed;
+        }
+
         /**
          * Timeout read and write in milliseconds
          */
         void setTimeout(uint32_t ms);
 
+        /**
+         * I2C port used by this bus
+         */
+        i2c_port_t getPort() const
+        {
+            return port;
+        }
+
+        /**
+         * Usage counters for this bus
+         */
+        I2CMetrics &getMetrics() const
+        {
+            return metrics;
+        }
+
+        /**
+         * @brief  Executes a prepared command link while holding the bus lock.
+         * @param  cmd       [Command link to execute]
+         * @param  timeout   [Custom timeout for the particular call]
+         * @return  - ESP_OK Success
+         *          - ESP_ERR_INVALID_ARG Parameter error
+         *          - ESP_FAIL Sending command error, slave doesn't ACK the transfer.
+         *          - ESP_ERR_INVALID_STATE I2C driver not installed or not in master mode.
+         *          - ESP_ERR_TIMEOUT Operation timeout because the bus is busy.
+         */
+        esp_err_t execute(i2c_cmd_handle_t cmd, int32_t timeout = -1) const;
+
         /**
          * *** WRITING interface ***
          * @brief  I2C commands for writing to a 8-bit slave device register.
@@ -114,7 +185,22 @@ namespace i2cbus
         esp_err_t writeBits(uint8_t devAddr, uint8_t regAddr, uint8_t bitStart, uint8_t length, uint8_t data, int32_t timeout = -1) const;
         esp_err_t writeByte(uint8_t devAddr, uint8_t regAddr, uint8_t data, int32_t timeout = -1) const;
         esp_err_t writeBytes(uint8_t devAddr, uint8_t regAddr, size_t length, const uint8_t *data, int32_t timeout = -1) const;
-        esp_err_t writeBytes(uint8_t devAddr, uint8_t regAddr, std::vector<uint16_t> values, int32_t timeout = -1) const;
+
+        /**
+         * @brief  Writes 16-bit values (little endian) to consecutive registers without allocating.
+         * @param  values    [Value(s) to be written, ie: {0xFFFF}]
+         */
+        template <size_t N>
+        esp_err_t writeBytes(uint8_t devAddr, uint8_t regAddr, const uint16_t (&values)[N], int32_t timeout = -1) const
+        {
+            uint8_t data[N * 2];
+            for (size_t i = 0; i < N; i++)
+            {
+                data[(i * 2)] = values[i] & 0xff;
+                data[(i * 2) + 1] = (values[i] >> 8) & 0xff;
+            }
+            return writeBytes(devAddr, regAddr, sizeof(data), data, timeout);
+        }
 
         /**
          * *** READING interface ***
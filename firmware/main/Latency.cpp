@@ -0,0 +1,147 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "Latency.hxx"
+
+/// Log tag to use for latency summaries.
+static constexpr const char *const TAG = "latency";
+
+/// Histogram for each @ref latency_point_t.
+static LatencyHistogram histograms[LATENCY_POINT_COUNT];
+
+/// Name of each @ref latency_point_t.
+static constexpr const char *const LATENCY_POINT_NAMES[LATENCY_POINT_COUNT] =
+{
+    "dispatch",
+    "first_i2c",
+    "feeder_idle",
+    "response"
+};
+
+void LatencyHistogram::record(int64_t latency_us)
+{
+    const uint32_t latency =
+        std::clamp<int64_t>(latency_us, 0, UINT32_MAX);
+    std::size_t bucket = 0;
+    if (latency > 1)
+    {
+        bucket = std::min<std::size_t>(31 - __builtin_clz(latency),
+                                       BUCKET_COUNT - 1);
+    }
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t max = max_.load(std::memory_order_relaxed);
+    while (latency > max &&
+           !max_.compare_exchange_weak(max, latency,
+                                       std::memory_order_relaxed))
+    {
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto &bucket : buckets_)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    max_.store(0, std::memory_order_relaxed);
+}
+
+LatencyHistogram::summary_t LatencyHistogram::summary() const
+{
+    uint32_t counts[BUCKET_COUNT];
+    summary_t summary = {};
+    for (std::size_t idx = 0; idx < BUCKET_COUNT; idx++)
+    {
+        counts[idx] = buckets_[idx].load(std::memory_order_relaxed);
+        summary.count += counts[idx];
+    }
+    summary.max = max_.load(std::memory_order_relaxed);
+    if (!summary.count)
+    {
+        return summary;
+    }
+
+    // walk the buckets until each percentile has been reached, the bucket
+    // upper bound is capped to the maximum recorded latency.
+    const uint64_t p50 = (summary.count * 50ULL + 99) / 100;
+    const uint64_t p90 = (summary.count * 90ULL + 99) / 100;
+    const uint64_t p99 = (summary.count * 99ULL + 99) / 100;
+    uint64_t seen = 0;
+    for (std::size_t idx = 0; idx < BUCKET_COUNT; idx++)
+    {
+        const uint64_t previous = seen;
+        seen += counts[idx];
+        const uint32_t upper =
+            std::min<uint64_t>((2ULL << idx) - 1, summary.max);
+        if (previous < p50 && seen >= p50)
+        {
+            summary.p50 = upper;
+        }
+        if (previous < p90 && seen >= p90)
+        {
+            summary.p90 = upper;
+        }
+        if (previous < p99 && seen >= p99)
+        {
+            summary.p99 = upper;
+        }
+    }
+    return summary;
+}
+
+void record_latency(latency_point_t point, int64_t received_us)
+{
+    histograms[point].record(esp_timer_get_time() - received_us);
+}
+
+void reset_latency()
+{
+    for (auto &histogram : histograms)
+    {
+        histogram.reset();
+    }
+}
+
+std::string format_latency()
+{
+    std::string result;
+    result.reserve(LATENCY_POINT_COUNT * 80);
+    for (std::size_t point = 0; point < LATENCY_POINT_COUNT; point++)
+    {
+        char line[96];
+        auto summary = histograms[point].summary();
+        snprintf(line, sizeof(line),
+                 "%s%s: count=%" PRIu32 " p50=%" PRIu32 "us p90=%" PRIu32
+                 "us p99=%" PRIu32 "us max=%" PRIu32 "us",
+                 point ? "\n" : "", LATENCY_POINT_NAMES[point], summary.count,
+                 summary.p50, summary.p90, summary.p99, summary.max);
+        result.append(line);
+    }
+    return result;
+}
+
+void log_latency()
+{
+    for (std::size_t point = 0; point < LATENCY_POINT_COUNT; point++)
+    {
+        auto summary = histograms[point].summary();
+        if (summary.count)
+        {
+            ESP_LOGI(TAG,
+                     "%s: count=%" PRIu32 " p50=%" PRIu32 "us p90=%" PRIu32
+                     "us p99=%" PRIu32 "us max=%" PRIu32 "us",
+                     LATENCY_POINT_NAMES[point], summary.count, summary.p50,
+                     summary.p90, summary.p99, summary.max);
+        }
+    }
+}
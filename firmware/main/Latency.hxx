@@ -0,0 +1,99 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/// Points at which the latency of a command is recorded, all latencies are
+/// measured from the time the command was received.
+typedef enum : uint8_t
+{
+    /// Command has been parsed and dispatched to it's handler.
+    LATENCY_DISPATCH,
+
+    /// First servo update for the command has been queued for the I2C bus.
+    LATENCY_FIRST_I2C,
+
+    /// Feeder has returned to idle after completing the command.
+    LATENCY_FEEDER_IDLE,
+
+    /// Response to the command has been queued for the client.
+    LATENCY_RESPONSE,
+
+    /// Number of latency points, must be last.
+    LATENCY_POINT_COUNT
+} latency_point_t;
+
+/// Fixed size histogram of latencies using power of two buckets.
+///
+/// Recording a latency requires only a couple of relaxed atomic operations
+/// so that it can be used on all command processing paths.
+class LatencyHistogram
+{
+public:
+    /// Summary of the recorded latencies, the percentiles are reported as
+    /// the upper bound of the bucket containing the percentile.
+    struct summary_t
+    {
+        /// Number of recorded latencies.
+        uint32_t count;
+
+        /// 50th percentile in microseconds.
+        uint32_t p50;
+
+        /// 90th percentile in microseconds.
+        uint32_t p90;
+
+        /// 99th percentile in microseconds.
+        uint32_t p99;
+
+        /// Maximum recorded latency in microseconds.
+        uint32_t max;
+    };
+
+    /// Records a single latency.
+    ///
+    /// @param latency_us Latency in microseconds.
+    void record(int64_t latency_us);
+
+    /// Discards all recorded latencies.
+    void reset();
+
+    /// @return @ref summary_t of the recorded latencies.
+    summary_t summary() const;
+
+private:
+    /// Number of buckets, bucket N holds latencies below 2^(N+1)
+    /// microseconds with the last bucket holding all longer latencies.
+    static constexpr std::size_t BUCKET_COUNT = 24;
+
+    /// Number of latencies recorded in each bucket.
+    std::atomic<uint32_t> buckets_[BUCKET_COUNT] = {};
+
+    /// Maximum recorded latency in microseconds.
+    std::atomic<uint32_t> max_{0};
+};
+
+/// Records the latency of a command.
+///
+/// @param point @ref latency_point_t being recorded.
+/// @param received_us Time (from esp_timer_get_time) at which the command
+/// was received.
+void record_latency(latency_point_t point, int64_t received_us);
+
+/// Discards all recorded latencies.
+void reset_latency();
+
+/// Formats a summary of all recorded latencies.
+///
+/// @return @ref std::string with one line per @ref latency_point_t.
+std::string format_latency();
+
+/// Logs a summary of all latency points which have recorded latencies.
+void log_latency();
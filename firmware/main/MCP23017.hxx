@@ -6,11 +6,18 @@
 
 #pragma once
 
+#include "config.hxx"
 #include "I2Cbus.hxx"
+#include "I2CQueue.hxx"
 #include <cmath>
 #include <esp_err.h>
 #include <endian.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <functional>
+#include <mutex>
+#include <vector>
 
 /// Manages a single MCP23017 IO Expander IC.
 class MCP23017 : public std::enable_shared_from_this<MCP23017>
@@ -20,18 +27,24 @@ public:
     /// Constructor.
     ///
     /// @param i2c @ref I2C_t instance to use for this @ref MCP23017 instance.
-    MCP23017(I2C_t &i2c, asio::io_context &context)
-        : i2c_(i2c), timer_(context)
+    /// @param queue @ref I2CQueue to use for background updates.
+    MCP23017(I2C_t &i2c, I2CQueue &queue)
+        : i2c_(i2c), queue_(queue)
     {
     }
 
     /// Configures this @ref MCP23017 instance.
     ///
     /// @param address I2C device address to use.
+    /// @param use_interrupt When true the device will be configured to raise
+    /// an interrupt (INTA/INTB mirrored, open-drain) upon any input change.
+    ///
+    /// NOTE: The owner is responsible for calling @ref refresh periodically
+    /// and when the interrupt is raised.
     ///
     /// @return ESP_OK if the device was detected and configured, any other
     /// value indicates failure.
-    esp_err_t configure(const uint8_t address)
+    esp_err_t configure(const uint8_t address, bool use_interrupt = false)
     {
         addr_ = address;
 
@@ -55,10 +68,71 @@ public:
             return res;
         }
 
-        // start background updates
-        update({});
+        if (use_interrupt)
+        {
+            // Mirror INTA/INTB so a single pin can be used for all IO and
+            // configure it as open-drain so multiple devices can share it.
+            res = i2c_.writeByte(addr_, IOCON, IOCON_MIRROR | IOCON_ODR);
+            if (res != ESP_OK)
+            {
+                return res;
+            }
+
+            // Raise the interrupt when an input changes from its previous
+            // value.
+            res = i2c_.writeBytes(addr_, INT_CONTROL_A, {0x0000});
+            if (res != ESP_OK)
+            {
+                return res;
+            }
 
-        return ESP_OK;
+            // Enable interrupt on change for all IO pins.
+            res = i2c_.writeBytes(addr_, INT_ENABLE_A, {0xFFFF});
+            if (res != ESP_OK)
+            {
+                return res;
+            }
+        }
+
+        // Capture the initial state of the IO pins, this also clears any
+        // pending interrupt.
+        return i2c_.readBytes(addr_, INPUT_A, sizeof(state_), state_);
+    }
+
+    /// Verifies communication with this @ref MCP23017 by writing a test
+    /// pattern to the default compare value registers and reading it back,
+    /// these are not used by @ref configure (interrupts compare against the
+    /// previous value) so the pattern has no effect on the device.
+    ///
+    /// @param seed Value used to generate the test pattern, zero restores the
+    /// power-on values of the registers.
+    ///
+    /// @return ESP_OK if the pattern was read back, ESP_ERR_INVALID_RESPONSE
+    /// if the pattern read back was different, any other value indicates an
+    /// I2C failure.
+    esp_err_t verify(uint8_t seed)
+    {
+        uint8_t pattern[2] = {0x00, 0x00};
+        if (seed)
+        {
+            pattern[0] = seed * 0x9D;
+            pattern[1] = ~pattern[0];
+        }
+        esp_err_t res =
+            i2c_.writeBytes(addr_, DEFAULT_VALUE_A, sizeof(pattern), pattern);
+        if (res != ESP_OK)
+        {
+            return res;
+        }
+        uint8_t readback[sizeof(pattern)];
+        res = i2c_.readBytes(addr_, DEFAULT_VALUE_A, sizeof(readback),
+                             readback);
+        if (res != ESP_OK)
+        {
+            return res;
+        }
+        return memcmp(pattern, readback, sizeof(pattern)) ?
+            ESP_ERR_INVALID_RESPONSE : ESP_OK;
     }
 
     /// Returns the current state of an IO channel.
@@ -93,6 +167,36 @@ public:
         return addr_;
     }
 
+    /// @return time of the last detected IO pin state change.
+    std::chrono::steady_clock::time_point last_change() const
+    {
+        return std::chrono::steady_clock::time_point(
+            std::chrono::steady_clock::duration(last_change_.load()));
+    }
+
+    /// Queues a read of the interrupt flags, captured and current state of
+    /// the IO pins. Any subscribers will be notified of state changes before
+    /// @param done is invoked.
+    ///
+    /// @param done Optional callback to invoke once the read has completed.
+    ///
+    /// NOTE: If a read is already in progress a second read will be queued
+    /// once it completes, @param done will be invoked after that read.
+    void refresh(std::function<void()> done = nullptr)
+    {
+        const std::lock_guard<std::mutex> lock(mux_);
+        if (done)
+        {
+            waiting_.push_back(std::move(done));
+        }
+        if (reading_)
+        {
+            reread_ = true;
+            return;
+        }
+        start_read_locked();
+    }
+
     /// maximum number of PWM channels supported by the MCP23017.
     static constexpr size_t NUM_CHANNELS = 16;
 
@@ -100,8 +204,11 @@ private:
     /// Log tag to use for this class.
     static constexpr const char *const TAG = "MCP23017";
 
-    /// Interval at which to poll the current state of the IO pins.
-    static constexpr std::size_t POLLING_INTERVAL_MS = 50;
+    /// IOCON bit to mirror INTA and INTB.
+    static constexpr uint8_t IOCON_MIRROR = 0x40;
+
+    /// IOCON bit to configure INTA/INTB as open-drain.
+    static constexpr uint8_t IOCON_ODR = 0x04;
 
     /// Device register offsets.
     enum REGISTERS
@@ -112,9 +219,32 @@ private:
         /// IO Direction B control register address.
         IO_DIR_B = 0x01,
 
+        /// Interrupt on change enable register addresses.
+        INT_ENABLE_A = 0x04,
+        INT_ENABLE_B = 0x05,
+
+        /// Default compare value register addresses.
+        DEFAULT_VALUE_A = 0x06,
+        DEFAULT_VALUE_B = 0x07,
+
+        /// Interrupt control register addresses.
+        INT_CONTROL_A = 0x08,
+        INT_CONTROL_B = 0x09,
+
+        /// Device configuration register address.
+        IOCON = 0x0A,
+
         GPIO_PULL_A = 0x0C,
         GPIO_PULL_B = 0x0D,
 
+        /// Interrupt flag register addresses.
+        INT_FLAG_A = 0x0E,
+        INT_FLAG_B = 0x0F,
+
+        /// Interrupt capture register addresses.
+        INT_CAPTURE_A = 0x10,
+        INT_CAPTURE_B = 0x11,
+
         INPUT_A = 0x12,
         INPUT_B = 0x13,
 
@@ -128,59 +258,120 @@ private:
     /// @ref I2C_t instance to use for this device.
     I2C_t &i2c_;
 
+    /// @ref I2CQueue used for background updates.
+    I2CQueue &queue_;
+
     /// Last known states of the IO pins.
     uint8_t state_[2];
 
+    /// Receives the INT_FLAG, INT_CAPTURE and INPUT registers from the
+    /// @ref I2CQueue.
+    uint8_t read_buffer_[6];
+
+    /// Time of the last detected IO pin state change.
+    std::atomic<std::chrono::steady_clock::rep> last_change_{0};
+
+    /// Protects @ref reading_, @ref reread_ and @ref waiting_.
+    std::mutex mux_;
+
+    /// When true a read has been queued and not yet processed.
+    bool reading_{false};
+
+    /// When true another read should be queued once the current read has
+    /// been processed.
+    bool reread_{false};
+
+    /// Callbacks to invoke once the next read has completed.
+    std::vector<std::function<void()>> waiting_;
+
+    /// Callbacks to invoke once the current read has completed.
+    std::vector<std::function<void()>> active_;
+
     /// Collection of callbacks to invoke when state has changed.
     std::function<void(bool)> callbacks_[NUM_CHANNELS];
 
-    /// Background timer instance.
-    asio::system_timer timer_;
+    /// Queues a read of the device registers, @ref mux_ must be held.
+    void start_read_locked()
+    {
+        reading_ = true;
+        reread_ = false;
+        active_.swap(waiting_);
+        esp_err_t res =
+            queue_.read(addr_, INT_FLAG_A, read_buffer_, sizeof(read_buffer_),
+                        std::bind(&MCP23017::process_state,
+                                  shared_from_this(), std::placeholders::_1));
+        if (res != ESP_OK)
+        {
+            // unable to queue the read, the next refresh or watchdog update
+            // will try again.
+            reading_ = false;
+            for (auto &done : active_)
+            {
+                asio::post(queue_.context(), std::move(done));
+            }
+            active_.clear();
+        }
+    }
 
-    /// Background update task which reads the latest state of the IO pins.
+    /// Processes the registers read by @ref start_read_locked.
     ///
-    /// @param error @ref asio::error_code provided by the @ref timer_.
-    void update(asio::error_code error)
+    /// @param res Result of the I2C read.
+    void process_state(esp_err_t res)
     {
-        if (!error)
+        if (res == ESP_OK)
         {
-            // read the current state of IO pins using a local storage so we
-            // can compare it after reading with last reading.
-            uint8_t state[2];
-            ESP_ERROR_CHECK_WITHOUT_ABORT(
-                i2c_.readBytes(addr_, INPUT_A, 2, state));
+            const uint16_t flags = read_buffer_[0] | (read_buffer_[1] << 8);
+            const uint16_t captured = read_buffer_[2] | (read_buffer_[3] << 8);
+            const uint16_t current = read_buffer_[4] | (read_buffer_[5] << 8);
+            uint16_t previous = state_[0] | (state_[1] << 8);
 
             // verify if there are any state changes that are interesting to
             // subscribers.
-            for (std::size_t index = 0; index < 8; index++)
+            for (std::size_t index = 0; index < NUM_CHANNELS; index++)
             {
-                // check first eight inputs
-                if ((state[0] & (1 << index)) != (state_[0] & (1 << index)))
+                const uint16_t bit = (1 << index);
+                // if the pin raised an interrupt but has since returned to
+                // it's previous state report the captured state first so the
+                // transition is not lost.
+                if ((flags & bit) && (captured & bit) != (previous & bit))
                 {
-                    if (callbacks_[index])
-                    {
-                        callbacks_[index](state[0] & (1 << index));
-                    }
+                    notify(index, captured & bit);
+                    previous ^= bit;
                 }
-
-                // check second eight inputs
-                if ((state[1] & (1 << index)) != (state_[1] & (1 << index)))
+                if ((current & bit) != (previous & bit))
                 {
-                    if (callbacks_[index + 8])
-                    {
-                        callbacks_[index + 8](state[1] & (1 << index));
-                    }
+                    notify(index, current & bit);
                 }
             }
             // stash the newly updated state.
-            state_[0] = state[0];
-            state_[1] = state[1];
-
-            // reset the timer to call this function again after the timeout.
-            timer_.expires_from_now(
-                std::chrono::milliseconds(POLLING_INTERVAL_MS));
-            timer_.async_wait(std::bind(&MCP23017::update, shared_from_this(),
-                                        std::placeholders::_1));
+            state_[0] = read_buffer_[4];
+            state_[1] = read_buffer_[5];
+        }
+        for (auto &done : active_)
+        {
+            done();
+        }
+        active_.clear();
+
+        const std::lock_guard<std::mutex> lock(mux_);
+        reading_ = false;
+        if (reread_ || !waiting_.empty())
+        {
+            start_read_locked();
         }
     }
+
+    /// Invokes the subscriber for an IO pin.
+    ///
+    /// @param channel IO pin that has changed.
+    /// @param state New state of the IO pin.
+    void notify(std::size_t channel, bool state)
+    {
+        last_change_ = std::chrono::steady_clock::now().time_since_epoch().count();
+        if (callbacks_[channel])
+        {
+            callbacks_[channel](state);
+        }
+    }
+
 };
\ No newline at end of file
@@ -7,11 +7,20 @@
 #pragma once
 
 #include "I2Cbus.hxx"
+#include "I2CQueue.hxx"
+#include <asio.hpp>
+#include <atomic>
 #include <cmath>
+#include <cstring>
 #include <esp_err.h>
 #include <endian.h>
+#include <mutex>
 
 /// Manages a single PCA9685 PWM controller IC.
+///
+/// A shadow copy of the output registers is maintained so that updates to
+/// multiple outputs can be staged and sent to the device in a single I2C
+/// transaction via @ref flush.
 class PCA9685
 {
 
@@ -19,8 +28,17 @@ public:
     /// Constructor.
     ///
     /// @param i2c @ref I2C_t instance to use for this @ref PCA9685 instance.
-    PCA9685(I2C_t &i2c) : i2c_(i2c)
+    /// @param queue @ref I2CQueue to use for deferred updates.
+    PCA9685(I2C_t &i2c, I2CQueue &queue)
+        : i2c_(i2c), queue_(queue)
     {
+        // All outputs are fully off after power on.
+        for (size_t channel = 0; channel < NUM_CHANNELS; channel++)
+        {
+            OUTPUT_STATE_REGISTER reg_value;
+            reg_value.off.full_off = 1;
+            store_output_locked(channel, reg_value);
+        }
     }
 
     /// Configures this @ref PCA9685 instance.
@@ -81,10 +99,61 @@ public:
 
         MODE2_REGISTER mode2;
         mode2.output_check = 1;
-        return i2c_.writeByte(addr_, REGISTERS::MODE2, mode2.value);
+        res = i2c_.writeByte(addr_, REGISTERS::MODE2, mode2.value);
+        if (res != ESP_OK)
+        {
+            return res;
+        }
+
+        // Send the full shadow copy of the output registers so the device
+        // state is known.
+        {
+            const std::lock_guard<std::mutex> lock(mux_);
+            dirty_ = ALL_CHANNELS;
+        }
+        return flush();
     }
 
-    /// Configures one PWM output.
+    /// Verifies communication with this @ref PCA9685 by writing a test
+    /// pattern to the sub-address registers and reading it back, the
+    /// sub-addresses are not enabled by @ref configure so the pattern has no
+    /// effect on the device.
+    ///
+    /// @param seed Value used to generate the test pattern, zero restores the
+    /// power-on values of the registers.
+    ///
+    /// @return ESP_OK if the pattern was read back, ESP_ERR_INVALID_RESPONSE
+    /// if the pattern read back was different, any other value indicates an
+    /// I2C failure.
+    esp_err_t verify(uint8_t seed)
+    {
+        uint8_t pattern[] = {0xE2, 0xE4, 0xE8, 0xE0};
+        if (seed)
+        {
+            for (size_t idx = 0; idx < sizeof(pattern); idx++)
+            {
+                // bit zero of the sub-address registers is read-only.
+                pattern[idx] = ((seed * 0x9D) + (idx * 0x5B)) & 0xFE;
+            }
+        }
+        esp_err_t res =
+            i2c_.writeBytes(addr_, REGISTERS::SUBADR1, sizeof(pattern), pattern);
+        if (res != ESP_OK)
+        {
+            return res;
+        }
+        uint8_t readback[sizeof(pattern)];
+        res = i2c_.readBytes(addr_, REGISTERS::SUBADR1, sizeof(readback),
+                             readback);
+        if (res != ESP_OK)
+        {
+            return res;
+        }
+        return memcmp(pattern, readback, sizeof(pattern)) ?
+            ESP_ERR_INVALID_RESPONSE : ESP_OK;
+    }
+
+    /// Configures one PWM output immediately.
     ///
     /// @param channel PWM output to configure.
     /// @param count Number of pulses to generate.
@@ -95,8 +164,30 @@ public:
     ///
     /// NOTE: passing -1 for @param count will enable the maximum output
     /// frequency. Passing 0 (zero) for count will disable the PWM output
-    /// signal.
+    /// signal. Any other staged outputs will also be sent.
     esp_err_t set_pwm(const uint8_t channel, const uint16_t count)
+    {
+        esp_err_t res = stage_pwm(channel, count);
+        if (res != ESP_OK)
+        {
+            return res;
+        }
+        return flush();
+    }
+
+    /// Stages an update to one PWM output, the update will not be sent to the
+    /// device until @ref flush is called.
+    ///
+    /// @param channel PWM output to configure.
+    /// @param count Number of pulses to generate.
+    ///
+    /// @return ESP_OK if the PWM output was staged, ESP_ERR_INVALID_ARG if
+    /// the @param channel is outside the supported range.
+    ///
+    /// NOTE: passing -1 for @param count will enable the maximum output
+    /// frequency. Passing 0 (zero) for count will disable the PWM output
+    /// signal.
+    esp_err_t stage_pwm(const uint8_t channel, const uint16_t count)
     {
         if (channel >= NUM_CHANNELS)
         {
@@ -121,24 +212,95 @@ public:
             reg_value.on.counts = (channel * 256);
             reg_value.off.counts = (count + (channel * 256)) % 0x1000;
         }
-        uint8_t output_register = REGISTERS::LED0_ON_L + (channel << 2);
-        ESP_LOGV(TAG, "[%02x:%d] Setting PWM to %d:%d", addr_, channel,
+        ESP_LOGV(TAG, "[%02x:%d] Staging PWM %d:%d", addr_, channel,
                  reg_value.on.value, reg_value.off.value);
-        return i2c_.writeBytes(addr_, output_register,
-                               {htole16(reg_value.on.value),
-                                htole16(reg_value.off.value)});
+        const std::lock_guard<std::mutex> lock(mux_);
+        store_output_locked(channel, reg_value);
+        return ESP_OK;
+    }
+
+    /// Sends all staged output updates to the device.
+    ///
+    /// Consecutive modified outputs are sent as a single auto-increment burst
+    /// so that updating multiple outputs costs a single I2C transaction.
+    ///
+    /// @return ESP_OK if all staged outputs were sent, any other value
+    /// indicates an I2C failure. Outputs that failed to update will be
+    /// retried on the next call.
+    esp_err_t flush()
+    {
+        const std::lock_guard<std::mutex> lock(mux_);
+        flush_pending_ = false;
+        return for_each_dirty_run_locked(
+            [&](const size_t channel, const size_t count)
+            {
+                return i2c_.writeBytes(addr_, output_register(channel),
+                                       count * OUTPUT_REGISTER_SIZE,
+                                       &shadow_[channel * OUTPUT_REGISTER_SIZE]);
+            });
+    }
+
+    /// Queues all staged output updates to be sent to the device by the
+    /// @ref I2CQueue, this does not block on the I2C bus.
+    ///
+    /// Outputs that fail to update will be retried on the next flush.
+    void flush_async()
+    {
+        const std::lock_guard<std::mutex> lock(mux_);
+        flush_pending_ = false;
+        esp_err_t res = for_each_dirty_run_locked(
+            [&](const size_t channel, const size_t count)
+            {
+                const uint16_t mask = ((1 << count) - 1) << channel;
+                return queue_.write(addr_, output_register(channel),
+                                    &shadow_[channel * OUTPUT_REGISTER_SIZE],
+                                    count * OUTPUT_REGISTER_SIZE,
+                                    [this, mask](esp_err_t res)
+                                    {
+                                        if (res != ESP_OK)
+                                        {
+                                            const std::lock_guard<std::mutex> lock(mux_);
+                                            dirty_ |= mask;
+                                        }
+                                    });
+            });
+        if (res == ESP_ERR_NO_MEM)
+        {
+            // the I2C queue is full, try again once it has had a chance to
+            // drain.
+            schedule_flush();
+        }
+    }
+
+    /// Schedules a call to @ref flush_async on the @ref asio::io_context,
+    /// multiple calls before the flush executes will be combined.
+    void schedule_flush()
+    {
+        if (!flush_pending_.exchange(true))
+        {
+            asio::post(queue_.context(), [this]()
+            {
+                flush_async();
+            });
+        }
     }
 
     /// Utility method to turn off the PWM signal for a single channel.
     ///
     /// @param channel PWM output to turn off.
     ///
-    /// @return ESP_OK if the PWM output was updated, ESP_ERR_INVALID_ARG if
-    /// the @param channel is outside the supported range, all other values
-    /// indicate an I2C failure.
+    /// @return ESP_OK if the PWM output was staged, ESP_ERR_INVALID_ARG if
+    /// the @param channel is outside the supported range.
+    ///
+    /// NOTE: The update will be sent via @ref schedule_flush.
     esp_err_t off(const uint8_t channel)
     {
-        return set_pwm(channel, MAX_PWM_COUNTS);
+        esp_err_t res = stage_pwm(channel, MAX_PWM_COUNTS);
+        if (res == ESP_OK)
+        {
+            schedule_flush();
+        }
+        return res;
     }
 
     /// Configures a PWM output to drive a servo to specific angle.
@@ -152,9 +314,10 @@ public:
     /// @param max_servo_angle Maximum angle that the servo supports,
     /// default 180.
     ///
-    /// @return ESP_OK if the PWM output was updated, ESP_ERR_INVALID_ARG if
-    /// the @param channel is outside the supported range, all other values
-    /// indicate an I2C failure.
+    /// @return ESP_OK if the PWM output was staged, ESP_ERR_INVALID_ARG if
+    /// the @param channel is outside the supported range.
+    ///
+    /// NOTE: The update will be sent via @ref schedule_flush.
     esp_err_t set_servo_angle(const uint8_t channel, const uint16_t angle,
                               const uint16_t min_pulse_count = 150,
                               const uint16_t max_pulse_count = 600,
@@ -162,13 +325,44 @@ public:
                               const uint16_t max_servo_angle = 180)
     {
         ESP_LOGI(TAG, "[%02x:%d] Moving to %" PRIu16 " deg", addr_, channel, angle);
+        esp_err_t res = stage_servo_angle(channel, angle, min_pulse_count,
+                                          max_pulse_count, min_servo_angle,
+                                          max_servo_angle);
+        if (res == ESP_OK)
+        {
+            schedule_flush();
+        }
+        return res;
+    }
+
+    /// Stages an update to a PWM output to drive a servo to specific angle,
+    /// the update will not be sent to the device until @ref flush or
+    /// @ref flush_async is called.
+    ///
+    /// @param channel PWM output to configure.
+    /// @param angle Desired angle to move to.
+    /// @param min_pulse_count Minimum pulse count to send to the servo.
+    /// @param max_pulse_count Maximum pulse count to send to the servo.
+    /// @param min_servo_angle Minimum angle that the servo supports,
+    /// default 0 (zero).
+    /// @param max_servo_angle Maximum angle that the servo supports,
+    /// default 180.
+    ///
+    /// @return ESP_OK if the PWM output was staged, ESP_ERR_INVALID_ARG if
+    /// the @param channel is outside the supported range.
+    esp_err_t stage_servo_angle(const uint8_t channel, const uint16_t angle,
+                                const uint16_t min_pulse_count = 150,
+                                const uint16_t max_pulse_count = 600,
+                                const uint16_t min_servo_angle = 0,
+                                const uint16_t max_servo_angle = 180)
+    {
         const uint16_t pulse_count_range = max_pulse_count - min_pulse_count;
         const uint16_t target_angle =
             std::max(std::min(angle, max_servo_angle), min_servo_angle);
         const uint16_t pulse_count =
             (pulse_count_range * target_angle) / max_servo_angle +
             min_pulse_count;
-        return set_pwm(channel, pulse_count);
+        return stage_pwm(channel, pulse_count);
     }
 
     uint8_t get_address() const
@@ -186,6 +380,12 @@ private:
     /// Log tag to use for this class.
     static constexpr const char *const TAG = "PCA9685";
 
+    /// Number of bytes used by the registers for a single output.
+    static constexpr size_t OUTPUT_REGISTER_SIZE = 4;
+
+    /// Bit mask including all outputs.
+    static constexpr uint16_t ALL_CHANNELS = 0xFFFF;
+
     /// Default internal clock frequency, 25MHz.
     static constexpr uint32_t INTERNAL_CLOCK_FREQUENCY = 25000000;
 
@@ -198,6 +398,10 @@ private:
         /// MODE2 register address.
         MODE2 = 0x01,
 
+        /// First I2C sub-address register address, this is followed by the
+        /// remaining sub-address registers and the all-call address register.
+        SUBADR1 = 0x02,
+
         /// OUTPUT 0 first register address. This is used as a starting offset
         /// for all other output registers.
         LED0_ON_L = 0x6,
@@ -310,4 +514,102 @@ private:
 
     /// @ref I2C_t instance to use for this device.
     I2C_t &i2c_;
+
+    /// @ref I2CQueue used for @ref flush_async.
+    I2CQueue &queue_;
+
+    /// Shadow copy of the LED0..LED15 ON/OFF registers in device byte order.
+    uint8_t shadow_[NUM_CHANNELS * OUTPUT_REGISTER_SIZE];
+
+    /// Bit mask of outputs in @ref shadow_ that have not been sent to the
+    /// device.
+    uint16_t dirty_{0};
+
+    /// When true a call to @ref flush is pending on @ref context_.
+    std::atomic<bool> flush_pending_{false};
+
+    /// Mutex protecting @ref shadow_ and @ref dirty_.
+    std::mutex mux_;
+
+    /// @return Address of the first register for an output.
+    static constexpr uint8_t output_register(const size_t channel)
+    {
+        return REGISTERS::LED0_ON_L + (channel * OUTPUT_REGISTER_SIZE);
+    }
+
+    /// Invokes a writer for each group of modified outputs in @ref shadow_.
+    ///
+    /// Consecutive modified outputs are grouped together, a single unmodified
+    /// output between two modified outputs is also included as re-sending it
+    /// is cheaper than starting another transaction.
+    ///
+    /// @param writer Function to send a group of outputs, the signature is:
+    /// esp_err_t writer(size_t first_channel, size_t count). Outputs are no
+    /// longer considered modified when ESP_OK is returned.
+    ///
+    /// @return ESP_OK if all writes were successful, otherwise the last
+    /// failure returned by @param writer.
+    template <typename Writer>
+    esp_err_t for_each_dirty_run_locked(Writer writer)
+    {
+        esp_err_t res = ESP_OK;
+        size_t channel = 0;
+        while (dirty_ && channel < NUM_CHANNELS)
+        {
+            if (!(dirty_ & (1 << channel)))
+            {
+                channel++;
+                continue;
+            }
+            size_t last = channel;
+            for (size_t next = channel + 1; next < NUM_CHANNELS; next++)
+            {
+                if (dirty_ & (1 << next))
+                {
+                    last = next;
+                }
+                else if (next - last > 1)
+                {
+                    break;
+                }
+            }
+            const size_t count = (last - channel) + 1;
+            ESP_LOGV(TAG, "[%02x] Sending outputs %zu-%zu", addr_, channel,
+                     last);
+            esp_err_t write_res = writer(channel, count);
+            if (write_res == ESP_OK)
+            {
+                dirty_ &= ~(((1 << count) - 1) << channel);
+            }
+            else
+            {
+                res = write_res;
+            }
+            channel = last + 1;
+        }
+        return res;
+    }
+
+    /// Stores an output register value into @ref shadow_, marking it as
+    /// modified if the value differs.
+    ///
+    /// @param channel Output to update.
+    /// @param reg_value Value for the output registers.
+    void store_output_locked(const uint8_t channel,
+                             const OUTPUT_STATE_REGISTER &reg_value)
+    {
+        uint8_t *regs = &shadow_[channel * OUTPUT_REGISTER_SIZE];
+        const uint8_t value[OUTPUT_REGISTER_SIZE] =
+        {
+            static_cast<uint8_t>(reg_value.on.value & 0xFF),
+            static_cast<uint8_t>(reg_value.on.value >> 8),
+            static_cast<uint8_t>(reg_value.off.value & 0xFF),
+            static_cast<uint8_t>(reg_value.off.value >> 8)
+        };
+        if (memcmp(regs, value, OUTPUT_REGISTER_SIZE))
+        {
+            memcpy(regs, value, OUTPUT_REGISTER_SIZE);
+            dirty_ |= (1 << channel);
+        }
+    }
 };
\ No newline at end of file
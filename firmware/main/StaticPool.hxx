@@ -0,0 +1,113 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/// Fixed capacity container which constructs objects in place within it's
+/// own storage, no heap allocations are performed.
+///
+/// Objects can only be added to the pool and are destroyed together by
+/// @ref clear (or when the pool is destroyed), objects never move so
+/// pointers and references to them remain valid until then.
+///
+/// @param T Type of object held by the pool.
+/// @param CAPACITY Maximum number of objects in the pool.
+template <typename T, std::size_t CAPACITY>
+class StaticPool
+{
+public:
+    /// Constructor.
+    StaticPool() = default;
+
+    /// Destructor, destroys all objects in the pool.
+    ~StaticPool()
+    {
+        clear();
+    }
+
+    /// Constructs a new object at the end of the pool.
+    ///
+    /// @param args Arguments to pass to the constructor of @param T.
+    ///
+    /// @return pointer to the new object or nullptr when the pool is full.
+    template <typename... Args>
+    T *emplace(Args &&...args)
+    {
+        if (size_ >= CAPACITY)
+        {
+            return nullptr;
+        }
+        T *object = new (&storage_[size_]) T(std::forward<Args>(args)...);
+        size_++;
+        return object;
+    }
+
+    /// Destroys all objects in the pool, in reverse order of creation.
+    void clear()
+    {
+        while (size_)
+        {
+            (*this)[--size_].~T();
+        }
+    }
+
+    /// @return number of objects in the pool.
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    /// @return true if the pool does not contain any objects.
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    /// @return maximum number of objects in the pool.
+    static constexpr std::size_t capacity()
+    {
+        return CAPACITY;
+    }
+
+    /// @return object at @param index, this must be less than @ref size.
+    T &operator[](std::size_t index)
+    {
+        return *std::launder(reinterpret_cast<T *>(&storage_[index]));
+    }
+
+    /// @return object at @param index, this must be less than @ref size.
+    const T &operator[](std::size_t index) const
+    {
+        return *std::launder(reinterpret_cast<const T *>(&storage_[index]));
+    }
+
+    /// @return pointer to the first object in the pool.
+    T *begin()
+    {
+        return reinterpret_cast<T *>(storage_);
+    }
+
+    /// @return pointer past the last object in the pool.
+    T *end()
+    {
+        return begin() + size_;
+    }
+
+private:
+    StaticPool(const StaticPool &) = delete;
+    StaticPool &operator=(const StaticPool &) = delete;
+
+    /// Storage for the objects.
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage_[CAPACITY];
+
+    /// Number of objects which have been constructed in @ref storage_.
+    std::size_t size_{0};
+};
@@ -0,0 +1,303 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <esp_cpu.h>
+#include <esp_log.h>
+#include <esp_pthread.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <thread>
+#include <vector>
+
+#include "config.hxx"
+#include "Trace.hxx"
+
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0,
+              "TRACE_RING_SIZE must be a power of two");
+
+/// Log tag to use for formatted trace records.
+static constexpr const char *const TAG = "trace";
+
+/// Single trace record.
+///
+/// The sequence number is cleared while the record is being written and is
+/// set to the ring index plus one once the record is complete, readers copy
+/// the record and discard it if the sequence number is not the expected
+/// value both before and after the copy.
+struct trace_record_t
+{
+    /// Ring index of the record plus one, zero while being written.
+    std::atomic<uint32_t> seq;
+
+    /// Lower 32 bits of the @ref esp_timer_get_time timestamp.
+    uint32_t timestamp;
+
+    /// Feeder ID or @ref TRACE_NO_FEEDER.
+    uint16_t feeder;
+
+    /// @ref trace_event_t of the record.
+    uint8_t event;
+
+    /// First event argument.
+    uint32_t arg0;
+
+    /// Second event argument.
+    uint32_t arg1;
+};
+
+/// Ring of trace records for a single CPU core.
+struct trace_ring_t
+{
+    /// Next ring index to write, this is never wrapped.
+    std::atomic<uint32_t> head{0};
+
+    /// Trace records.
+    trace_record_t records[TRACE_RING_SIZE];
+};
+
+/// Copy of a complete trace record, used when formatting.
+struct trace_entry_t
+{
+    /// CPU core that recorded the event.
+    uint8_t core;
+
+    /// Lower 32 bits of the timestamp.
+    uint32_t timestamp;
+
+    /// Feeder ID or @ref TRACE_NO_FEEDER.
+    uint16_t feeder;
+
+    /// @ref trace_event_t of the record.
+    uint8_t event;
+
+    /// First event argument.
+    uint32_t arg0;
+
+    /// Second event argument.
+    uint32_t arg1;
+};
+
+/// Trace rings, one per CPU core.
+static trace_ring_t rings[portNUM_PROCESSORS];
+
+/// Format of each @ref trace_event_t, the two event arguments are passed as
+/// unsigned integers in order.
+static constexpr const char *const TRACE_EVENT_FORMATS[TRACE_EVENT_COUNT] =
+{
+    "command %c%" PRIu32,
+    "request M%" PRIu32,
+    "advance from position:%" PRIu32 " remaining:%" PRIu32 "mm",
+    "remaining:%" PRIu32 "mm",
+    "movement complete",
+    "settled after %" PRIu32 "ms (learned %" PRIu32 "ms)",
+    "prefeed %" PRIu32 "mm",
+    "waiting for motion slot (%" PRIu32 " deg)",
+    "moving to %" PRIu32 " deg over %" PRIu32 "ms",
+    "binary request opcode:%" PRIu32 " seq:%" PRIu32
+};
+
+void trace(trace_event_t event, uint16_t feeder, uint32_t arg0, uint32_t arg1)
+{
+    trace_ring_t &ring = rings[esp_cpu_get_core_id()];
+    const uint32_t index = ring.head.fetch_add(1, std::memory_order_relaxed);
+    trace_record_t &record = ring.records[index & (TRACE_RING_SIZE - 1)];
+    record.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record.timestamp = esp_timer_get_time();
+    record.feeder = feeder;
+    record.event = event;
+    record.arg0 = arg0;
+    record.arg1 = arg1;
+    record.seq.store(index + 1, std::memory_order_release);
+}
+
+/// Copies a trace record.
+///
+/// @param core CPU core of the ring to read from.
+/// @param index Ring index to read.
+/// @param entry Receives the record.
+///
+/// @return zero if the record was copied, negative if the record has not yet
+/// been completed or positive if it has been overwritten.
+static int read_record(uint8_t core, uint32_t index, trace_entry_t &entry)
+{
+    const trace_record_t &record =
+        rings[core].records[index & (TRACE_RING_SIZE - 1)];
+    const uint32_t expected = index + 1;
+    const uint32_t before = record.seq.load(std::memory_order_acquire);
+    entry.core = core;
+    entry.timestamp = record.timestamp;
+    entry.feeder = record.feeder;
+    entry.event = record.event;
+    entry.arg0 = record.arg0;
+    entry.arg1 = record.arg1;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint32_t after = record.seq.load(std::memory_order_relaxed);
+    if (before == expected && after == expected)
+    {
+        return 0;
+    }
+    auto newer = [expected](uint32_t seq)
+    {
+        return seq && static_cast<int32_t>(seq - expected) > 0;
+    };
+    // a zero (or older) sequence number means the record has been reserved
+    // but not yet written.
+    return newer(before) || newer(after) ? 1 : -1;
+}
+
+/// Formats a single trace record.
+///
+/// @param entry Record to format.
+/// @param buffer Receives the formatted record.
+/// @param size Size of @param buffer.
+static void format_entry(const trace_entry_t &entry, char *buffer,
+                         std::size_t size)
+{
+    int offset;
+    if (entry.feeder == TRACE_NO_FEEDER)
+    {
+        offset = snprintf(buffer, size, "%10" PRIu32 " [%u] ",
+                          entry.timestamp, entry.core);
+    }
+    else
+    {
+        offset = snprintf(buffer, size, "%10" PRIu32 " [%u] feeder:%u ",
+                          entry.timestamp, entry.core, entry.feeder);
+    }
+    if (offset < 0 || static_cast<std::size_t>(offset) >= size)
+    {
+        return;
+    }
+    if (entry.event < TRACE_EVENT_COUNT)
+    {
+        snprintf(buffer + offset, size - offset,
+                 TRACE_EVENT_FORMATS[entry.event], entry.arg0, entry.arg1);
+    }
+    else
+    {
+        snprintf(buffer + offset, size - offset, "event:%u", entry.event);
+    }
+}
+
+std::string format_trace(std::size_t count)
+{
+    std::vector<trace_entry_t> entries;
+    entries.reserve(std::min(count, TRACE_RING_SIZE) * portNUM_PROCESSORS);
+    for (uint8_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        const uint32_t head = rings[core].head.load(std::memory_order_acquire);
+        const uint32_t available = std::min<std::size_t>(
+            {static_cast<std::size_t>(head), TRACE_RING_SIZE, count});
+        for (uint32_t index = head - available; index != head; index++)
+        {
+            trace_entry_t entry;
+            if (!read_record(core, index, entry))
+            {
+                entries.push_back(entry);
+            }
+        }
+    }
+
+    // the timestamps are truncated to 32 bits, ordering by age relative to
+    // the current time is correct as long as the records are less than ~71
+    // minutes old.
+    const uint32_t now = esp_timer_get_time();
+    std::stable_sort(entries.begin(), entries.end(),
+        [now](const trace_entry_t &lhs, const trace_entry_t &rhs)
+        {
+            return (now - lhs.timestamp) > (now - rhs.timestamp);
+        });
+    if (entries.size() > count)
+    {
+        entries.erase(entries.begin(), entries.end() - count);
+    }
+
+    std::string result;
+    result.reserve(entries.size() * 64);
+    for (auto &entry : entries)
+    {
+        char line[96];
+        format_entry(entry, line, sizeof(line));
+        if (!result.empty())
+        {
+            result.append("\n");
+        }
+        result.append(line);
+    }
+    return result;
+}
+
+/// Periodically formats new trace records to the log.
+static void trace_drain()
+{
+    uint32_t cursors[portNUM_PROCESSORS] = {};
+    while (true)
+    {
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(TRACE_DRAIN_INTERVAL_MS));
+        for (uint8_t core = 0; core < portNUM_PROCESSORS; core++)
+        {
+            const uint32_t head =
+                rings[core].head.load(std::memory_order_acquire);
+            uint32_t dropped = 0;
+            if (head - cursors[core] > TRACE_RING_SIZE)
+            {
+                dropped = head - cursors[core] - TRACE_RING_SIZE;
+                cursors[core] = head - TRACE_RING_SIZE;
+            }
+            for (; cursors[core] != head; cursors[core]++)
+            {
+                trace_entry_t entry;
+                const int result = read_record(core, cursors[core], entry);
+                if (result < 0)
+                {
+                    // record is still being written, retry on the next pass.
+                    break;
+                }
+                else if (result > 0)
+                {
+                    dropped++;
+                    continue;
+                }
+                char line[96];
+                format_entry(entry, line, sizeof(line));
+                ESP_LOGI(TAG, "%s", line);
+            }
+            if (dropped)
+            {
+                ESP_LOGW(TAG, "[%u] %" PRIu32 " records dropped", core,
+                         dropped);
+            }
+        }
+    }
+}
+
+void start_trace_drain()
+{
+    if (!TRACE_DRAIN_TO_LOG)
+    {
+        return;
+    }
+
+    // std::thread does not expose options for thread name, stack size or
+    // pinning to a core. ESP-IDF provides a pthread extension for this which
+    // must be called prior to thread creation.
+    auto cfg = esp_pthread_get_default_config();
+    cfg.thread_name = "trace";
+    cfg.prio = TRACE_DRAIN_PRIORITY;
+    esp_pthread_set_cfg(&cfg);
+    std::thread(trace_drain).detach();
+
+    // restore the default configuration for any threads created later.
+    cfg = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&cfg);
+}
@@ -0,0 +1,85 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: CC-BY-NC-SA-4.0
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// Events that can be recorded with @ref trace.
+typedef enum : uint8_t
+{
+    /// GCode command has been received, arg0 is the command letter and arg1
+    /// is the command code.
+    TRACE_COMMAND,
+
+    /// Feeder request has been received by the @ref FeederManager, arg0 is
+    /// the M-code of the request.
+    TRACE_FEEDER_REQUEST,
+
+    /// Feeder is advancing, arg0 is the current position and arg1 is the
+    /// remaining movement in mm.
+    TRACE_FEEDER_ADVANCE,
+
+    /// Feeder movement continues with another advance, arg0 is the
+    /// remaining movement in mm.
+    TRACE_FEEDER_REMAINING,
+
+    /// Feeder movement has completed and the servo has been turned off.
+    TRACE_FEEDER_COMPLETE,
+
+    /// Feeder has settled using the adaptive settle time, arg0 is the time
+    /// spent settling and arg1 is the updated learned settle time, both in
+    /// milliseconds.
+    TRACE_FEEDER_SETTLED,
+
+    /// Pre-feed movement has started, arg0 is the distance in mm.
+    TRACE_FEEDER_PREFEED,
+
+    /// Servo movement is waiting for a motion slot, arg0 is the target
+    /// angle.
+    TRACE_SERVO_WAITING,
+
+    /// Servo movement has started, arg0 is the target angle and arg1 is the
+    /// duration in milliseconds.
+    TRACE_SERVO_MOVE,
+
+    /// Binary protocol request has been received, arg0 is the opcode and
+    /// arg1 is the sequence number.
+    TRACE_BINARY_REQUEST,
+
+    /// Number of trace events, must be last.
+    TRACE_EVENT_COUNT
+} trace_event_t;
+
+/// Feeder ID to use for events which are not related to a feeder.
+static constexpr uint16_t TRACE_NO_FEEDER = UINT16_MAX;
+
+/// Records a trace event into the ring buffer for the current CPU core.
+///
+/// Recording an event does not allocate, format or lock, the event is
+/// formatted later by the drain thread (@ref start_trace_drain) or when the
+/// trace is dumped (@ref format_trace).
+///
+/// @param event @ref trace_event_t to record.
+/// @param feeder Feeder ID the event relates to or @ref TRACE_NO_FEEDER.
+/// @param arg0 First event argument.
+/// @param arg1 Second event argument.
+void trace(trace_event_t event, uint16_t feeder, uint32_t arg0 = 0,
+           uint32_t arg1 = 0);
+
+/// Formats the most recent trace events from all CPU cores, oldest first.
+///
+/// @param count Maximum number of events to format.
+///
+/// @return @ref std::string with one line per event.
+std::string format_trace(std::size_t count);
+
+/// Starts the low priority thread which periodically formats new trace
+/// events to the log, this does nothing when @ref TRACE_DRAIN_TO_LOG is
+/// false.
+void start_trace_drain();
@@ -4,7 +4,12 @@
  * SPDX-License-Identifier: CC-BY-NC-SA-4.0
  */
 
+#include <algorithm>
+#include <cinttypes>
+#include <esp_mac.h>
 #include <esp_netif_types.h>
+
+#include "config.hxx"
 #include "WiFiManager.hxx"
 
 WiFiManager::WiFiManager(const char *const ssid, const char *const password,
@@ -20,6 +25,11 @@ WiFiManager::~WiFiManager()
                                  &WiFiManager::process_idf_event);
     esp_event_handler_unregister(IP_EVENT, ESP_EVENT_ANY_ID,
                                  &WiFiManager::process_idf_event);
+    if (reconnectTimer_ != nullptr)
+    {
+        esp_timer_stop(reconnectTimer_);
+        esp_timer_delete(reconnectTimer_);
+    }
 }
 
 bool WiFiManager::start()
@@ -42,6 +52,22 @@ bool WiFiManager::start()
     ESP_LOGI(TAG, "Setting hostname to \"%s\".", hostname_.c_str());
     ESP_ERROR_CHECK(esp_netif_set_hostname(staIface_, hostname_.c_str()));
 
+    if (strlen(WIFI_STATIC_IP))
+    {
+        configure_static_ip();
+    }
+
+    // reconnect attempts after the first are made from this timer so that
+    // the delay between attempts does not block the event loop.
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = [](void *arg)
+    {
+        static_cast<WiFiManager *>(arg)->connect();
+    };
+    timer_args.arg = this;
+    timer_args.name = "wifi_reconnect";
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &reconnectTimer_));
+
     // Connect our event listeners.
     esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
                                &WiFiManager::process_idf_event, this);
@@ -75,6 +101,14 @@ bool WiFiManager::start()
     ESP_ERROR_CHECK(esp_wifi_start());
     ESP_ERROR_CHECK(esp_wifi_set_max_tx_power(84));
 
+    if (WIFI_LOW_LATENCY)
+    {
+        // modem sleep delays received packets until the next DTIM beacon,
+        // this shows up as 100ms+ spikes in the command response time.
+        ESP_LOGI(TAG, "Disabling WiFi power save");
+        ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
+    }
+
     EventBits_t bits;
     for (uint8_t attempts = 1; attempts <= MAX_CONNECTION_CHECK_ATTEMPTS;
          attempts++)
@@ -127,14 +161,22 @@ void WiFiManager::process_idf_event(void *ctx, esp_event_base_t event_base,
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
     {
         ESP_LOGI(TAG, "WiFi station started.");
-        ESP_ERROR_CHECK(esp_wifi_connect());
+        wifi_mgr->connect();
     }
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
     {
         wifi_event_sta_connected_t *data =
             static_cast<wifi_event_sta_connected_t *>(event_data);
 
-        ESP_LOGI(TAG, "Connected to SSID:%s", data->ssid);
+        ESP_LOGI(TAG, "Connected to SSID:%s (BSSID:" MACSTR " channel:%d)",
+                 data->ssid, MAC2STR(data->bssid), data->channel);
+        if (WIFI_LOW_LATENCY)
+        {
+            // remember the AP so that reconnecting can skip the scan.
+            memcpy(wifi_mgr->cachedBssid_, data->bssid,
+                   sizeof(wifi_mgr->cachedBssid_));
+            wifi_mgr->cachedChannel_ = data->channel;
+        }
         // Set the flag that indictes we are connected to the SSID.
         xEventGroupSetBits(wifi_mgr->wifiStatus_, WIFI_CONNECTED_BIT);
     }
@@ -171,15 +213,28 @@ void WiFiManager::process_idf_event(void *ctx, esp_event_base_t event_base,
 
         if (was_previously_connected)
         {
+            // The GCode and binary servers listen on all addresses so their
+            // acceptors remain valid while reconnecting, only the connected
+            // clients are lost.
             ESP_LOGI(TAG, "Reconnecting to SSID:%s.",
                      data->ssid);
+            wifi_mgr->disconnectedAt_ = esp_timer_get_time();
+            wifi_mgr->reconnectDelay_ = 0;
         }
         else
         {
             ESP_LOGI(TAG, "Connection to SSID:%s (reason:%d) failed",
                      data->ssid, data->reason);
+            if (wifi_mgr->cachedChannel_ &&
+                data->reason == WIFI_REASON_NO_AP_FOUND)
+            {
+                // the AP may have moved to another channel, fall back to a
+                // full scan.
+                ESP_LOGW(TAG, "Cached AP not found, scanning all channels");
+                wifi_mgr->cachedChannel_ = 0;
+            }
         }
-        ESP_ERROR_CHECK(esp_wifi_connect());
+        wifi_mgr->schedule_reconnect();
     }
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
     {
@@ -187,6 +242,16 @@ void WiFiManager::process_idf_event(void *ctx, esp_event_base_t event_base,
             static_cast<ip_event_got_ip_t *>(event_data);
 
         ESP_LOGI(TAG, "IP address:" IPSTR, IP2STR(&data->ip_info.ip));
+        wifi_mgr->reconnectDelay_ = 0;
+        if (wifi_mgr->disconnectedAt_)
+        {
+            const uint32_t elapsed_ms =
+                (esp_timer_get_time() - wifi_mgr->disconnectedAt_) / 1000;
+            wifi_mgr->disconnectedAt_ = 0;
+            wifi_mgr->lastReconnectMs_ = elapsed_ms;
+            wifi_mgr->reconnectCount_++;
+            ESP_LOGI(TAG, "Reconnected in %" PRIu32 "ms", elapsed_ms);
+        }
         // Set the flag that indictes we have an IPv4 address.
         xEventGroupSetBits(wifi_mgr->wifiStatus_, WIFI_GOTIP_BIT);
     }
@@ -203,4 +268,92 @@ esp_ip4_addr_t WiFiManager::get_local_ip()
     esp_netif_ip_info_t ip_info;
     ESP_ERROR_CHECK(esp_netif_get_ip_info(staIface_, &ip_info));
     return ip_info.ip;
-}
\ No newline at end of file
+}
+void WiFiManager::log_status()
+{
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK)
+    {
+        ESP_LOGI(TAG,
+                 "SSID:%s BSSID:" MACSTR " channel:%d RSSI:%d reconnects:%"
+                 PRIu32 " last reconnect:%" PRIu32 "ms",
+                 ap_info.ssid, MAC2STR(ap_info.bssid), ap_info.primary,
+                 ap_info.rssi, reconnectCount_.load(),
+                 lastReconnectMs_.load());
+    }
+    else
+    {
+        ESP_LOGW(TAG,
+                 "Not connected, reconnects:%" PRIu32 " last reconnect:%"
+                 PRIu32 "ms", reconnectCount_.load(), lastReconnectMs_.load());
+    }
+}
+
+void WiFiManager::configure_static_ip()
+{
+    ESP_LOGI(TAG, "Using static IP:%s netmask:%s gateway:%s", WIFI_STATIC_IP,
+             WIFI_STATIC_NETMASK, WIFI_STATIC_GATEWAY);
+    esp_err_t res = esp_netif_dhcpc_stop(staIface_);
+    if (res != ESP_OK && res != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED)
+    {
+        ESP_LOGE(TAG, "Failed to stop DHCP client:%s", esp_err_to_name(res));
+        abort();
+    }
+
+    esp_netif_ip_info_t ip_info;
+    memset(&ip_info, 0, sizeof(esp_netif_ip_info_t));
+    ip_info.ip.addr = esp_ip4addr_aton(WIFI_STATIC_IP);
+    ip_info.netmask.addr = esp_ip4addr_aton(WIFI_STATIC_NETMASK);
+    ip_info.gw.addr = esp_ip4addr_aton(WIFI_STATIC_GATEWAY);
+    ESP_ERROR_CHECK(esp_netif_set_ip_info(staIface_, &ip_info));
+
+    const char *dns = strlen(WIFI_STATIC_DNS) ? WIFI_STATIC_DNS
+                                              : WIFI_STATIC_GATEWAY;
+    if (strlen(dns))
+    {
+        esp_netif_dns_info_t dns_info;
+        memset(&dns_info, 0, sizeof(esp_netif_dns_info_t));
+        dns_info.ip.type = ESP_IPADDR_TYPE_V4;
+        dns_info.ip.u_addr.ip4.addr = esp_ip4addr_aton(dns);
+        ESP_ERROR_CHECK(
+            esp_netif_set_dns_info(staIface_, ESP_NETIF_DNS_MAIN, &dns_info));
+    }
+}
+
+void WiFiManager::connect()
+{
+    wifi_config_t conf;
+    ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &conf));
+    if (cachedChannel_)
+    {
+        // connecting to a known BSSID on a known channel only probes that
+        // channel instead of scanning all of them.
+        conf.sta.bssid_set = true;
+        memcpy(conf.sta.bssid, cachedBssid_, sizeof(conf.sta.bssid));
+        conf.sta.channel = cachedChannel_;
+    }
+    else
+    {
+        conf.sta.bssid_set = false;
+        conf.sta.channel = 0;
+    }
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_wifi_set_config(WIFI_IF_STA, &conf));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_wifi_connect());
+}
+
+void WiFiManager::schedule_reconnect()
+{
+    if (reconnectDelay_ == 0)
+    {
+        // first attempt after losing the connection is made immediately.
+        reconnectDelay_ = WIFI_RECONNECT_MIN_DELAY_MS;
+        connect();
+        return;
+    }
+    ESP_LOGI(TAG, "Reconnecting in %" PRIu32 "ms", reconnectDelay_);
+    esp_timer_stop(reconnectTimer_);
+    ESP_ERROR_CHECK(
+        esp_timer_start_once(reconnectTimer_, reconnectDelay_ * 1000ULL));
+    reconnectDelay_ =
+        std::min<uint32_t>(reconnectDelay_ * 2, WIFI_RECONNECT_MAX_DELAY_MS);
+}
@@ -6,9 +6,11 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstring>
 #include <esp_event.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
 #include <esp_netif.h>
 #include <freertos/event_groups.h>
@@ -50,6 +52,10 @@ public:
     /// @returns Currently assigned IP address.
     esp_ip4_addr_t get_local_ip();
 
+    /// Logs the signal strength of the connection and the reconnect
+    /// statistics.
+    void log_status();
+
 private:
     /// Log tag to use for this class.
     static constexpr const char * TAG = "wifi_mgr";
@@ -89,4 +95,38 @@ private:
     /// Bit mask used for checking WiFi connection process events.
     uint32_t wifiConnectBitMask_{WIFI_CONNECTED_BIT};
 
+    /// Timer used to delay reconnect attempts.
+    esp_timer_handle_t reconnectTimer_{nullptr};
+
+    /// Delay before the next reconnect attempt, in milliseconds.
+    uint32_t reconnectDelay_{0};
+
+    /// BSSID of the AP from the last successful connection.
+    uint8_t cachedBssid_[6];
+
+    /// Channel of the AP from the last successful connection, zero when no
+    /// AP has been cached.
+    uint8_t cachedChannel_{0};
+
+    /// Time (from esp_timer_get_time) at which the connection was lost, zero
+    /// when connected.
+    int64_t disconnectedAt_{0};
+
+    /// Number of times the connection has been re-established.
+    std::atomic<uint32_t> reconnectCount_{0};
+
+    /// Time taken by the most recent reconnect, from losing the connection
+    /// to having an IP address, in milliseconds.
+    std::atomic<uint32_t> lastReconnectMs_{0};
+
+    /// Configures @ref staIface_ with @ref WIFI_STATIC_IP.
+    void configure_static_ip();
+
+    /// Updates the station configuration to connect directly to the cached
+    /// AP (if any) and starts a connection attempt.
+    void connect();
+
+    /// Schedules a connection attempt after the current reconnect delay and
+    /// increases the delay for the next attempt.
+    void schedule_reconnect();
 };
\ No newline at end of file
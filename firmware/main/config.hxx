@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <hal/gpio_types.h>
 
@@ -18,6 +19,34 @@ static constexpr const char * const WIFI_PASSWORD = "";
 /// Hostname to assign to the device upon connection to WiFi.
 static constexpr const char * const WIFI_HOSTNAME = "esp32feeder";
 
+/// When set to true WiFi modem power save is disabled and the BSSID and
+/// channel of the AP are remembered so that reconnecting after a dropped
+/// connection skips the full channel scan. This increases power usage but
+/// avoids the latency spikes caused by the modem sleeping between beacons.
+static constexpr bool WIFI_LOW_LATENCY = true;
+
+/// Static IPv4 address to assign to the device, when blank DHCP is used
+/// (with CONFIG_LWIP_DHCP_RESTORE_LAST_IP the previous address is requested
+/// again after reconnecting).
+static constexpr const char * const WIFI_STATIC_IP = "";
+
+/// Netmask to use with @ref WIFI_STATIC_IP.
+static constexpr const char * const WIFI_STATIC_NETMASK = "255.255.255.0";
+
+/// Gateway to use with @ref WIFI_STATIC_IP.
+static constexpr const char * const WIFI_STATIC_GATEWAY = "";
+
+/// DNS server to use with @ref WIFI_STATIC_IP, when blank the gateway is
+/// used.
+static constexpr const char * const WIFI_STATIC_DNS = "";
+
+/// Delay in milliseconds before the first reconnect attempt after the WiFi
+/// connection has been lost, the delay doubles after each failed attempt.
+static constexpr uint32_t WIFI_RECONNECT_MIN_DELAY_MS = 100;
+
+/// Maximum delay in milliseconds between reconnect attempts.
+static constexpr uint32_t WIFI_RECONNECT_MAX_DELAY_MS = 5000;
+
 /// When set to true any detected feeders will automatically be enabled.
 static constexpr bool AUTO_ENABLE_FEEDERS = true;
 
@@ -34,9 +63,48 @@ static constexpr uint8_t DEFAULT_FEEDER_RETRACT_ANGLE = 15;
 /// Default feeder servo settlement time in milliseconds.
 static constexpr uint16_t DEFAULT_FEEDER_SETTLE_TIME_MS = 240;
 
+/// When set to true feeders with feedback enabled learn how long the
+/// mechanism takes to settle after each servo movement from the time the
+/// tension feedback is restored, and wait only that long (plus
+/// @ref FEEDER_ADAPTIVE_SETTLE_MARGIN_MS) instead of the configured settle
+/// time. The configured settle time remains the upper limit.
+static constexpr bool FEEDER_ADAPTIVE_SETTLE = true;
+
+/// Safety margin in milliseconds added to the learned settle time.
+static constexpr uint16_t FEEDER_ADAPTIVE_SETTLE_MARGIN_MS = 30;
+
+/// Minimum settle time in milliseconds when using the learned settle time.
+static constexpr uint16_t FEEDER_ADAPTIVE_SETTLE_MIN_MS = 40;
+
+/// Weight of the existing learned settle time when a new measurement is
+/// averaged in, higher values adapt more slowly.
+static constexpr uint16_t FEEDER_ADAPTIVE_SETTLE_WEIGHT = 4;
+
+/// Minimum change in milliseconds of a learned settle time before it is
+/// persisted again, this avoids writing to flash after every movement.
+static constexpr uint16_t FEEDER_ADAPTIVE_SETTLE_PERSIST_DELTA_MS = 10;
+
 /// Default feeder servo movement interval in milliseconds.
 static constexpr uint16_t DEFAULT_FEEDER_MOVEMENT_INTERVAL_MS = 10;
 
+/// Interval in milliseconds at which moving feeders are advanced, all servo
+/// updates for a single PCA9685 are sent together once per interval.
+static constexpr uint16_t FEEDER_MOTION_TICK_MS = 10;
+
+/// Maximum number of servos connected to a single PCA9685 that can be moving
+/// at the same time, additional movements are delayed until one of the
+/// servos has reached its target angle.
+static constexpr std::size_t FEEDER_MAX_MOVING_PER_PCA9685 = 4;
+
+/// Maximum number of servos that can be moving at the same time across all
+/// PCA9685 devices, this should be sized to the power supply.
+static constexpr std::size_t FEEDER_MAX_MOVING_TOTAL = 8;
+
+/// Maximum number of feeders that can be created, storage for all of them is
+/// reserved statically at build time. Reducing this to match the number of
+/// connected PCA9685 devices (16 feeders each) saves memory.
+static constexpr std::size_t FEEDER_POOL_SIZE = 128;
+
 /// Default minimum number of pulses to send the servo.
 static constexpr uint16_t DEFAULT_FEEDER_MIN_PULSE_COUNT = 150;
 
@@ -49,8 +117,179 @@ static constexpr gpio_num_t I2C_SCL_PIN_NUM = GPIO_NUM_21;
 /// Pin to use for I2C SDA.
 static constexpr gpio_num_t I2C_SDA_PIN_NUM = GPIO_NUM_23;
 
-/// I2C Bus Speed in Hz.
+/// I2C Bus Speed in Hz, when @ref I2C_CLOCK_CALIBRATION is enabled this is
+/// the slowest speed that will be used.
 static constexpr uint32_t I2C_BUS_SPEED = 100000;
 
+/// Pin to use for SCL on the second I2C bus, when set to GPIO_NUM_NC the
+/// second I2C bus will not be used.
+static constexpr gpio_num_t I2C2_SCL_PIN_NUM = GPIO_NUM_NC;
+
+/// Pin to use for SDA on the second I2C bus, when set to GPIO_NUM_NC the
+/// second I2C bus will not be used.
+static constexpr gpio_num_t I2C2_SDA_PIN_NUM = GPIO_NUM_NC;
+
+/// Second I2C Bus Speed in Hz.
+static constexpr uint32_t I2C2_BUS_SPEED = I2C_BUS_SPEED;
+
+/// When true the clock speed of each I2C bus is calibrated during startup,
+/// the speeds in @ref I2C_CLOCK_STEPS above the configured bus speed are
+/// tried in order until a device fails verification. One step slower than the
+/// fastest speed that passed is used, but never below the configured bus
+/// speed. The speed is reduced again at runtime if the bus error rate rises.
+static constexpr bool I2C_CLOCK_CALIBRATION = true;
+
+/// I2C clock speeds in Hz which are tried by the calibration, in ascending
+/// order. The PCA9685 and ESP32 support up to 1MHz (Fast-mode Plus).
+static constexpr uint32_t I2C_CLOCK_STEPS[] =
+{
+    100000, 250000, 400000, 700000, 1000000
+};
+
+/// Number of verification write and read-back rounds performed with every
+/// detected device at each clock speed during calibration.
+static constexpr std::size_t I2C_CALIBRATION_ROUNDS = 16;
+
+/// Number of milliseconds between checks of the I2C bus error rate.
+static constexpr uint32_t I2C_HEALTH_CHECK_INTERVAL_MS = 1000;
+
+/// Minimum number of failed (not acknowledged or timed out) I2C transfers
+/// within @ref I2C_HEALTH_CHECK_INTERVAL_MS before the clock speed of the
+/// bus is reduced.
+static constexpr uint32_t I2C_STEP_DOWN_MIN_FAILURES = 3;
+
+/// Failed I2C transfers per thousand transfers within
+/// @ref I2C_HEALTH_CHECK_INTERVAL_MS at which the clock speed of the bus is
+/// reduced.
+static constexpr uint32_t I2C_STEP_DOWN_FAILURE_RATE = 10;
+
+/// Maximum number of devices on each I2C bus to collect usage counters for,
+/// this should cover all PCA9685 and MCP23017 devices (up to eight of each).
+static constexpr std::size_t I2C_METRICS_MAX_DEVICES = 16;
+
+/// Number of milliseconds to wait for a device to respond when probing the
+/// I2C bus for PCA9685 and MCP23017 devices during startup.
+static constexpr int32_t I2C_PROBE_TIMEOUT_MS = 10;
+
+/// Maximum number of feeders to start homing (retracting) at the same time
+/// during startup, this limits the current drawn by the servos.
+static constexpr std::size_t FEEDER_HOMING_BATCH_SIZE = 4;
+
+/// Number of milliseconds between starting each batch of feeders homing
+/// during startup.
+static constexpr uint32_t FEEDER_HOMING_INTERVAL_MS = 250;
+
+/// Pin connected to the INTA pins of all MCP23017 devices, the MCP23017
+/// devices will be configured for open-drain mirrored interrupts so a single
+/// pin can be shared with an external pull-up. When set to GPIO_NUM_NC the
+/// MCP23017 devices will be polled for changes instead.
+static constexpr gpio_num_t MCP23017_INT_PIN = GPIO_NUM_NC;
+
+/// Interval in milliseconds at which MCP23017 devices are read when
+/// @ref MCP23017_INT_PIN is used, this catches any missed interrupts.
+static constexpr std::size_t MCP23017_WATCHDOG_INTERVAL_MS = 1000;
+
+/// Interval in milliseconds at which MCP23017 devices are read when any
+/// feeder using the device is moving or has recently changed state. This is
+/// only used when @ref MCP23017_INT_PIN is GPIO_NUM_NC.
+static constexpr std::size_t MCP23017_SCAN_FAST_INTERVAL_MS = 10;
+
+/// Interval in milliseconds at which idle MCP23017 devices are read. This is
+/// only used when @ref MCP23017_INT_PIN is GPIO_NUM_NC.
+static constexpr std::size_t MCP23017_SCAN_IDLE_INTERVAL_MS = 50;
+
+/// Duration in milliseconds that an MCP23017 device will continue to be read
+/// at @ref MCP23017_SCAN_FAST_INTERVAL_MS after feeder movement or an IO pin
+/// state change.
+static constexpr std::size_t MCP23017_SCAN_ACTIVE_HOLD_MS = 1000;
+
+/// CPU core to run the network (GCode) io_context on, this should match the
+/// core that the lwIP TCP/IP task is pinned to (CONFIG_LWIP_TCPIP_TASK_AFFINITY).
+static constexpr int NETWORK_CONTEXT_CORE = 1;
+
+/// Number of threads running the network (GCode) io_context.
+static constexpr std::size_t NETWORK_CONTEXT_THREADS = 2;
+
+/// Priority of the threads running the network (GCode) io_context.
+static constexpr std::size_t NETWORK_CONTEXT_PRIORITY = 5;
+
+/// CPU core to run the motion (feeder and I2C) io_context on.
+static constexpr int MOTION_CONTEXT_CORE = 0;
+
+/// Number of threads running the motion (feeder and I2C) io_context. Feeders
+/// are serialized per PCA9685 so additional threads only help when multiple
+/// PCA9685 devices are in use.
+static constexpr std::size_t MOTION_CONTEXT_THREADS = 1;
+
+/// Priority of the threads running the motion (feeder and I2C) io_context,
+/// this is above the network threads so that feeder movements are not
+/// delayed by network activity.
+static constexpr std::size_t MOTION_CONTEXT_PRIORITY = 7;
+
+/// Maximum number of I2C transactions that can be queued for the bus thread.
+static constexpr std::size_t I2C_QUEUE_DEPTH = 32;
+
+/// Maximum number of queued I2C transactions to combine into a single bus
+/// transfer.
+static constexpr std::size_t I2C_QUEUE_MAX_BATCH = 8;
+
+/// Timeout in milliseconds for a single queued I2C bus transfer.
+static constexpr int32_t I2C_QUEUE_TIMEOUT_MS = 50;
+
+/// CPU core to pin the I2C bus thread to.
+static constexpr int I2C_QUEUE_CORE = MOTION_CONTEXT_CORE;
+
+/// Priority of the I2C bus thread, this is above the motion threads so that
+/// queued transactions are executed as soon as they are submitted.
+static constexpr std::size_t I2C_QUEUE_PRIORITY = MOTION_CONTEXT_PRIORITY + 1;
+
 /// NVS namespace to use for all configuration data.
 static constexpr const char * const NVS_FEEDER_NAMESPACE = "esp32feeder";
+
+/// Number of milliseconds without further feeder configuration changes
+/// before the changes are persisted to NVS.
+static constexpr uint32_t FEEDER_CONFIG_COMMIT_DELAY_MS = 2000;
+
+/// Maximum number of GCode commands that can be received from a single client
+/// before the responses for earlier commands have been sent. Setting this to
+/// one will process commands strictly one at a time.
+static constexpr std::size_t GCODE_MAX_PIPELINED_COMMANDS = 8;
+
+/// Maximum number of bytes of feeder event lines (M621) that can be queued
+/// for a single client, events are dropped when a client does not read them
+/// fast enough.
+static constexpr std::size_t GCODE_EVENT_BUFFER_SIZE = 2048;
+
+/// Minimum number of milliseconds between feeder event (M621) batches, all
+/// changes to a feeder within this interval are coalesced into one event.
+static constexpr uint32_t FEEDER_EVENT_INTERVAL_MS = 50;
+
+/// When true the binary feeder protocol server is started alongside the
+/// GCode server.
+static constexpr bool BINARY_SERVER_ENABLED = true;
+
+/// Port number to listen on for binary feeder protocol connections.
+static constexpr uint16_t BINARY_SERVER_PORT = 8990;
+
+/// Maximum number of binary protocol requests that can be received from a
+/// single client before the responses for earlier requests have been sent.
+static constexpr std::size_t BINARY_MAX_PIPELINED_REQUESTS = 32;
+
+/// Number of trace records kept for each CPU core, this must be a power of
+/// two. Each record uses 20 bytes of RAM.
+static constexpr std::size_t TRACE_RING_SIZE = 256;
+
+/// When true new trace records are periodically formatted to the log by a
+/// low priority thread, when false the records are only available via M625.
+static constexpr bool TRACE_DRAIN_TO_LOG = true;
+
+/// Interval in milliseconds at which new trace records are formatted to the
+/// log.
+static constexpr uint32_t TRACE_DRAIN_INTERVAL_MS = 250;
+
+/// Priority of the trace drain thread, this is below the network and motion
+/// threads so that formatting never delays command processing.
+static constexpr std::size_t TRACE_DRAIN_PRIORITY = 1;
+
+/// Default number of trace records returned by M625.
+static constexpr std::size_t TRACE_DUMP_DEFAULT_COUNT = 32;
@@ -11,16 +11,21 @@
 #include <esp_log.h>
 #include <esp_ota_ops.h>
 #include <esp_pthread.h>
+#include <esp_timer.h>
+#include <memory>
 #include <nvs.h>
 #include <nvs_flash.h>
 #include <string>
 
+#include "BinaryServer.hxx"
 #include "config.hxx"
 #include "FeederManager.hxx"
 #include "WiFiManager.hxx"
 #include "GCodeServer.hxx"
+#include "Latency.hxx"
 #include "Utils.hxx"
 #include "SocInfo.hxx"
+#include "Trace.hxx"
 
 // Compile time validation of configuration parameters
 static_assert(__builtin_strlen(WIFI_SSID) > 0,
@@ -48,6 +53,47 @@ static void worker_task(asio::io_context &context)
     }
 }
 
+/// Starts worker threads for an @ref asio::io_context.
+///
+/// @param context @ref asio::io_context to run on the worker threads.
+/// @param name Prefix for the worker thread names.
+/// @param count Number of worker threads to create.
+/// @param core CPU core to pin the worker threads to.
+/// @param priority Priority for the worker threads.
+/// @param cores Number of CPU cores available.
+/// @param workers Container to receive the worker threads.
+static void start_workers(asio::io_context &context, const char *name,
+                          std::size_t count, int core, std::size_t priority,
+                          int cores, std::vector<std::thread> &workers)
+{
+    const char *const TAG = "main";
+    // single core SoCs only have core zero available.
+    if (core >= cores)
+    {
+        core = 0;
+    }
+    ESP_LOGI(TAG, "Creating %zu %s worker threads on core %d (priority %zu)",
+             count, name, core, priority);
+    for (std::size_t id = 0; id < count; id++)
+    {
+        // std::thread does not expose options for thread name, stack size or
+        // pinning to a core. ESP-IDF provides a pthread extension for this
+        // which must be called prior to thread creation.
+        auto cfg = esp_pthread_get_default_config();
+        std::string thread_name = name;
+        thread_name.append("-").append(std::to_string(id));
+        cfg.thread_name = thread_name.c_str();
+        cfg.pin_to_core = core;
+        cfg.prio = priority;
+        esp_pthread_set_cfg(&cfg);
+
+        // Create the worker thread which passes in the asio::io_context by
+        // reference. Internally the asio::io_context object will manage
+        // locking as required.
+        workers.emplace_back(std::thread(worker_task, std::ref(context)));
+    }
+}
+
 extern "C"
 {
 
@@ -102,10 +148,23 @@ void app_main()
         abort();
     }
 
-    asio::io_context context;
-    GCodeServer gcode_server(context, wifi.get_local_ip());
-    FeederManager feeder_mgr(gcode_server, context);
-    asio::system_timer heap_timer(context, std::chrono::seconds(30));
+    // Network (GCode) handling and feeder motion / I2C are executed on
+    // separate io_context instances running on separate cores so that
+    // network load does not introduce jitter into the feeder movements.
+    // Requests are handed off between the two via the feeder and client
+    // strands.
+    asio::io_context network_context;
+    asio::io_context motion_context;
+    GCodeServer gcode_server(network_context, wifi.get_local_ip());
+    FeederManager feeder_mgr(gcode_server, motion_context);
+    std::unique_ptr<BinaryServer> binary_server;
+    if (BINARY_SERVER_ENABLED)
+    {
+        binary_server = std::make_unique<BinaryServer>(network_context,
+                                                       wifi.get_local_ip());
+        feeder_mgr.register_binary_handlers(*binary_server);
+    }
+    asio::system_timer heap_timer(network_context, std::chrono::seconds(30));
     std::function<void(asio::error_code)> heap_monitor =
         [&](asio::error_code ec)
     {
@@ -120,6 +179,9 @@ void app_main()
                      heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 1024.0f,
                      heap_caps_get_total_size(MALLOC_CAP_SPIRAM) / 1024.0f);
 #endif // CONFIG_SPIRAM_SUPPORT
+            wifi.log_status();
+            log_latency();
+            feeder_mgr.log_bus_metrics();
             heap_timer.expires_from_now(std::chrono::seconds(30));
             heap_timer.async_wait(heap_monitor);
         }
@@ -129,28 +191,17 @@ void app_main()
     // in the background.
     heap_monitor({});
 
-    std::vector<std::thread> workers;
-    // Create two workers per core to increase concurrency of execution.
-    const int worker_count = chip_info.cores * 2;
-    ESP_LOGI(TAG, "Creating %d worker threads", worker_count);
-    for (int id = 0; id < worker_count; id++)
-    {
-        // std::thread does not expose options for thread name, stack size or
-        // pinning to a core. ESP-IDF provides a pthread extension for this
-        // which must be called prior to thread creation.
-        auto cfg = esp_pthread_get_default_config();
-        std::string name = "worker-";
-        name.append(std::to_string(id));
-        cfg.thread_name = name.c_str();
-        cfg.pin_to_core = id % 2;
-        esp_pthread_set_cfg(&cfg);
+    start_trace_drain();
 
-        // Create the worker thread which passes in the asio::io_context by
-        // reference. Internally the asio::io_context object will manage
-        // locking as required.
-        workers.emplace_back(std::thread(worker_task, std::ref(context)));
-    }
-    ESP_LOGI(TAG, "%s Ready!", app_data->project_name);
+    std::vector<std::thread> workers;
+    start_workers(network_context, "net", NETWORK_CONTEXT_THREADS,
+                  NETWORK_CONTEXT_CORE, NETWORK_CONTEXT_PRIORITY,
+                  chip_info.cores, workers);
+    start_workers(motion_context, "motion", MOTION_CONTEXT_THREADS,
+                  MOTION_CONTEXT_CORE, MOTION_CONTEXT_PRIORITY,
+                  chip_info.cores, workers);
+    ESP_LOGI(TAG, "%s Ready! (%lldms since power on)", app_data->project_name,
+             static_cast<long long>(esp_timer_get_time() / 1000));
 
     // Wait for all workers to exit.
     for (auto &worker : workers)